@@ -0,0 +1,402 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+// Necessary for the counters (Linux only) and the statistics
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "Vector.h"
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+using namespace std;
+
+// Support for the driver's "bench" command: hardware counters read through
+// perf_event_open(), and the statistics used to summarize and compare runs.
+//
+// The counters only count this thread in user space, which the default
+// perf_event_paranoid setting (2) allows without root. Counters the
+// machine or a virtual machine does not provide are reported as missing
+// rather than failing the benchmark.
+
+enum CounterKind
+{
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_CACHE_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_COUNT
+};
+
+inline const char* counterName(int counter)
+{
+    switch (counter)
+    {
+        case COUNTER_CYCLES:        return "cycles";
+        case COUNTER_INSTRUCTIONS:  return "instructions";
+        case COUNTER_CACHE_MISSES:  return "cache-misses";
+        case COUNTER_BRANCH_MISSES: return "branch-misses";
+        default:                    return "unknown";
+    }
+}
+
+// One file descriptor per counter, -1 where it could not be opened
+struct PerfCounters
+{
+    int fds[COUNTER_COUNT];
+};
+
+// Counter values, -1 for a counter that is not available
+struct CounterValues
+{
+    double values[COUNTER_COUNT];
+};
+
+inline CounterValues noCounterValues()
+{
+    CounterValues counts;
+    for (int k = 0; k < COUNTER_COUNT; k++)
+        counts.values[k] = -1;
+    return counts;
+}
+
+// Opens the counters for the calling thread and starts them. Returns false
+// if none of them is available.
+
+inline bool openCounters(PerfCounters& counters)
+{
+    bool any = false;
+    for (int k = 0; k < COUNTER_COUNT; k++)
+    {
+        counters.fds[k] = -1;
+#ifdef __linux__
+        static const unsigned long long configs[COUNTER_COUNT] =
+        {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.size           = sizeof(attr);
+        attr.config         = configs[k];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        // Scaled by the time each counter actually ran, in case the kernel
+        // has to take turns with more counters than the CPU has
+        attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        counters.fds[k] = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (counters.fds[k] >= 0)
+            any = true;
+#endif
+    }
+    return any;
+}
+
+inline void closeCounters(PerfCounters& counters)
+{
+    for (int k = 0; k < COUNTER_COUNT; k++)
+    {
+#ifdef __linux__
+        if (counters.fds[k] >= 0)
+            close(counters.fds[k]);
+#endif
+        counters.fds[k] = -1;
+    }
+}
+
+// Returns zero for every open counter and -1 for the others: the starting
+// total to add stage costs to.
+
+inline CounterValues zeroCounters(const PerfCounters& counters)
+{
+    CounterValues counts = noCounterValues();
+    for (int k = 0; k < COUNTER_COUNT; k++)
+    {
+        if (counters.fds[k] >= 0)
+            counts.values[k] = 0;
+    }
+    return counts;
+}
+
+// Reads the running totals of the counters. The cost of a stage is the
+// difference of two readings (see subtractCounters()).
+
+inline CounterValues readCounters(const PerfCounters& counters)
+{
+    CounterValues counts = noCounterValues();
+#ifdef __linux__
+    for (int k = 0; k < COUNTER_COUNT; k++)
+    {
+        unsigned long long data[3] = {0, 0, 0}; // value, enabled, running
+        if (counters.fds[k] >= 0 && read(counters.fds[k], data, sizeof(data)) == sizeof(data))
+            counts.values[k] = (data[2] > 0) ? (double) data[0] * data[1] / data[2] : 0;
+    }
+#else
+    (void) counters;
+#endif
+    return counts;
+}
+
+// Returns after - before, or -1 where a counter is missing.
+
+inline CounterValues subtractCounters(const CounterValues& after, const CounterValues& before)
+{
+    CounterValues counts = noCounterValues();
+    for (int k = 0; k < COUNTER_COUNT; k++)
+    {
+        if (after.values[k] >= 0 && before.values[k] >= 0)
+            counts.values[k] = after.values[k] - before.values[k];
+    }
+    return counts;
+}
+
+// Adds 'counts' to 'total', keeping missing counters missing.
+
+inline void addCounters(CounterValues& total, const CounterValues& counts)
+{
+    for (int k = 0; k < COUNTER_COUNT; k++)
+    {
+        if (counts.values[k] < 0)
+            total.values[k] = -1;
+        else if (total.values[k] >= 0)
+            total.values[k] += counts.values[k];
+    }
+}
+
+// ----------------------------------------------------//
+
+inline double mean(const Vector<double>& samples)
+{
+    double sum = 0;
+    for (int i = 0; i < samples.getSize(); i++)
+        sum += samples[i];
+    return (samples.getSize() > 0) ? sum / samples.getSize() : 0;
+}
+
+// Sample variance (divided by n - 1)
+
+inline double variance(const Vector<double>& samples)
+{
+    int n = samples.getSize();
+    if (n < 2)
+        return 0;
+
+    double average = mean(samples), sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += (samples[i] - average) * (samples[i] - average);
+    return sum / (n - 1);
+}
+
+// Returns the p-th percentile (0 to 100) of 'sorted', which has to be in
+// ascending order, interpolating between neighbouring samples.
+
+inline double percentile(const Vector<double>& sorted, double p)
+{
+    int n = sorted.getSize();
+    if (n == 0)
+        return 0;
+
+    double position = p / 100 * (n - 1);
+    int below = (int) position;
+    if (below >= n - 1)
+        return sorted[n - 1];
+    double fraction = position - below;
+    return sorted[below] + (sorted[below + 1] - sorted[below]) * fraction;
+}
+
+// Sorts 'samples' in ascending order. Heap sort, so that a million
+// latencies sort in O(N lg N) without recursion.
+
+inline void sortSamples(Vector<double>& samples)
+{
+    int n = samples.getSize();
+    for (int end = n; end > 0; end--)
+    {
+        // The first pass builds the heap, later ones restore it after the
+        // largest value is moved to the end
+        int first = (end == n) ? n / 2 - 1 : 0;
+        for (int start = first; start >= 0; start--)
+        {
+            int root = start;
+            for (;;)
+            {
+                int child = 2 * root + 1;
+                if (child >= end)
+                    break;
+                if (child + 1 < end && samples[child + 1] > samples[child])
+                    child++;
+                if (samples[root] >= samples[child])
+                    break;
+                double swap = samples[root];
+                samples[root]  = samples[child];
+                samples[child] = swap;
+                root = child;
+            }
+        }
+
+        double swap = samples[0];
+        samples[0]       = samples[end - 1];
+        samples[end - 1] = swap;
+    }
+}
+
+// Regularized incomplete beta function I_x(a, b), from its continued
+// fraction (modified Lentz's method).
+
+inline double incompleteBeta(double a, double b, double x)
+{
+    if (x <= 0) return 0;
+    if (x >= 1) return 1;
+
+    // The continued fraction converges quickly for x < (a + 1) / (a + b + 2)
+    if (x > (a + 1) / (a + b + 2))
+        return 1 - incompleteBeta(b, a, 1 - x);
+
+    const double TINY = 1e-300;
+    double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) +
+        a * log(x) + b * log(1 - x)) / a;
+
+    double f = 1, c = 1, d = 0;
+    for (int i = 0; i <= 200; i++)
+    {
+        int m = i / 2;
+        double numerator;
+        if (i == 0)
+            numerator = 1;
+        else if (i % 2 == 0)
+            numerator = (m * (b - m) * x) / ((a + 2 * m - 1) * (a + 2 * m));
+        else
+            numerator = -((a + m) * (a + b + m) * x) / ((a + 2 * m) * (a + 2 * m + 1));
+
+        d = 1 + numerator * d;
+        if (fabs(d) < TINY) d = TINY;
+        d = 1 / d;
+        c = 1 + numerator / c;
+        if (fabs(c) < TINY) c = TINY;
+
+        double step = c * d;
+        f *= step;
+        if (fabs(1 - step) < 1e-12)
+            break;
+    }
+    return front * (f - 1);
+}
+
+// The outcome of comparing two sets of samples
+struct Comparison
+{
+    double t;       // Welch's t statistic (second minus first)
+    double freedom; // Welch-Satterthwaite degrees of freedom
+    double p;       // two-sided p-value
+};
+
+// Welch's t-test: are the means of 'first' and 'second' different? Unlike
+// Student's test it does not assume the two runs are equally noisy.
+
+inline Comparison welchTest(const Vector<double>& first, const Vector<double>& second)
+{
+    Comparison result = {0, 0, 1};
+    int n1 = first.getSize(), n2 = second.getSize();
+    if (n1 < 2 || n2 < 2)
+        return result;
+
+    double v1 = variance(first) / n1;
+    double v2 = variance(second) / n2;
+    if (v1 + v2 <= 0)
+    {
+        // No noise at all: any difference is significant
+        result.p = (mean(first) == mean(second)) ? 1 : 0;
+        return result;
+    }
+
+    result.t       = (mean(second) - mean(first)) / sqrt(v1 + v2);
+    result.freedom = (v1 + v2) * (v1 + v2) /
+        (v1 * v1 / (n1 - 1) + v2 * v2 / (n2 - 1));
+    result.p = incompleteBeta(result.freedom / 2, 0.5,
+        result.freedom / (result.freedom + result.t * result.t));
+    return result;
+}
+
+// ----------------------------------------------------//
+
+// Per-iteration results of a "bench" run, as saved with --save
+struct BenchmarkRun
+{
+    string label;
+    Vector<double> seconds;      // wall time of each measured iteration
+    Vector<double> instructions; // -1 where not counted
+    Vector<double> cycles;
+};
+
+// Writes 'run' as text: a header line, then one line per iteration.
+
+inline bool writeBenchmarkRun(const string& path, const BenchmarkRun& run)
+{
+    ofstream out(path.c_str());
+    if (!out)
+        return false;
+
+    out.precision(17);
+    out << "# bench " << run.label << "\n";
+    for (int i = 0; i < run.seconds.getSize(); i++)
+    {
+        out << run.seconds[i] << " " << run.cycles[i] << " "
+            << run.instructions[i] << "\n";
+    }
+    return (bool) out;
+}
+
+// Reads a file written by writeBenchmarkRun(). Returns false with a message
+// in 'error' if it cannot be read.
+
+inline bool readBenchmarkRun(const string& path, BenchmarkRun& run, string& error)
+{
+    ifstream in(path.c_str());
+    if (!in)
+    {
+        error = "Cannot open " + path;
+        return false;
+    }
+
+    run.seconds.clear();
+    run.cycles.clear();
+    run.instructions.clear();
+
+    string line;
+    int number = 0;
+    while (getline(in, line))
+    {
+        number++;
+        if (line.empty())
+            continue;
+        if (line[0] == '#')
+        {
+            run.label = (line.size() > 8) ? line.substr(8) : "";
+            continue;
+        }
+
+        stringstream ss(line);
+        double seconds = 0, cycles = -1, instructions = -1;
+        if (!(ss >> seconds >> cycles >> instructions))
+        {
+            stringstream message;
+            message << path << ":" << number << ": expected seconds, cycles and instructions";
+            error = message.str();
+            return false;
+        }
+        run.seconds.pushBack(seconds);
+        run.cycles.pushBack(cycles);
+        run.instructions.pushBack(instructions);
+    }
+    return true;
+}
+
+#endif
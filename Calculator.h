@@ -0,0 +1,610 @@
+#ifndef CALCULATOR_H
+#define CALCULATOR_H
+
+// The parsing and evaluation routines used by the driver. They live in a
+// header so that other programs (benchmarks, tools) can use the same code.
+
+#include <cctype>
+#include <cmath>
+#include <string>
+#include "Stack.h"
+#include "Vector.h"
+#include "Map.h"
+#include "Numeric.h"
+#include "Diagnostics.h"
+using namespace std;
+
+
+// Kinds of infix tokens, as told apart by classifyToken()
+enum TokenKind
+{
+    TOKEN_OPERAND,  // a number or a variable, or the name of a called function
+    TOKEN_OPEN,     // "("
+    TOKEN_CLOSE,    // ")"
+    TOKEN_COMMA,    // ","
+    TOKEN_FUNCTION, // min, max, sin, cos or tan
+    TOKEN_INFIX     // + - * /, the comparisons, "and" and "or"
+};
+
+// Precedence levels, from lowest to highest. "(" is 0, so an operator never
+// moves past the "(" it is inside of.
+const int PRECEDENCE_OR         = 1;
+const int PRECEDENCE_AND        = 2;
+const int PRECEDENCE_COMPARISON = 3;
+const int PRECEDENCE_ADDITION   = 4;
+const int PRECEDENCE_PRODUCT    = 5;
+const int PRECEDENCE_FUNCTION   = 6;
+
+// Returns the TokenKind of an infix token and sets 'precedence' to its
+// level. Each token is looked at once, by its length and first characters,
+// rather than compared against every operator in turn.
+
+inline int classifyToken(const string& token, int& precedence)
+{
+    precedence = PRECEDENCE_FUNCTION;
+    switch (token.size())
+    {
+        case 1:
+            switch (token[0])
+            {
+                case '(': precedence = 0; return TOKEN_OPEN;
+                case ')': return TOKEN_CLOSE;
+                case ',': return TOKEN_COMMA;
+                case '*':
+                case '/': precedence = PRECEDENCE_PRODUCT;    return TOKEN_INFIX;
+                case '+':
+                case '-': precedence = PRECEDENCE_ADDITION;   return TOKEN_INFIX;
+                case '<':
+                case '>': precedence = PRECEDENCE_COMPARISON; return TOKEN_INFIX;
+            }
+            break;
+        case 2:
+            if (token[1] == '=' && (token[0] == '<' || token[0] == '>' || 
+                token[0] == '=' || token[0] == '!'))
+            {
+                precedence = PRECEDENCE_COMPARISON;
+                return TOKEN_INFIX;
+            }
+            if (token == "or")
+            {
+                precedence = PRECEDENCE_OR;
+                return TOKEN_INFIX;
+            }
+            break;
+        case 3:
+            if (token == "and")
+            {
+                precedence = PRECEDENCE_AND;
+                return TOKEN_INFIX;
+            }
+            if (token == "min" || token == "max" || token == "sin" || 
+                token == "cos" || token == "tan")
+                return TOKEN_FUNCTION;
+            break;
+    }
+    return TOKEN_OPERAND;
+}
+
+// Pushes an operator onto the operation stack: the index of its token in
+// the infix expression and its precedence. Only indices are kept, so
+// moving operators around never copies a string.
+
+inline void pushOperator(Stack<int>& positions, Stack<int>& levels,
+    int position, int level)
+{
+    positions.push(position);
+    levels.push(level);
+}
+
+// Returns the number of arguments a built-in function takes, -1 if 'name'
+// is not one (it may be a user-defined function).
+
+inline int builtinArity(const string& name)
+{
+    if (name == "sin" || name == "cos" || name == "tan")
+        return 1;
+    if (name == "min" || name == "max")
+        return 2;
+    if (name == "if")
+        return 3;
+    return -1;
+}
+
+// Returns true if a "(" at infix index 'position' opens the arguments of a
+// call, which is the case when the function is right before it on the
+// operation stack.
+
+inline bool opensCall(const Stack<int>& positions, const Stack<int>& levels,
+    int position)
+{
+    int level = 0, previous = 0;
+    return levels.top(level) && level == PRECEDENCE_FUNCTION &&
+        positions.top(previous) && previous == position - 1;
+}
+
+// Pops the operators of at least 'operation' precedence from the operation
+// stack, and pushes them onto postfix. It stops at a "(", which has
+// precedence 0. If 'origins' is given, the infix index of every operator
+// moved onto postfix is added to it.
+// Every operator is pushed and popped once, so a whole expression takes
+// time linear in its length.
+
+inline void movePrecedence(const Vector<string>& expression, 
+    Stack<int>& positions, Stack<int>& levels, int operation, 
+    Vector<string>& postfix, Vector<int>* origins = NULL)
+{
+    int level    = 0;
+    int position = 0;
+    
+    // Pops one operator at a time accordingly   
+    while (levels.top(level) && level > 0 && level >= operation)
+    {
+        levels.pop(level);
+        positions.pop(position);
+        
+        postfix.pushBack(expression[position]);
+        if (origins != NULL)
+            origins->pushBack(position);
+    }
+}
+
+// Returns the two values that arithmetic will be performed on by variable reference.
+
+template <class T>
+bool operatorValues(Stack<T>& auxStack, T& value1, T& value2, int trigFunc)
+{
+    // Error checking for malformed expressions
+    if (auxStack.size() >= 2 && trigFunc == 0)   
+    {
+        // pop 2nd value
+        auxStack.pop(value2);
+
+        // pop 1st value
+        auxStack.pop(value1);
+
+        return true;
+    }
+    else if (auxStack.size() >= 1 && trigFunc == 1)
+    {
+        // pop one value
+        auxStack.pop(value1);
+        
+        return true;
+    }
+    else return false;
+}
+
+// This function will be given the infix expression provided by the user and will 
+// attempt to convert it to an equivalent postfix expression, that will be stored 
+// in ‘postfix’. This function will return true if we were able to perform the 
+// conversion and false if the expression is malformed. Shunting Yard algorithm 
+// will only fail if the parentheses are mismatched. It is possible for the 
+// expression to be invalid, but still pass through the shunting yard.
+// Functions can be called with comma separated arguments, as in 
+// "max ( a , b )" or "f ( x , y * 2 )". Any name directly followed by "(" is
+// treated as a function call; its name is pushed onto postfix after its 
+// arguments, just like the built-in min/max/sin/cos/tan. That includes the
+// conditional "if ( c , a , b )".
+// From lowest to highest precedence the operators are: or, and, the
+// comparisons (< <= > >= == !=), + -, * /, and function calls.
+// A call to a built-in function (min, max, sin, cos, tan or if) has to
+// have as many arguments as the function takes. Calls to other functions
+// are left to the caller: if 'calls' and 'counts' are given, the infix
+// index of the name and the number of arguments of each such call are
+// added to them (see checkArguments() in Program.h).
+// If 'diagnostic' is given it tells which token failed (see Diagnostics.h):
+// a ")" without "(", a "(" that is never closed, a "," outside of a
+// function call, or the name of a function called with the wrong number
+// of arguments. If 'origins' is given, the index in 'expression' of every
+// token added to postfix is added to it, so errors found later in the
+// postfix expression can be traced back to the infix one.
+
+inline bool shuntingYard(const Vector<string>& expression, const int startIndex, 
+    Vector<string>& postfix, Diagnostic* diagnostic = NULL,
+    Vector<int>* origins = NULL, Vector<int>* calls = NULL,
+    Vector<int>* counts = NULL)
+{    
+    // The auxiliary track (operation stack): the infix index of every
+    // operator on it and its precedence
+    Stack<int> positions;
+    Stack<int> levels;
+    
+    // For each "(" on the operation stack, the commas inside it so far, or
+    // -1 if it is not the "(" of a call
+    Stack<int> commas;
+    
+    // Postfix never has more tokens than the infix expression
+    postfix.reserve(postfix.getSize() + expression.getSize() - startIndex);
+    if (origins != NULL)
+        origins->reserve(origins->getSize() + expression.getSize() - startIndex);
+    
+    int level    = 0;
+    int position = 0;
+    int count    = 0;
+    
+    for (int i = startIndex; i < expression.getSize(); i++)
+    {            
+        int precedence = 0;
+        switch (classifyToken(expression[i], precedence))
+        {
+            case TOKEN_OPEN:
+                commas.push(opensCall(positions, levels, i) ? 0 : -1);
+                pushOperator(positions, levels, i, precedence);
+                break;
+                
+            case TOKEN_FUNCTION:
+                pushOperator(positions, levels, i, precedence);
+                break;
+                
+            case TOKEN_CLOSE:
+                movePrecedence(expression, positions, levels, PRECEDENCE_OR, 
+                    postfix, origins);
+                
+                // Error checking for missing parenthesis.
+                if (!levels.top(level) || level != 0)
+                    return report(diagnostic, ERROR_MISMATCHED_PARENTHESES, i);
+                levels.pop(level);
+                positions.pop(position);
+                commas.pop(count);
+                
+                // The end of a call: "f ( )" has no arguments, otherwise
+                // there is one more than there are commas
+                if (count >= 0)
+                {
+                    int arguments = (i == position + 1) ? 0 : count + 1;
+                    int arity = builtinArity(expression[position - 1]);
+                    if (arity >= 0 && arguments != arity)
+                        return report(diagnostic, ERROR_WRONG_ARGUMENTS, position - 1);
+                    if (arity < 0 && calls != NULL && counts != NULL)
+                    {
+                        calls->pushBack(position - 1);
+                        counts->pushBack(arguments);
+                    }
+                }
+                break;
+                
+            case TOKEN_COMMA:
+                // Finish the current argument: move everything since the
+                // function's "(" onto postfix, but leave the "(" itself.
+                movePrecedence(expression, positions, levels, PRECEDENCE_OR, 
+                    postfix, origins);
+                
+                // Error checking for a comma outside of the parentheses
+                // of a call
+                if (!levels.top(level) || level != 0 || !commas.pop(count) || count < 0)
+                    return report(diagnostic, ERROR_MISPLACED_COMMA, i);
+                commas.push(count + 1);
+                break;
+                
+            case TOKEN_INFIX:
+                // All operators are left associative: first move the ones
+                // of the same or higher precedence
+                movePrecedence(expression, positions, levels, precedence, 
+                    postfix, origins);
+                pushOperator(positions, levels, i, precedence);
+                break;
+                
+            default:
+                if (i + 1 < expression.getSize() && expression[i + 1] == "(")
+                {
+                    // A call to a user-defined function
+                    pushOperator(positions, levels, i, PRECEDENCE_FUNCTION);
+                }
+                else
+                {
+                    // Pushing numbers directly onto postfix
+                    postfix.pushBack(expression[i]);
+                    if (origins != NULL)
+                        origins->pushBack(i);
+                }
+                break;
+        }
+    }
+    
+    // Push the final operators in the operation stack onto postfix
+    movePrecedence(expression, positions, levels, PRECEDENCE_OR, postfix, origins);
+    
+    // Transforming infix to postfix was a success if the operation stack is
+    // empty. Otherwise an unclosed "(" is left on top.
+    if (positions.isEmpty())
+        return true;
+    
+    positions.top(position);
+    return report(diagnostic, ERROR_MISMATCHED_PARENTHESES, position);
+}
+
+// Returns true if 'token' looks like a name (a variable or function) rather
+// than a number or a symbol.
+
+inline bool isName(const string& token)
+{
+    return !token.empty() && (isalpha((unsigned char) token[0]) || token[0] == '_');
+}
+
+// Finds the token that starts at or after 'offset' in 'text'. Returns the
+// offset just past it, or -1 if there is none. Tokens are separated by
+// whitespace, which is how the driver reads a line.
+
+inline int nextToken(const string& text, int offset, string& token)
+{
+    int size = (int) text.size();
+    while (offset < size && isspace((unsigned char) text[offset]))
+        offset++;
+    int start = offset;
+    while (offset < size && !isspace((unsigned char) text[offset]))
+        offset++;
+    
+    token.assign(text, start, offset - start);
+    return (offset > start) ? offset : -1;
+}
+
+// Splits 'text' into tokens with nextToken(), adding them to 'tokens'.
+
+inline void tokenize(const string& text, Vector<string>& tokens)
+{
+    string token;
+    int offset = 0;
+    while ((offset = nextToken(text, offset, token)) >= 0)
+        tokens.pushBack(token);
+}
+
+// Returns the earlier of two token indices, where -1 means none.
+
+inline int firstDivision(int a, int b)
+{
+    if (a < 0) return b;
+    if (b < 0) return a;
+    return (a < b) ? a : b;
+}
+
+// Postfix operators, as told apart by postfixOperator()
+enum PostfixOperator
+{
+    POSTFIX_VALUE,  // a variable or a number
+    POSTFIX_MIN,
+    POSTFIX_MAX,
+    POSTFIX_SIN,
+    POSTFIX_COS,
+    POSTFIX_TAN,
+    POSTFIX_ADD,
+    POSTFIX_SUBTRACT,
+    POSTFIX_MULTIPLY,
+    POSTFIX_DIVIDE,
+    POSTFIX_LESS,
+    POSTFIX_LESS_EQUAL,
+    POSTFIX_GREATER,
+    POSTFIX_GREATER_EQUAL,
+    POSTFIX_EQUAL,
+    POSTFIX_NOT_EQUAL,
+    POSTFIX_AND,
+    POSTFIX_OR,
+    POSTFIX_IF
+};
+
+// Returns the PostfixOperator of a postfix token, with the same single
+// look at the token as classifyToken().
+
+inline int postfixOperator(const string& token)
+{
+    switch (token.size())
+    {
+        case 1:
+            switch (token[0])
+            {
+                case '+': return POSTFIX_ADD;
+                case '-': return POSTFIX_SUBTRACT;
+                case '*': return POSTFIX_MULTIPLY;
+                case '/': return POSTFIX_DIVIDE;
+                case '<': return POSTFIX_LESS;
+                case '>': return POSTFIX_GREATER;
+            }
+            break;
+        case 2:
+            if (token == "<=") return POSTFIX_LESS_EQUAL;
+            if (token == ">=") return POSTFIX_GREATER_EQUAL;
+            if (token == "==") return POSTFIX_EQUAL;
+            if (token == "!=") return POSTFIX_NOT_EQUAL;
+            if (token == "or") return POSTFIX_OR;
+            if (token == "if") return POSTFIX_IF;
+            break;
+        case 3:
+            if (token == "min") return POSTFIX_MIN;
+            if (token == "max") return POSTFIX_MAX;
+            if (token == "sin") return POSTFIX_SIN;
+            if (token == "cos") return POSTFIX_COS;
+            if (token == "tan") return POSTFIX_TAN;
+            if (token == "and") return POSTFIX_AND;
+            break;
+    }
+    return POSTFIX_VALUE;
+}
+
+// The values evaluatePostfix() has computed so far. Keeping them outside of
+// the loop lets an expression be evaluated a token at a time while its
+// postfix form is still being produced (see StreamParser.h).
+
+template <class T>
+struct PostfixState
+{
+    // The auxiliary track
+    Stack<T> values;
+    
+    // With a diagnostic: for every value, the first division by zero it
+    // depends on (-1 for none)
+    Stack<int> divisions;
+};
+
+// Evaluates one postfix token, as evaluatePostfix() does, updating 'state'.
+// 'index' is the token reported to 'diagnostic' if the token fails.
+
+template <class T, template <class, class> class M, class V>
+bool evaluateToken(const string& token, int index, const M<string, V>& variables, 
+    PostfixState<T>& state, Diagnostic* diagnostic = NULL)
+{
+    typedef NumericTraits<T> Traits;
+    
+    // Declaring & initializing
+    T value1 = Traits::fromDouble(0);
+    T value2 = Traits::fromDouble(0);
+    T condition = Traits::fromDouble(0);
+    V variable = V();
+    // Number of values popped by a trig function
+    int trigFunc = 1;
+    // Number of values popped by any other operator
+    int binaryFunc = 0;
+    
+    Stack<T>& auxStack = state.values;
+    int before = auxStack.size();
+    
+    // Each token is classified once. The built-in functions come first,
+    // then variables, so a variable may be named like an operator.
+    int op = postfixOperator(token);
+    if (op > POSTFIX_TAN && variables.search(token, variable))
+        op = POSTFIX_VALUE;
+    else if (op == POSTFIX_VALUE && !variables.search(token, variable))
+    {
+        // Converting the literal to a T. A token that is neither an
+        // operator, a variable nor a number makes the expression malformed.
+        T value;
+        if (!Traits::parse(token, value))
+        {
+            if (outOfRange<T>(token))
+                return report(diagnostic, ERROR_OUT_OF_RANGE, index);
+            return report(diagnostic, isName(token) ? 
+                ERROR_UNDEFINED_VARIABLE : ERROR_UNKNOWN_TOKEN, index);
+        }
+
+        // Pushing the value directly onto the auxiliary stack
+        auxStack.push(value);
+        op = -1;
+    }
+    
+    // Number of values the operator pops
+    int popped = (op == POSTFIX_SIN || op == POSTFIX_COS || op == POSTFIX_TAN) ?
+        trigFunc : binaryFunc;
+    if (op > POSTFIX_VALUE && !operatorValues(auxStack, value1, value2, popped))
+        return report(diagnostic, ERROR_MISSING_OPERAND, index);
+    
+    switch (op)
+    {
+        case POSTFIX_VALUE:
+            loadVariable(variable, value1);
+            auxStack.push(value1);
+            break;
+        // Compute arithmetic and push it onto the auxiliary stack
+        case POSTFIX_MIN:           auxStack.push(Traits::minimum(value1, value2));      break;
+        case POSTFIX_MAX:           auxStack.push(Traits::maximum(value1, value2));      break;
+        case POSTFIX_SIN:           auxStack.push(Traits::sine(value1));                 break;
+        case POSTFIX_COS:           auxStack.push(Traits::cosine(value1));               break;
+        case POSTFIX_TAN:           auxStack.push(Traits::tangent(value1));              break;
+        case POSTFIX_ADD:           auxStack.push(Traits::add(value1, value2));          break;
+        case POSTFIX_SUBTRACT:      auxStack.push(Traits::subtract(value1, value2));     break;
+        case POSTFIX_MULTIPLY:      auxStack.push(Traits::multiply(value1, value2));     break;
+        case POSTFIX_DIVIDE:        auxStack.push(Traits::divide(value1, value2));       break;
+        case POSTFIX_LESS:          auxStack.push(Traits::less(value1, value2));         break;
+        case POSTFIX_LESS_EQUAL:    auxStack.push(Traits::lessEqual(value1, value2));    break;
+        case POSTFIX_GREATER:       auxStack.push(Traits::greater(value1, value2));      break;
+        case POSTFIX_GREATER_EQUAL: auxStack.push(Traits::greaterEqual(value1, value2)); break;
+        case POSTFIX_EQUAL:         auxStack.push(Traits::equal(value1, value2));        break;
+        case POSTFIX_NOT_EQUAL:     auxStack.push(Traits::notEqual(value1, value2));     break;
+        case POSTFIX_AND:           auxStack.push(Traits::logicalAnd(value1, value2));   break;
+        case POSTFIX_OR:            auxStack.push(Traits::logicalOr(value1, value2));    break;
+        case POSTFIX_IF:
+            // if ( condition , value1 , value2 )
+            if (!operatorValues(auxStack, condition, condition, trigFunc))
+                return report(diagnostic, ERROR_MISSING_OPERAND, index);
+            auxStack.push(Traits::select(condition, value1, value2));
+            break;
+    }
+    
+    if (diagnostic != NULL)
+    {
+        // The token replaced 'count' values by one. operands[0] is the
+        // deepest of them.
+        int count = before + 1 - auxStack.size();
+        int operands[3] = {-1, -1, -1};
+        for (int k = count - 1; k >= 0; k--)
+            state.divisions.pop(operands[k]);
+        
+        // Drop the operands "if", "and" and "or" do not use
+        if (op == POSTFIX_IF)
+        {
+            int known = Traits::truth(condition);
+            if (known == 0) operands[1] = -1;
+            if (known == 1) operands[2] = -1;
+        }
+        else if ((op == POSTFIX_AND && Traits::truth(value1) == 0) ||
+                 (op == POSTFIX_OR  && Traits::truth(value1) == 1))
+            operands[1] = -1;
+        
+        int first = firstDivision(firstDivision(operands[0], operands[1]), 
+            operands[2]);
+        if (op == POSTFIX_DIVIDE && Traits::truth(value2) == 0)
+            first = firstDivision(first, index);
+        state.divisions.push(first);
+    }
+    return true;
+}
+
+// Takes the result out of 'state' once every token has been evaluated.
+// Fails if other than one value is left, or with a diagnostic, if the
+// result depends on a division by zero or overflowed (see Numeric.h).
+
+template <class T>
+bool finishPostfix(PostfixState<T>& state, T& result, Diagnostic* diagnostic = NULL)
+{
+    // If there is only 1 element (result) in the auxiliary stack return true
+    if (state.values.size() == 1)
+    {
+        // Pop the result
+        state.values.pop(result);
+        
+        int division = -1;
+        state.divisions.top(division);
+        if (diagnostic != NULL && division >= 0)
+            return report(diagnostic, ERROR_DIVISION_BY_ZERO, division);
+        if (diagnostic != NULL && NumericTraits<T>::overflowed(result))
+            return report(diagnostic, ERROR_OUT_OF_RANGE, -1);
+        return true;
+    }
+    else return report(diagnostic, state.values.isEmpty() ? ERROR_MISSING_OPERAND : 
+        ERROR_EXTRA_VALUES, -1);
+}
+
+// This function will be given the postfix expression produced by the 
+// Shunting Yard algorithm as input. It will attempt to evaluate the expression, 
+// returning true if evaluation was successful. If evaluation fails 
+// (because the postfix expression was invalid), the function will return false 
+// instead. The result will be saved in ‘result’ if the function returns true.
+// Including variable map as an input. Values will be inserted into 
+// the variable map in the driver, and they will be retrieved in 
+// evaluatePostfix(). At any point in time, all variables that have been 
+// assigned by the program so far will be stored in the variable map.
+// Any map with the interface of Map works, such as a PersistentMap.
+// The arithmetic is done in the type of ‘result’ (see Numeric.h), so the same
+// expression can be evaluated as a float, double, long double, Decimal or 
+// Compensated value. Variables are normally stored as doubles and converted
+// on load, but the map may also hold T values directly (see Interval.h).
+// "and", "or" and "if" evaluate all of their operands here; compiled
+// programs (see Program.h) skip the operands that are not needed.
+// If 'diagnostic' is given it tells which postfix token failed: an operator
+// without enough values, a name that is not a variable, or values left over
+// at the end. Division by zero is checked as well, and then fails the
+// evaluation (with the IEEE result still saved in 'result'). Only divisions
+// the result depends on count, so "if ( x != 0 , 1 / x , 0 )" is fine for
+// x = 0, the same as in a compiled program, which never evaluates 1 / x.
+
+template <class T, template <class, class> class M, class V>
+bool evaluatePostfix(const Vector<string>& postfix,
+    const M<string, V>& variables, T& result, Diagnostic* diagnostic = NULL)
+{   
+    PostfixState<T> state;
+    for (int i = 0; i < postfix.getSize(); i++)
+    {
+        if (!evaluateToken(postfix[i], i, variables, state, diagnostic))
+            return false;
+    }
+    return finishPostfix(state, result, diagnostic);
+}
+
+#endif
@@ -0,0 +1,442 @@
+#ifndef COLUMN_INPUT_H
+#define COLUMN_INPUT_H
+
+// Necessary for mapping files, byte order and the SSE2 scanning
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "Vector.h"
+#include "NumberFormat.h"
+#include "Program.h"
+#include "Parallel.h"
+using namespace std;
+
+// Column ingestion. Instead of feeding data through "name = value" lines,
+// a whole file is mapped into memory and turned into one column of doubles
+// per variable, ready for evaluateProgramBatch() / evaluateProgramParallel().
+//
+// Two formats are read:
+//  - CSV with a header line of variable names and one row of numbers per
+//    line. Fields are separated by ',' and lines end in "\n" or "\r\n". An
+//    empty field is read as NaN (a missing value).
+//  - Raw binary columns: a file of little-endian doubles, one column per
+//    file, bound to a name given by the caller. On little-endian machines
+//    the column is used straight from the mapping without a copy.
+//
+// CSV files are parsed by all workers of a ParallelPool at once. Each worker
+// takes a byte range of the file, and the row each range starts at is
+// found by counting newlines (16 bytes at a time with SSE2) first.
+
+// ----------------------------------------------------//
+
+// A read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+    MappedFile() { mData = NULL; mSize = 0; }
+    ~MappedFile() { close(); }
+
+    // Returns false if the file cannot be opened or mapped
+    bool open(const string& path);
+    void close();
+
+    const char* data() const { return mData; }
+    size_t size() const { return mSize; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const char* mData;
+    size_t mSize;
+};
+
+inline bool MappedFile::open(const string& path)
+{
+    close();
+
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(file, &info) != 0)
+    {
+        ::close(file);
+        return false;
+    }
+
+    // mmap() refuses empty files, but an empty file is a valid empty input
+    mSize = (size_t) info.st_size;
+    if (mSize > 0)
+    {
+        void* mapped = mmap(NULL, mSize, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapped == MAP_FAILED)
+        {
+            ::close(file);
+            mSize = 0;
+            return false;
+        }
+        mData = (const char*) mapped;
+        madvise(mapped, mSize, MADV_SEQUENTIAL);
+    }
+
+    ::close(file);
+    return true;
+}
+
+inline void MappedFile::close()
+{
+    if (mData != NULL)
+        munmap((void*) mData, mSize);
+    mData = NULL;
+    mSize = 0;
+}
+
+// ----------------------------------------------------//
+
+// Named columns of doubles, all with the same number of rows. Columns are
+// either owned by the table (allocated with allocateColumn()) or point into
+// a MappedFile the table keeps open.
+class ColumnTable
+{
+public:
+    ColumnTable() { mRows = 0; }
+    ~ColumnTable() { clear(); }
+
+    void clear();
+
+    size_t getRows() const { return mRows; }
+    int getColumns() const { return mNames.getSize(); }
+    const string& getName(int column) const { return mNames[column]; }
+    const double* getColumn(int column) const { return mColumns[column]; }
+
+    // Looks up a column by name
+    bool find(const string& name, const double*& column) const;
+
+    // Reads a CSV file, replacing the table's contents. On failure 'error'
+    // tells what went wrong and on which line.
+    bool readCsv(const string& path, ParallelPool& pool, string& error);
+
+    // Adds a column from a file of little-endian doubles. The file must
+    // have as many rows as the columns already in the table.
+    bool addBinary(const string& path, const string& name, ParallelPool& pool,
+        string& error);
+
+private:
+    ColumnTable(const ColumnTable&);
+    ColumnTable& operator=(const ColumnTable&);
+
+    Vector<string> mNames;
+    Vector<const double*> mColumns;
+    Vector<double*> mOwned;
+    Vector<MappedFile*> mMapped;
+    size_t mRows;
+};
+
+inline void ColumnTable::clear()
+{
+    for (int i = 0; i < mOwned.getSize(); i++)
+        freeColumn(mOwned[i]);
+    for (int i = 0; i < mMapped.getSize(); i++)
+        delete mMapped[i];
+
+    mNames.clear();
+    mColumns.clear();
+    mOwned.clear();
+    mMapped.clear();
+    mRows = 0;
+}
+
+inline bool ColumnTable::find(const string& name, const double*& column) const
+{
+    for (int i = 0; i < mNames.getSize(); i++)
+    {
+        if (mNames[i] == name)
+        {
+            column = mColumns[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Collects the column for every variable slot of 'program' into 'columns',
+// in slot order, for evaluateProgramBatch(). Returns false if the program
+// uses a variable the table has no column for.
+
+inline bool bindColumns(const Program& program, const ColumnTable& table,
+    Vector<const double*>& columns)
+{
+    columns.clear();
+    for (int i = 0; i < program.variables.getSize(); i++)
+    {
+        const double* column = NULL;
+        if (!table.find(program.variables[i], column))
+            return false;
+        columns.pushBack(column);
+    }
+    return true;
+}
+
+// ----------------------------------------------------//
+
+// Counts the newlines in [begin, end).
+
+inline long countLines(const char* begin, const char* end)
+{
+    long count = 0;
+    const char* p = begin;
+
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; p + 16 <= end; p += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*) p);
+        unsigned mask = (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(block, newline));
+        count += __builtin_popcount(mask);
+    }
+#endif
+
+    for (; p < end; p++)
+        count += (*p == '\n');
+    return count;
+}
+
+// Returns the first ',' or '\n' in [p, end), or 'end'.
+
+inline const char* findDelimiter(const char* p, const char* end)
+{
+#ifdef __SSE2__
+    const __m128i comma   = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; p + 16 <= end; p += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*) p);
+        __m128i hits  = _mm_or_si128(_mm_cmpeq_epi8(block, comma),
+                                     _mm_cmpeq_epi8(block, newline));
+        unsigned mask = (unsigned) _mm_movemask_epi8(hits);
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+
+    while (p < end && *p != ',' && *p != '\n')
+        p++;
+    return p;
+}
+
+// Parses one CSV field. Surrounding spaces and a trailing '\r' are ignored,
+// and an empty field is NaN.
+
+inline bool parseField(const char* begin, const char* end, double& value)
+{
+    while (begin < end && *begin == ' ')
+        begin++;
+    while (end > begin && (end[-1] == ' ' || end[-1] == '\r'))
+        end--;
+
+    if (begin == end)
+    {
+        value = numeric_limits<double>::quiet_NaN();
+        return true;
+    }
+    return parseNumber(begin, end, value);
+}
+
+inline bool ColumnTable::readCsv(const string& path, ParallelPool& pool,
+    string& error)
+{
+    clear();
+
+    MappedFile* file = new MappedFile();
+    if (!file->open(path))
+    {
+        delete file;
+        error = "Could not open " + path;
+        return false;
+    }
+
+    const char* data = file->data();
+    const char* end  = data + file->size();
+
+    // Header: the variable names
+    const char* body = data;
+    while (body < end && *body != '\n')
+        body++;
+
+    stringstream header(string(data, body - data));
+    string name;
+    while (getline(header, name, ','))
+    {
+        size_t first = name.find_first_not_of(" \r");
+        size_t last  = name.find_last_not_of(" \r");
+        mNames.pushBack(first == string::npos ? "" : name.substr(first, last - first + 1));
+    }
+    if (body < end)
+        body++;
+
+    if (mNames.getSize() == 0)
+    {
+        delete file;
+        error = "The header line of " + path + " is empty";
+        return false;
+    }
+
+    // Count the rows in every worker's byte range. A row starts at 'body'
+    // or right after a newline; the last line needs no newline.
+    int workers = pool.getWorkers();
+    size_t length = end - body;
+    Vector<long> lines(workers);
+
+    pool.run([&](int worker)
+    {
+        const char* from = body + length * worker / workers;
+        const char* to   = body + length * (worker + 1) / workers;
+        lines[worker] = countLines(from, to);
+    });
+
+    size_t total = 0;
+    Vector<size_t> firstRow(workers);
+    for (int w = 0; w < workers; w++)
+    {
+        firstRow[w] = total;
+        total += lines[w];
+    }
+    if (length > 0 && end[-1] != '\n')
+        total++;
+
+    mRows = total;
+    int columns = mNames.getSize();
+    for (int c = 0; c < columns; c++)
+    {
+        double* column = allocateColumn(pool, mRows);
+        mOwned.pushBack(column);
+        mColumns.pushBack(column);
+    }
+
+    // Parse. Every worker parses the rows that start inside its range and
+    // remembers the first bad line it finds.
+    Vector<long> badLine(workers);
+    pool.run([&](int worker)
+    {
+        const char* from = body + length * worker / workers;
+        const char* to   = body + length * (worker + 1) / workers;
+        size_t row = firstRow[worker];
+        badLine[worker] = -1;
+
+        // Move to the first row that starts in this range
+        const char* p = from;
+        if (p > body && p[-1] != '\n')
+        {
+            while (p < to && *p != '\n')
+                p++;
+            p++;
+            row++;
+        }
+
+        for (; p < to && p < end; row++)
+        {
+            for (int c = 0; c < columns; c++)
+            {
+                const char* field = findDelimiter(p, end);
+                bool last = (c == columns - 1);
+
+                // Too few or too many fields
+                bool separatorOk = last ? (field == end || *field == '\n')
+                                        : (field < end && *field == ',');
+                if (!separatorOk || !parseField(p, field, mOwned[c][row]))
+                {
+                    if (badLine[worker] < 0)
+                        badLine[worker] = row;
+
+                    // Skip the rest of the line
+                    while (field < end && *field != '\n')
+                        field++;
+                    p = field + 1;
+                    break;
+                }
+                p = field + 1;
+            }
+        }
+    });
+
+    for (int w = 0; w < workers; w++)
+    {
+        if (badLine[w] >= 0)
+        {
+            // The header is line 1
+            stringstream message;
+            message << path << ", line " << badLine[w] + 2
+                    << ": expected " << columns << " numbers";
+            error = message.str();
+            delete file;
+            clear();
+            return false;
+        }
+    }
+
+    // The parsed values are copies; the mapping is no longer needed
+    delete file;
+    return true;
+}
+
+inline bool ColumnTable::addBinary(const string& path, const string& name,
+    ParallelPool& pool, string& error)
+{
+    MappedFile* file = new MappedFile();
+    if (!file->open(path))
+    {
+        delete file;
+        error = "Could not open " + path;
+        return false;
+    }
+
+    size_t rows = file->size() / sizeof(double);
+    if (file->size() % sizeof(double) != 0 ||
+        (mNames.getSize() > 0 && rows != mRows))
+    {
+        stringstream message;
+        message << path << " holds " << file->size() << " bytes, expected "
+                << (mNames.getSize() > 0 ? mRows : (size_t) 0) << " doubles";
+        error = message.str();
+        delete file;
+        return false;
+    }
+
+    mRows = rows;
+    mNames.pushBack(name);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // The file already is the column. mmap() aligns to a page.
+    mColumns.pushBack((const double*) file->data());
+    mMapped.pushBack(file);
+    (void) pool;
+#else
+    // Swap the bytes of every value into a column of our own
+    double* column = allocateColumn(pool, mRows);
+    const unsigned char* bytes = (const unsigned char*) file->data();
+    for (size_t r = 0; r < mRows; r++)
+    {
+        uint64_t bits = 0;
+        for (int b = 7; b >= 0; b--)
+            bits = (bits << 8) | bytes[r * 8 + b];
+        memcpy(&column[r], &bits, sizeof(double));
+    }
+    mOwned.pushBack(column);
+    mColumns.pushBack(column);
+    delete file;
+#endif
+    return true;
+}
+
+#endif
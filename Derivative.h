@@ -0,0 +1,375 @@
+#ifndef DERIVATIVE_H
+#define DERIVATIVE_H
+
+// Necessary for the math functions
+#include <cmath>
+#include "Vector.h"
+#include "Program.h"
+using namespace std;
+
+// Automatic differentiation over a compiled Program. Both functions below
+// compute the value of the expression together with its partial derivative
+// with respect to every variable slot, in a single pass over the program,
+// instead of the 2N extra evaluations finite differences need.
+//
+// Forward mode carries a derivative for every slot along with each stack
+// value. It needs no extra memory per instruction, and is the better choice
+// when there are only a few variables. Reverse mode records the value of
+// every instruction on a tape and then sweeps back over it once, so its cost
+// does not grow with the number of variables.
+//
+// min and max are not differentiable where both operands are equal; there
+// the derivative of the first operand is used, matching selectMinimum() and
+// selectMaximum(). A NaN operand is ignored, as with fmin() and fmax().
+//
+// Comparisons and logic are flat, so their derivative is 0. A conditional
+// passes on the derivative of the side it picks. Both sides are evaluated
+// here; the skips evaluateProgram() uses are ignored.
+
+// Returns true if min(a, b) takes its value from 'b'
+inline bool minimumPicksSecond(double a, double b)
+{
+    return (b < a || a != a);
+}
+
+// Returns true if max(a, b) takes its value from 'b'
+inline bool maximumPicksSecond(double a, double b)
+{
+    return (b > a || a != a);
+}
+
+// ----------------------------------------------------//
+
+// Forward mode. Evaluates 'program' with the given inputs and saves the
+// result in 'result' and d(result)/d(input[k]) in gradient[k].
+
+inline void evaluateForward(const Program& program, const double* inputs,
+    double& result, Vector<double>& gradient)
+{
+    int n = program.variables.getSize();
+
+    // values[k] is a stack entry, tangents[k * n + j] its derivative with
+    // respect to slot j
+    double* values   = new double[program.maxDepth];
+    double* tangents = new double[program.maxDepth * n + 1];
+    int top = -1;
+
+    for (int i = 0; i < program.code.getSize(); i++)
+    {
+        const Instruction& instruction = program.code[i];
+        if (isSkip(instruction))
+            continue;
+
+        int count = operandCount(instruction);
+        top = top - count + 1;
+
+        double& a  = values[top];
+        double  b  = (count == 2) ? values[top + 1] : 0;
+        double* ta = tangents + top * n;
+        double* tb = ta + n;
+
+        switch (instruction.opcode)
+        {
+            case OP_CONSTANT:
+                a = program.constants[instruction.operand];
+                for (int j = 0; j < n; j++) ta[j] = 0;
+                break;
+            case OP_VARIABLE:
+                a = inputs[instruction.operand];
+                for (int j = 0; j < n; j++) ta[j] = 0;
+                ta[instruction.operand] = 1;
+                break;
+            case OP_ARGUMENT:
+            case OP_RETURN:
+            {
+                // Copy a value and its derivatives from further down
+                int from = (instruction.opcode == OP_ARGUMENT)
+                         ? instruction.operand : top + count - 1;
+                a = values[from];
+                for (int j = 0; j < n; j++) ta[j] = tangents[from * n + j];
+                break;
+            }
+            case OP_ADD:
+                a = a + b;
+                for (int j = 0; j < n; j++) ta[j] += tb[j];
+                break;
+            case OP_SUBTRACT:
+                a = a - b;
+                for (int j = 0; j < n; j++) ta[j] -= tb[j];
+                break;
+            case OP_MULTIPLY:
+                for (int j = 0; j < n; j++) ta[j] = ta[j] * b + a * tb[j];
+                a = a * b;
+                break;
+            case OP_DIVIDE:
+            {
+                // (a / b)' = (a' - (a / b) * b') / b
+                double quotient = a / b;
+                for (int j = 0; j < n; j++) ta[j] = (ta[j] - quotient * tb[j]) / b;
+                a = quotient;
+                break;
+            }
+            case OP_MIN:
+                if (minimumPicksSecond(a, b))
+                    for (int j = 0; j < n; j++) ta[j] = tb[j];
+                a = selectMinimum(a, b);
+                break;
+            case OP_MAX:
+                if (maximumPicksSecond(a, b))
+                    for (int j = 0; j < n; j++) ta[j] = tb[j];
+                a = selectMaximum(a, b);
+                break;
+            case OP_SIN:
+            {
+                double slope = cos(a);
+                for (int j = 0; j < n; j++) ta[j] *= slope;
+                a = sin(a);
+                break;
+            }
+            case OP_COS:
+            {
+                double slope = -sin(a);
+                for (int j = 0; j < n; j++) ta[j] *= slope;
+                a = cos(a);
+                break;
+            }
+            case OP_TAN:
+            {
+                // tan' = 1 + tan^2
+                double t     = tan(a);
+                double slope = 1 + t * t;
+                for (int j = 0; j < n; j++) ta[j] *= slope;
+                a = t;
+                break;
+            }
+            case OP_LESS:
+            case OP_LESS_EQUAL:
+            case OP_GREATER:
+            case OP_GREATER_EQUAL:
+            case OP_EQUAL:
+            case OP_NOT_EQUAL:
+            case OP_AND:
+            case OP_OR:
+                a = applyComparison(instruction.opcode, a, b);
+                for (int j = 0; j < n; j++) ta[j] = 0;
+                break;
+            case OP_SELECT:
+            {
+                int from = (a != 0) ? top + 1 : top + 2;
+                a = values[from];
+                for (int j = 0; j < n; j++) ta[j] = tangents[from * n + j];
+                break;
+            }
+        }
+    }
+
+    result = values[0];
+    gradient.resize(n);
+    for (int j = 0; j < n; j++)
+        gradient[j] = tangents[j];
+
+    delete[] values;
+    delete[] tangents;
+}
+
+// ----------------------------------------------------//
+
+// Working memory for reverse mode. Keeping one around and passing it to
+// every call avoids allocating on each evaluation.
+struct GradientTape
+{
+    Vector<double> values;   // result of each instruction
+    Vector<double> adjoints; // d(result)/d(instruction's value)
+    Vector<int> left;        // instruction that produced the first operand
+    Vector<int> right;       // instruction that produced the second operand
+    Vector<int> stack;       // instruction indices while recording
+};
+
+// Reverse mode. Same results as evaluateForward(), computed with one
+// forward sweep that records every instruction's value and one backward
+// sweep that propagates adjoints.
+
+inline void evaluateReverse(const Program& program, const double* inputs,
+    double& result, Vector<double>& gradient, GradientTape& tape)
+{
+    int length = program.code.getSize();
+    int n      = program.variables.getSize();
+
+    tape.values.resize(length);
+    tape.adjoints.resize(length);
+    tape.left.resize(length);
+    tape.right.resize(length);
+    tape.stack.resize(program.maxDepth);
+    int top = -1;
+
+    // Forward sweep: record values and where each operand came from
+    for (int i = 0; i < length; i++)
+    {
+        const Instruction& instruction = program.code[i];
+        int count = operandCount(instruction);
+
+        // Skips record nothing
+        if (isSkip(instruction))
+        {
+            tape.left[i]     = -1;
+            tape.right[i]    = -1;
+            tape.values[i]   = 0;
+            tape.adjoints[i] = 0;
+            continue;
+        }
+
+        // Function arguments and results pass a value through unchanged,
+        // so they only need to remember where it came from. So does a
+        // conditional, from the side it picks.
+        if (instruction.opcode == OP_ARGUMENT)
+        {
+            tape.left[i]  = tape.stack[instruction.operand];
+            tape.right[i] = -1;
+        }
+        else if (instruction.opcode == OP_RETURN)
+        {
+            tape.left[i]  = tape.stack[top];
+            tape.right[i] = -1;
+            top -= count;
+        }
+        else if (instruction.opcode == OP_SELECT)
+        {
+            int second = tape.stack[top--];
+            int first  = tape.stack[top--];
+            int test   = tape.stack[top--];
+            tape.left[i]  = (tape.values[test] != 0) ? first : second;
+            tape.right[i] = -1;
+        }
+        else
+        {
+            tape.right[i] = (count == 2) ? tape.stack[top--] : -1;
+            tape.left[i]  = (count >= 1) ? tape.stack[top--] : -1;
+        }
+
+        double a = (tape.left[i]  >= 0) ? tape.values[tape.left[i]]  : 0;
+        double b = (tape.right[i] >= 0) ? tape.values[tape.right[i]] : 0;
+        double& value = tape.values[i];
+
+        switch (instruction.opcode)
+        {
+            case OP_CONSTANT: value = program.constants[instruction.operand]; break;
+            case OP_VARIABLE: value = inputs[instruction.operand]; break;
+            case OP_ARGUMENT:
+            case OP_RETURN:
+            case OP_SELECT:   value = a;          break;
+            case OP_ADD:      value = a + b;      break;
+            case OP_SUBTRACT: value = a - b;      break;
+            case OP_MULTIPLY: value = a * b;      break;
+            case OP_DIVIDE:   value = a / b;      break;
+            case OP_MIN:      value = selectMinimum(a, b); break;
+            case OP_MAX:      value = selectMaximum(a, b); break;
+            case OP_SIN:      value = sin(a);     break;
+            case OP_COS:      value = cos(a);     break;
+            case OP_TAN:      value = tan(a);     break;
+            default:          value = applyComparison(instruction.opcode, a, b); break;
+        }
+
+        tape.stack[++top] = i;
+        tape.adjoints[i]  = 0;
+    }
+
+    result = tape.values[length - 1];
+    gradient.resize(n);
+    for (int j = 0; j < n; j++)
+        gradient[j] = 0;
+
+    // Backward sweep: push each adjoint down to the operands
+    tape.adjoints[length - 1] = 1;
+    for (int i = length - 1; i >= 0; i--)
+    {
+        const Instruction& instruction = program.code[i];
+        double adjoint = tape.adjoints[i];
+        int l = tape.left[i];
+        int r = tape.right[i];
+
+        switch (instruction.opcode)
+        {
+            case OP_CONSTANT:
+                break;
+            case OP_VARIABLE:
+                gradient[instruction.operand] += adjoint;
+                break;
+            case OP_ARGUMENT:
+            case OP_RETURN:
+            case OP_SELECT:
+                tape.adjoints[l] += adjoint;
+                break;
+            case OP_ADD:
+                tape.adjoints[l] += adjoint;
+                tape.adjoints[r] += adjoint;
+                break;
+            case OP_SUBTRACT:
+                tape.adjoints[l] += adjoint;
+                tape.adjoints[r] -= adjoint;
+                break;
+            case OP_MULTIPLY:
+                tape.adjoints[l] += adjoint * tape.values[r];
+                tape.adjoints[r] += adjoint * tape.values[l];
+                break;
+            case OP_DIVIDE:
+                tape.adjoints[l] += adjoint / tape.values[r];
+                tape.adjoints[r] -= adjoint * tape.values[i] / tape.values[r];
+                break;
+            case OP_MIN:
+                if (minimumPicksSecond(tape.values[l], tape.values[r]))
+                    tape.adjoints[r] += adjoint;
+                else
+                    tape.adjoints[l] += adjoint;
+                break;
+            case OP_MAX:
+                if (maximumPicksSecond(tape.values[l], tape.values[r]))
+                    tape.adjoints[r] += adjoint;
+                else
+                    tape.adjoints[l] += adjoint;
+                break;
+            case OP_SIN:
+                tape.adjoints[l] += adjoint * cos(tape.values[l]);
+                break;
+            case OP_COS:
+                tape.adjoints[l] -= adjoint * sin(tape.values[l]);
+                break;
+            case OP_TAN:
+                tape.adjoints[l] += adjoint * (1 + tape.values[i] * tape.values[i]);
+                break;
+            default:
+                // Skips, comparisons and logic: nothing flows back
+                break;
+        }
+    }
+}
+
+// ----------------------------------------------------//
+
+// Batch mode. Evaluates 'program' for 'rows' rows of columnar input (one
+// column per variable slot, as for evaluateProgramBatch()). values[r] gets
+// the result for row r and gradients[r * n + j] its derivative with respect
+// to slot j, where n is the number of variables.
+
+inline void evaluateGradientBatch(const Program& program,
+    const Vector<const double*>& columns, size_t rows, double* values,
+    double* gradients)
+{
+    int n = program.variables.getSize();
+    GradientTape tape;
+    Vector<double> gradient;
+    Vector<double> inputs(n);
+
+    for (size_t r = 0; r < rows; r++)
+    {
+        for (int j = 0; j < n; j++)
+            inputs[j] = columns[j][r];
+
+        evaluateReverse(program, (n > 0) ? &inputs[0] : NULL, values[r],
+            gradient, tape);
+
+        for (int j = 0; j < n; j++)
+            gradients[r * n + j] = gradient[j];
+    }
+}
+
+#endif
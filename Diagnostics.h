@@ -0,0 +1,128 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+// Necessary for the error buffer
+#include "Vector.h"
+using namespace std;
+
+// Structured errors. The parsing and evaluation functions keep returning
+// bool, and can fill in a Diagnostic as well when given one: what went wrong
+// and at which token. Passing NULL (the default) skips all of this, so
+// callers that only need true/false pay nothing.
+//
+// 'token' is an index into the tokens the function was given: the infix
+// expression for shuntingYard(), the postfix expression for
+// evaluatePostfix() and compileProgram(). shuntingYard() and compileProgram()
+// can also record where each output token came from ('origins'), which maps
+// any later error back to the infix expression.
+
+enum ErrorCode
+{
+    ERROR_NONE,
+    ERROR_MISMATCHED_PARENTHESES, // ")" without "(", or "(" never closed
+    ERROR_MISPLACED_COMMA,        // "," outside of a function call
+    ERROR_MISSING_OPERAND,        // an operator without enough values
+    ERROR_EXTRA_VALUES,           // values left over, e.g. "1 2"
+    ERROR_UNKNOWN_TOKEN,          // neither a number, operator nor variable
+    ERROR_UNDEFINED_VARIABLE,     // a variable that has no value
+    ERROR_DIVISION_BY_ZERO,
+    ERROR_NOT_FINITE,             // strict mode: a NaN or infinite result
+    ERROR_OUT_OF_RANGE,           // a number too large for the numeric type
+    ERROR_WRONG_ARGUMENTS         // a call with more or fewer arguments than
+                                  // the function takes
+};
+
+struct Diagnostic
+{
+    int code;  // an ErrorCode
+    int token; // index of the offending token, -1 for the end of the input
+};
+
+// Returns a short description of an ErrorCode, for printing.
+
+inline const char* errorMessage(int code)
+{
+    switch (code)
+    {
+        case ERROR_NONE:                   return "No error";
+        case ERROR_MISMATCHED_PARENTHESES: return "Mismatched parentheses";
+        case ERROR_MISPLACED_COMMA:        return "Comma outside of a function call";
+        case ERROR_MISSING_OPERAND:        return "Missing operand";
+        case ERROR_EXTRA_VALUES:           return "Too many values";
+        case ERROR_UNKNOWN_TOKEN:          return "Unknown token";
+        case ERROR_UNDEFINED_VARIABLE:     return "Undefined variable";
+        case ERROR_DIVISION_BY_ZERO:       return "Division by zero";
+        case ERROR_NOT_FINITE:             return "Result is not finite";
+        case ERROR_OUT_OF_RANGE:           return "Number out of range";
+        case ERROR_WRONG_ARGUMENTS:        return "Wrong number of arguments";
+        default:                           return "Unknown error";
+    }
+}
+
+// Fills in 'diagnostic' if there is one. Returns false, so that error paths
+// can simply "return report(...)".
+
+inline bool report(Diagnostic* diagnostic, int code, int token)
+{
+    if (diagnostic != NULL)
+    {
+        diagnostic->code  = code;
+        diagnostic->token = token;
+    }
+    return false;
+}
+
+// ----------------------------------------------------//
+
+// One failed row of a batch evaluation.
+struct RowError
+{
+    size_t row;
+    int code; // an ErrorCode
+};
+
+// Collects the failed rows of batch evaluations. Rows are checked a batch
+// at a time with plain loops that compile to vector compares, and nothing
+// is written here unless a row actually fails, so evaluating clean data
+// costs no branches per row and no allocations. The output values of failed
+// rows are still the IEEE results (inf or NaN).
+//
+// Division by zero is always reported. With 'strict' set, any row whose
+// result is NaN or infinite is reported too, for whatever reason. At most
+// 'limit' rows are kept in 'rows', but 'count' counts all of them.
+struct BatchErrors
+{
+    bool strict;
+    int limit;
+    long count;
+    Vector<RowError> rows;
+};
+
+inline void clearBatchErrors(BatchErrors& errors)
+{
+    errors.count = 0;
+    errors.rows.clear();
+}
+
+inline BatchErrors makeBatchErrors(bool strict, int limit)
+{
+    BatchErrors errors;
+    errors.strict = strict;
+    errors.limit  = limit;
+    errors.count  = 0;
+    return errors;
+}
+
+// Records a failed row, keeping at most errors.limit of them.
+
+inline void addRowError(BatchErrors& errors, size_t row, int code)
+{
+    errors.count++;
+    if (errors.rows.getSize() < errors.limit)
+    {
+        RowError error = {row, code};
+        errors.rows.pushBack(error);
+    }
+}
+
+#endif
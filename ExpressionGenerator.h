@@ -0,0 +1,185 @@
+#ifndef EXPRESSION_GENERATOR_H
+#define EXPRESSION_GENERATOR_H
+
+// Necessary for the random values and for writing expressions out
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include "Vector.h"
+#include "NumberFormat.h"
+using namespace std;
+
+// Generates random infix expressions, as token vectors in the same form the
+// driver produces. Used by the differential fuzzer to compare evaluation
+// back ends, and to produce the expression corpora the benchmarks run on.
+
+// A small, fast and fully deterministic random number generator
+// (splitmix64), so a seed always reproduces the same expressions on every
+// platform.
+class Random
+{
+public:
+    Random(uint64_t seed) { mState = seed; }
+
+    uint64_t next()
+    {
+        uint64_t z = (mState += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform in [0, bound)
+    int below(int bound) { return (int) (next() % (uint64_t) bound); }
+
+    // Uniform in [0, 1)
+    double unit() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+private:
+    uint64_t mState;
+};
+
+// The operators the generator can use, in the order of
+// GeneratorOptions::weights. The comparisons, logic and "if" come last and
+// are off by default, so existing seeds keep producing the same expressions.
+const char* const GENERATOR_OPERATORS[] =
+    {"+", "-", "*", "/", "min", "max", "sin", "cos", "tan",
+     "<", "<=", ">", ">=", "==", "!=", "and", "or", "if"};
+const int GENERATOR_OPERATOR_COUNT = 18;
+const int GENERATOR_FIRST_CONDITION = 9;
+
+// Controls the shape of the generated expressions.
+struct GeneratorOptions
+{
+    int maxDepth;       // nesting depth of operators
+    int variableCount;  // variables are named x0, x1, ...
+    double leafChance;  // chance of stopping early at each level
+    double variableChance; // chance that a leaf is a variable, not a literal
+    int weights[GENERATOR_OPERATOR_COUNT]; // relative operator frequencies
+};
+
+// Depth 6 gives formulas of up to a few hundred tokens; fuzz_evaluator
+// --depth goes deeper.
+inline GeneratorOptions defaultGeneratorOptions()
+{
+    GeneratorOptions options;
+    options.maxDepth       = 6;
+    options.variableCount  = 4;
+    options.leafChance     = 0.2;
+    options.variableChance = 0.5;
+    for (int i = 0; i < GENERATOR_OPERATOR_COUNT; i++)
+        options.weights[i] = (i < GENERATOR_FIRST_CONDITION) ? 1 : 0;
+
+    // Arithmetic is more common than functions in real formulas
+    options.weights[0] = options.weights[1] = 4;
+    options.weights[2] = options.weights[3] = 3;
+    return options;
+}
+
+// Returns the name of variable 'index'.
+
+inline string generatorVariable(int index)
+{
+    stringstream ss;
+    ss << "x" << index;
+    return ss.str();
+}
+
+// Appends a random literal or variable to 'tokens'.
+
+inline void generateLeaf(Random& random, const GeneratorOptions& options,
+    Vector<string>& tokens)
+{
+    if (options.variableCount > 0 && random.unit() < options.variableChance)
+    {
+        tokens.pushBack(generatorVariable(random.below(options.variableCount)));
+        return;
+    }
+
+    // Mostly small "human" numbers, sometimes awkward ones
+    double value;
+    switch (random.below(4))
+    {
+        case 0:  value = random.below(10);                       break;
+        case 1:  value = random.below(1000) / 100.0;             break;
+        case 2:  value = (random.unit() - 0.5) * 1e6;            break;
+        default: value = random.unit() * 1e-3;                   break;
+    }
+
+    NumberFormat format = {true, 17};
+    tokens.pushBack(formatNumber(value, format));
+}
+
+// Appends a random expression of at most 'depth' levels to 'tokens'. Every
+// operand that is itself an operation is parenthesized, so the result
+// parses the same way regardless of precedence.
+
+inline void generateExpression(Random& random, const GeneratorOptions& options,
+    int depth, Vector<string>& tokens)
+{
+    if (depth <= 0 || random.unit() < options.leafChance)
+    {
+        generateLeaf(random, options, tokens);
+        return;
+    }
+
+    // Pick an operator according to the weights
+    int total = 0;
+    for (int i = 0; i < GENERATOR_OPERATOR_COUNT; i++)
+        total += options.weights[i];
+    if (total <= 0)
+    {
+        generateLeaf(random, options, tokens);
+        return;
+    }
+
+    int pick = random.below(total);
+    int op = 0;
+    while (pick >= options.weights[op])
+        pick -= options.weights[op++];
+
+    string name = GENERATOR_OPERATORS[op];
+    bool infix = (op < 4) || (op >= GENERATOR_FIRST_CONDITION && name != "if");
+
+    if (infix)
+    {
+        // Infix: ( a ) op ( b )
+        tokens.pushBack("(");
+        generateExpression(random, options, depth - 1, tokens);
+        tokens.pushBack(")");
+        tokens.pushBack(name);
+        tokens.pushBack("(");
+        generateExpression(random, options, depth - 1, tokens);
+        tokens.pushBack(")");
+    }
+    else
+    {
+        // Function call: name ( a ), name ( a , b ) or if ( c , a , b )
+        int arguments = (name == "if") ? 3 : (op < 6) ? 2 : 1;
+        tokens.pushBack(name);
+        tokens.pushBack("(");
+        for (int k = 0; k < arguments; k++)
+        {
+            if (k > 0)
+                tokens.pushBack(",");
+            generateExpression(random, options, depth - 1, tokens);
+        }
+        tokens.pushBack(")");
+    }
+}
+
+// Joins tokens with spaces, the format the driver reads.
+
+inline string joinTokens(const Vector<string>& tokens)
+{
+    string text;
+    for (int i = 0; i < tokens.getSize(); i++)
+    {
+        if (i > 0)
+            text += ' ';
+        text += tokens[i];
+    }
+    return text;
+}
+
+#endif
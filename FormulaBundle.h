@@ -0,0 +1,396 @@
+#ifndef FORMULA_BUNDLE_H
+#define FORMULA_BUNDLE_H
+
+// Necessary for reading bundles and for swapping them between threads
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include "Vector.h"
+#include "Map.h"
+#include "Calculator.h"
+#include "Program.h"
+#include "Diagnostics.h"
+using namespace std;
+
+// Formulas that can be replaced while other threads evaluate them.
+//
+// A FormulaBundle is a set of named, compiled formulas together with
+// default values for their variables. Once built it never changes, so any
+// number of threads can read it without locks. A BundleStore holds the
+// current bundle. publish() swaps in a new one with a single atomic
+// exchange, and evaluations that started on the old bundle finish on it.
+//
+// The old bundle is freed once no reader can still be using it, which is
+// tracked with epochs. Each reader has a slot where enter() announces the
+// current epoch before loading the bundle and leave() clears it. A thread
+// that stops reading gives its slot back for the next one. publish()
+// retires the old bundle with the epoch of the swap and advances the epoch.
+// A retired bundle is freed when every reader is either outside or
+// announced a later epoch; such a reader loaded the bundle after the swap.
+// Readers never wait: enter() and leave() are a few atomic loads and
+// stores. The writer never waits for readers either: publish() only swaps
+// the pointer, and reclaim() frees what is no longer in use and leaves the
+// rest for a later call.
+//
+// Bundle files use the driver's syntax, one statement per line:
+//
+//     # rates for 2017
+//     rate = 0.07
+//     fee = 2 * rate
+//     formula total = price * ( 1 + rate ) + fee
+//
+// An assignment gives a variable its default value, and can use the
+// defaults before it. "formula NAME = EXPRESSION" adds a formula. Its
+// variables without a default have to be given when it is evaluated.
+
+struct FormulaBundle
+{
+    // Incremented by BundleStore::publish()
+    long version;
+
+    // Name and compiled program of each formula
+    Vector<string> names;
+    Vector<Program> programs;
+    Map<string, int> index;
+
+    // Default value of each variable
+    Map<string, double> defaults;
+
+    // For each formula, its inputs bound to the defaults, and whether
+    // every variable it uses has one
+    Vector< Vector<double> > inputs;
+    Vector<bool> bound;
+};
+
+// Fills in the defaults a formula can use. Slots without a default are
+// left at zero, to be given by the caller.
+
+inline bool bindDefaults(const Program& program, const Map<string, double>& defaults,
+    Vector<double>& inputs)
+{
+    bool complete = true;
+    inputs.resize(program.variables.getSize());
+    for (int i = 0; i < program.variables.getSize(); i++)
+    {
+        double value = 0;
+        if (!defaults.search(program.variables[i], value))
+            complete = false;
+        inputs[i] = value;
+    }
+    return complete;
+}
+
+// Compiles one statement of a bundle file, 'tokens' being the tokens of
+// the line. Returns false with a message in 'error'.
+
+inline bool addStatement(FormulaBundle& bundle, const Vector<string>& tokens,
+    string& error)
+{
+    bool formula = tokens[0] == "formula";
+    int name = formula ? 1 : 0;
+    if (tokens.getSize() < name + 3 || tokens[name + 1] != "=" || !isName(tokens[name]))
+    {
+        error = "expected 'NAME = EXPRESSION' or 'formula NAME = EXPRESSION'";
+        return false;
+    }
+
+    Vector<string> postfix;
+    Program program;
+    Diagnostic diagnostic = {ERROR_NONE, -1};
+    if (!shuntingYard(tokens, name + 2, postfix, &diagnostic) ||
+        !compileProgram(postfix, program, &diagnostic))
+    {
+        error = errorMessage(diagnostic.code);
+        return false;
+    }
+
+    if (formula)
+    {
+        int existing = 0;
+        if (bundle.index.search(tokens[name], existing))
+        {
+            error = "formula " + tokens[name] + " is defined twice";
+            return false;
+        }
+        bundle.index.insert(tokens[name], bundle.names.getSize());
+        bundle.names.pushBack(tokens[name]);
+        bundle.programs.pushBack(program);
+        return true;
+    }
+
+    // A default, from the defaults before it
+    Vector<double> inputs;
+    double value = 0;
+    if (!bindVariables(program, bundle.defaults, inputs))
+    {
+        error = "a default can only use the defaults before it";
+        return false;
+    }
+    evaluateProgram(program, (inputs.getSize() > 0) ? &inputs[0] : NULL, value);
+    bundle.defaults.insert(tokens[name], value);
+    return true;
+}
+
+// Reads a bundle from 'in' into 'bundle', which should be new. On failure
+// 'error' names the line that could not be read, 'path' being the name
+// given to the input.
+
+inline bool readBundle(istream& in, const string& path, FormulaBundle& bundle,
+    string& error)
+{
+    bundle.version = 0;
+    string line;
+    for (int number = 1; getline(in, line); number++)
+    {
+        Vector<string> tokens;
+        tokenize(line, tokens);
+        if (tokens.getSize() == 0 || tokens[0][0] == '#')
+            continue;
+
+        string message;
+        if (!addStatement(bundle, tokens, message))
+        {
+            stringstream where;
+            where << path << ", line " << number << ": " << message;
+            error = where.str();
+            return false;
+        }
+    }
+
+    // Defaults are final once the whole file is read
+    int count = bundle.programs.getSize();
+    bundle.inputs.resize(count);
+    bundle.bound.resize(count);
+    for (int i = 0; i < count; i++)
+        bundle.bound[i] = bindDefaults(bundle.programs[i], bundle.defaults, bundle.inputs[i]);
+    return true;
+}
+
+// Reads the bundle file at 'path'.
+
+inline bool readBundle(const string& path, FormulaBundle& bundle, string& error)
+{
+    ifstream file(path.c_str());
+    if (!file)
+    {
+        error = "Could not open " + path;
+        return false;
+    }
+    return readBundle(file, path, bundle, error);
+}
+
+// Returns the index of the formula called 'name' in 'index', false if
+// there is none.
+
+inline bool findFormula(const FormulaBundle& bundle, const string& name, int& index)
+{
+    return bundle.index.search(name, index);
+}
+
+// Evaluates formula 'index' with the default values of its variables.
+// Returns false if one of them has no default.
+
+inline bool evaluateFormula(const FormulaBundle& bundle, int index, double& result)
+{
+    if (!bundle.bound[index])
+        return false;
+
+    const Vector<double>& inputs = bundle.inputs[index];
+    return evaluateProgram(bundle.programs[index],
+        (inputs.getSize() > 0) ? &inputs[0] : NULL, result);
+}
+
+// Evaluates formula 'index' with the values in 'variables', which take
+// precedence over the defaults. 'inputs' is scratch space, so that a thread
+// evaluating many rows does not allocate for each. Returns false if a
+// variable is in neither.
+
+template <template <class, class> class M, class V>
+bool evaluateFormula(const FormulaBundle& bundle, int index,
+    const M<string, V>& variables, Vector<double>& inputs, double& result)
+{
+    const Program& program = bundle.programs[index];
+    const Vector<double>& defaults = bundle.inputs[index];
+    inputs.resize(program.variables.getSize());
+
+    V variable = V();
+    for (int i = 0; i < program.variables.getSize(); i++)
+    {
+        if (variables.search(program.variables[i], variable))
+            loadVariable(variable, inputs[i]);
+        else if (bundle.bound[index])
+            inputs[i] = defaults[i];
+        else if (!bundle.defaults.search(program.variables[i], inputs[i]))
+            return false;
+    }
+    return evaluateProgram(program, (inputs.getSize() > 0) ? &inputs[0] : NULL, result);
+}
+
+// ----------------------------------------------------//
+
+// Holds the current FormulaBundle for up to MAX_READERS reader threads at a
+// time (see the top of this file). Each reader thread calls addReader()
+// before it starts, brackets every use of a bundle with enter() and leave(),
+// and calls removeReader() when it is done.
+class BundleStore
+{
+public:
+    static const int MAX_READERS = 128;
+
+    // Takes ownership of 'initial'
+    BundleStore(FormulaBundle* initial);
+    ~BundleStore();
+
+    // Returns a reader slot for the calling thread, -1 if all are taken
+    int addReader();
+    // Gives 'reader' back for another thread. The reader must be outside.
+    void removeReader(int reader);
+
+    // The current bundle, valid until leave()
+    const FormulaBundle* enter(int reader);
+    void leave(int reader);
+
+    // Makes 'bundle' current, taking ownership of it, and sets its version.
+    // The old bundle is retired; call reclaim() afterwards to free it.
+    void publish(FormulaBundle* bundle);
+
+    // Frees the retired bundles no reader can still be using. Returns the
+    // number that are left.
+    int reclaim();
+
+    long version() const;
+
+private:
+    BundleStore(const BundleStore&);
+    BundleStore& operator=(const BundleStore&);
+
+    // One cache line per reader, so announcing an epoch does not slow the
+    // other readers down
+    struct alignas(64) ReaderSlot
+    {
+        atomic<unsigned long> epoch; // 0 while outside
+        atomic<bool> used;           // taken by a reader thread
+    };
+
+    atomic<FormulaBundle*> mCurrent;
+    atomic<unsigned long> mEpoch;
+    ReaderSlot mReaders[MAX_READERS];
+    atomic<int> mReaderCount; // slots that were ever used, for reclaim()
+
+    // Only touched by publish() and reclaim(), under the lock
+    mutex mMutex;
+    Vector<FormulaBundle*> mRetired;
+    Vector<unsigned long> mRetiredEpochs;
+};
+
+inline BundleStore::BundleStore(FormulaBundle* initial) :
+    mCurrent(initial), mEpoch(1), mReaderCount(0)
+{
+    initial->version = 1;
+    for (int i = 0; i < MAX_READERS; i++)
+    {
+        mReaders[i].epoch.store(0);
+        mReaders[i].used.store(false);
+    }
+}
+
+// No reader may be inside when the store is destroyed
+
+inline BundleStore::~BundleStore()
+{
+    delete mCurrent.load();
+    for (int i = 0; i < mRetired.getSize(); i++)
+        delete mRetired[i];
+}
+
+// Takes the first free slot, so slots that were given back are used again
+// and reclaim() only has to look at as many as there were readers at once
+
+inline int BundleStore::addReader()
+{
+    for (int reader = 0; reader < MAX_READERS; reader++)
+    {
+        bool taken = false;
+        if (!mReaders[reader].used.compare_exchange_strong(taken, true))
+            continue;
+
+        // Raised before the reader can enter(), so reclaim() looks at its slot
+        int count = mReaderCount.load();
+        while (count <= reader && !mReaderCount.compare_exchange_weak(count, reader + 1))
+        {
+        }
+        return reader;
+    }
+    return -1;
+}
+
+inline void BundleStore::removeReader(int reader)
+{
+    mReaders[reader].used.store(false);
+}
+
+inline const FormulaBundle* BundleStore::enter(int reader)
+{
+    // The epoch is announced before the bundle is loaded, so once the
+    // bundle is swapped out, reclaim() sees that this reader may hold it
+    // (all of these are sequentially consistent)
+    mReaders[reader].epoch.store(mEpoch.load());
+    return mCurrent.load();
+}
+
+inline void BundleStore::leave(int reader)
+{
+    mReaders[reader].epoch.store(0);
+}
+
+inline void BundleStore::publish(FormulaBundle* bundle)
+{
+    lock_guard<mutex> lock(mMutex);
+    bundle->version = mCurrent.load()->version + 1;
+
+    FormulaBundle* old = mCurrent.exchange(bundle);
+    mRetired.pushBack(old);
+    mRetiredEpochs.pushBack(mEpoch.fetch_add(1));
+}
+
+inline int BundleStore::reclaim()
+{
+    lock_guard<mutex> lock(mMutex);
+
+    // The oldest epoch a reader inside announced
+    unsigned long oldest = mEpoch.load();
+    int readers = mReaderCount.load();
+    for (int i = 0; i < readers && i < MAX_READERS; i++)
+    {
+        unsigned long epoch = mReaders[i].epoch.load();
+        if (epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    // A bundle retired in epoch e may be in use by readers that announced
+    // e or earlier
+    int kept = 0;
+    for (int i = 0; i < mRetired.getSize(); i++)
+    {
+        if (mRetiredEpochs[i] < oldest)
+            delete mRetired[i];
+        else
+        {
+            mRetired[kept]       = mRetired[i];
+            mRetiredEpochs[kept] = mRetiredEpochs[i];
+            kept++;
+        }
+    }
+    mRetired.resize(kept);
+    mRetiredEpochs.resize(kept);
+    return kept;
+}
+
+inline long BundleStore::version() const
+{
+    return mCurrent.load()->version;
+}
+
+#endif
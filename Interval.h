@@ -0,0 +1,304 @@
+#ifndef INTERVAL_H
+#define INTERVAL_H
+
+// Necessary for the math functions and print()
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include "Numeric.h"
+using namespace std;
+
+// A closed range [lo, hi] of doubles. Evaluating an expression with
+// Interval values gives bounds on every result the expression can produce
+// when each variable is anywhere inside its range. This is what lets a
+// caller skip a whole block of rows: if the bounds computed from the block's
+// per-column min/max cannot satisfy a predicate, no row in the block can.
+//
+// The bounds are guaranteed to contain the value a plain double evaluation
+// would produce for any row in range, not just the exact real-number result.
+// For + - * / that comes for free: rounding to nearest is monotonic, so the
+// rounded endpoints still enclose the rounded result. Trig results are
+// widened by one ulp since libm is not guaranteed to be monotonic. Their
+// peaks and poles are found with the rounded INTERVAL_PI, which drifts from
+// the real ones as the argument grows, so a range counts as reaching one
+// if it comes within reductionError() of it. Beyond
+// INTERVAL_REDUCTION_LIMIT that error is over half a period, and sin and
+// cos give [-1, 1], tan the whole line.
+//
+// NaN cannot be stored as a bound. Whenever a row could evaluate to NaN
+// (inf - inf, 0 * inf, 0 / 0, sin of inf) the result is [-inf, inf] instead.
+// That keeps min and max correct, since they ignore a NaN operand and take
+// the other one.
+//
+// Comparisons and logic give [1, 1] when every row is true, [0, 0] when
+// every row is false and [0, 1] otherwise. if(c, a, b) gives a's or b's
+// bounds when c's truth is known, and both combined when it is not.
+struct Interval
+{
+    double lo;
+    double hi;
+};
+
+// Convenience constructor for binding a variable to a range.
+
+inline Interval makeInterval(double lo, double hi)
+{
+    Interval result = {lo, hi};
+    return result;
+}
+
+inline ostream& operator<<(ostream& out, const Interval& value)
+{
+    out << "[" << value.lo << ", " << value.hi << "]";
+    return out;
+}
+
+const double INTERVAL_PI = 3.14159265358979323846;
+const double INTERVAL_REDUCTION_LIMIT = 281474976710656.0; // 2^48
+
+template <>
+struct NumericTraits<Interval>
+{
+    static const char* name() { return "interval"; }
+
+    static Interval fromDouble(double value) { return makeInterval(value, value); }
+
+    // Only meaningful for point intervals; callers that need the bounds
+    // should read 'lo' and 'hi' directly.
+    static double toDouble(Interval value) { return 0.5 * (value.lo + value.hi); }
+
+    static bool parse(const string& token, Interval& value)
+    {
+        double parsed = 0;
+        if (!parseNumber(token, parsed))
+            return false;
+        value = fromDouble(parsed);
+        return true;
+    }
+
+    static Interval add(Interval a, Interval b)
+    {
+        return checked(makeInterval(a.lo + b.lo, a.hi + b.hi));
+    }
+
+    static Interval subtract(Interval a, Interval b)
+    {
+        return checked(makeInterval(a.lo - b.hi, a.hi - b.lo));
+    }
+
+    static Interval multiply(Interval a, Interval b)
+    {
+        // The extremes are always at a pair of endpoints
+        return hull(a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi);
+    }
+
+    static Interval divide(Interval a, Interval b)
+    {
+        // Anything can happen once the divisor can be zero
+        if (b.lo <= 0 && b.hi >= 0)
+            return entire();
+
+        return hull(a.lo / b.lo, a.lo / b.hi, a.hi / b.lo, a.hi / b.hi);
+    }
+
+    static Interval minimum(Interval a, Interval b)
+    {
+        return makeInterval(fmin(a.lo, b.lo), fmin(a.hi, b.hi));
+    }
+
+    static Interval maximum(Interval a, Interval b)
+    {
+        return makeInterval(fmax(a.lo, b.lo), fmax(a.hi, b.hi));
+    }
+
+    // sin peaks at pi/2 + 2k*pi and bottoms out at -pi/2 + 2k*pi
+    static Interval sine(Interval a)
+    {
+        return periodic(a, sin(a.lo), sin(a.hi), 0.5 * INTERVAL_PI);
+    }
+
+    // cos peaks at 2k*pi and bottoms out at pi + 2k*pi
+    static Interval cosine(Interval a)
+    {
+        return periodic(a, cos(a.lo), cos(a.hi), 0.0);
+    }
+
+    // tan increases between its poles at pi/2 + k*pi
+    static Interval tangent(Interval a)
+    {
+        if (!isfinite(a.lo) || !isfinite(a.hi) || a.hi - a.lo >= INTERVAL_PI ||
+            !reducible(a))
+            return entire();
+
+        double error = reductionError(a);
+        double pole = 0.5 * INTERVAL_PI
+            + ceil((a.lo - error - 0.5 * INTERVAL_PI) / INTERVAL_PI) * INTERVAL_PI;
+        if (pole <= a.hi + error)
+            return entire();
+
+        return widen(makeInterval(tan(a.lo), tan(a.hi)));
+    }
+
+    static Interval less(Interval a, Interval b)
+    {
+        return compared(a, b, a.hi < b.lo, a.lo >= b.hi);
+    }
+
+    static Interval lessEqual(Interval a, Interval b)
+    {
+        return compared(a, b, a.hi <= b.lo, a.lo > b.hi);
+    }
+
+    static Interval greater(Interval a, Interval b)      { return less(b, a); }
+    static Interval greaterEqual(Interval a, Interval b) { return lessEqual(b, a); }
+
+    static Interval equal(Interval a, Interval b)
+    {
+        bool point    = (a.lo == a.hi && b.lo == b.hi && a.lo == b.lo);
+        bool disjoint = (a.hi < b.lo || b.hi < a.lo);
+        return compared(a, b, point, disjoint);
+    }
+
+    static Interval notEqual(Interval a, Interval b)
+    {
+        bool point    = (a.lo == a.hi && b.lo == b.hi && a.lo == b.lo);
+        bool disjoint = (a.hi < b.lo || b.hi < a.lo);
+        return compared(a, b, disjoint, point);
+    }
+
+    static Interval logicalAnd(Interval a, Interval b)
+    {
+        int ta = truth(a), tb = truth(b);
+        if (ta == 0 || tb == 0) return fromDouble(0);
+        if (ta == 1 && tb == 1) return fromDouble(1);
+        return makeInterval(0, 1);
+    }
+
+    static Interval logicalOr(Interval a, Interval b)
+    {
+        int ta = truth(a), tb = truth(b);
+        if (ta == 1 || tb == 1) return fromDouble(1);
+        if (ta == 0 && tb == 0) return fromDouble(0);
+        return makeInterval(0, 1);
+    }
+
+    // A range that may hold NaN is [-inf, inf], which holds 0 as well, so
+    // its truth is never claimed to be known.
+    static int truth(Interval a)
+    {
+        if (a.lo > 0 || a.hi < 0)    return 1;
+        if (a.lo == 0 && a.hi == 0)  return 0;
+        return -1;
+    }
+
+    static Interval select(Interval c, Interval a, Interval b)
+    {
+        int known = truth(c);
+        if (known == 1) return a;
+        if (known == 0) return b;
+        return makeInterval(fmin(a.lo, b.lo), fmax(a.hi, b.hi));
+    }
+
+    static bool overflowed(Interval) { return false; }
+
+private:
+    // Result of a comparison that is known to be true for every row in
+    // range ('always'), known to be false ('never'), or neither. Nothing is
+    // known when an operand may be NaN.
+    static Interval compared(Interval a, Interval b, bool always, bool never)
+    {
+        if (mayBeNaN(a) || mayBeNaN(b))
+            return makeInterval(0, 1);
+        if (always) return fromDouble(1);
+        if (never)  return fromDouble(0);
+        return makeInterval(0, 1);
+    }
+
+    static bool mayBeNaN(Interval a)
+    {
+        return isinf(a.lo) && isinf(a.hi) && a.lo < a.hi;
+    }
+
+    static Interval entire()
+    {
+        double infinity = numeric_limits<double>::infinity();
+        return makeInterval(-infinity, infinity);
+    }
+
+    // inf - inf produces NaN, and then nothing is known
+    static Interval checked(Interval a)
+    {
+        if (isnan(a.lo) || isnan(a.hi))
+            return entire();
+        return a;
+    }
+
+    static Interval hull(double a, double b, double c, double d)
+    {
+        // 0 * inf produces NaN, and then nothing is known
+        if (isnan(a) || isnan(b) || isnan(c) || isnan(d))
+            return entire();
+
+        return makeInterval(fmin(fmin(a, b), fmin(c, d)),
+                            fmax(fmax(a, b), fmax(c, d)));
+    }
+
+    // Whether peaks and poles can be found for the arguments in 'a'
+    static bool reducible(Interval a)
+    {
+        return fabs(a.lo) <= INTERVAL_REDUCTION_LIMIT &&
+               fabs(a.hi) <= INTERVAL_REDUCTION_LIMIT;
+    }
+
+    // How far a peak or pole computed with INTERVAL_PI can be from the real
+    // one within 'a': INTERVAL_PI is off by under 2^-52 of pi, which is
+    // multiplied by the number of periods, and the reduction itself rounds
+    // a few times. 8 ulps of the largest argument covers both.
+    static double reductionError(Interval a)
+    {
+        double largest = fmax(fabs(a.lo), fabs(a.hi));
+        return 8 * numeric_limits<double>::epsilon() * (largest + 1);
+    }
+
+    // Moves both ends out by one ulp
+    static Interval widen(Interval a)
+    {
+        double infinity = numeric_limits<double>::infinity();
+        return makeInterval(nextafter(a.lo, -infinity), nextafter(a.hi, infinity));
+    }
+
+    // Bounds for sin/cos given the values at the endpoints and the position
+    // of the first peak. A peak inside the range raises the upper bound to 1,
+    // a trough (half a period later) lowers the lower bound to -1.
+    static Interval periodic(Interval a, double atLo, double atHi, double peak)
+    {
+        // sin/cos of infinity is NaN
+        if (!isfinite(a.lo) || !isfinite(a.hi))
+            return entire();
+        if (a.hi - a.lo >= 2 * INTERVAL_PI || !reducible(a))
+            return makeInterval(-1, 1);
+
+        Interval result = widen(makeInterval(fmin(atLo, atHi), fmax(atLo, atHi)));
+
+        // Peaks just outside of the range may really be inside
+        double error = reductionError(a);
+        double lo = a.lo - error;
+        double hi = a.hi + error;
+
+        double period = 2 * INTERVAL_PI;
+        double nextPeak   = peak + ceil((lo - peak) / period) * period;
+        double nextTrough = peak + INTERVAL_PI
+                          + ceil((lo - peak - INTERVAL_PI) / period) * period;
+
+        if (nextPeak <= hi)
+            result.hi = 1;
+        if (nextTrough <= hi)
+            result.lo = -1;
+
+        if (result.lo < -1) result.lo = -1;
+        if (result.hi >  1) result.hi =  1;
+        return result;
+    }
+};
+
+#endif
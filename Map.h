@@ -3,6 +3,10 @@
 
 // Necessary for print()
 #include <iostream>
+// Necessary for make_pair()
+#include <utility>
+#include "Stack.h"
+#include "MemoryUsage.h"
 using namespace std;
 
 // Represents a single Node in the BST used to implement the map.
@@ -19,6 +23,8 @@ struct Node
 // stores (key, value) pairs of arbitrary types, and the nodes
 // are stored in sorted order based on the key.
 // This implementation does NOT guarantee O(lg N) behavior.
+// Every operation uses loops rather than recursion, so even a degenerate
+// tree (keys inserted in sorted order) cannot overflow the call stack.
 template <class Key, class Value>
 class Map
 {
@@ -31,17 +37,22 @@ public:
     // Tree modification
     void insert(const Key& key, const Value& value);
     bool remove(const Key& key, Value& value);
+    void clear();
     
     // Tree statistics
     bool search(const Key& key, Value& value) const;
     void print() const;
     int size() const;
     
+    // Memory accounting (see MemoryUsage.h)
+    size_t heapBytes() const;
+    size_t memoryUsage() const;
+    
 private:
     Node<Key, Value>* mRoot;
     
     // Private helper functions. These do all the real work
-    // for the recursive algorithms, but we expose a simpler
+    // for the tree algorithms, but we expose a simpler
     // API to the user so they don't have to worry about the
     // implementation details.
     void copyHelper(Node<Key, Value>* src, Node<Key, Value>*& dest);
@@ -54,6 +65,7 @@ private:
     bool searchHelper(const Key& key, Value& value, const Node<Key, Value>* root) const;
     void printHelper(const Node<Key, Value>* root) const;
     int sizeHelper(const Node<Key, Value>* root)  const;
+    size_t heapBytesHelper(const Node<Key, Value>* root) const;
 };
 
 // ----------------------------------------------------//
@@ -77,21 +89,30 @@ template <class Key, class Value>
 void Map<Key, Value>::copyHelper(Node<Key, Value>* src, Node<Key, Value>*& dest)
 {
     // 'src' was empty - nothing to clone
-    if (src == NULL) 
-        dest = NULL;
+    dest = NULL;
     
-    else
+    // Each pending entry is a node still to clone and the link in the
+    // copy that should point to its clone
+    Stack< pair<Node<Key, Value>*, Node<Key, Value>**> > pending;
+    if (src != NULL)
+        pending.push(make_pair(src, &dest));
+    
+    pair<Node<Key, Value>*, Node<Key, Value>**> next;
+    while (pending.pop(next))
     {
-        // Turn 'dest' into a clone of 'src'
-        dest        = new Node<Key, Value>();
-        dest->key   = src->key;
-        dest->value = src->value;
-        dest->left  = NULL;
-        dest->right = NULL;
+        // Turn the link into a clone of the node
+        Node<Key, Value>* clone = new Node<Key, Value>();
+        clone->key   = next.first->key;
+        clone->value = next.first->value;
+        clone->left  = NULL;
+        clone->right = NULL;
+        *next.second = clone;
         
-        // Recursively clone the left and right children
-        copyHelper(src->left,  dest->left);
-        copyHelper(src->right, dest->right);
+        // Then clone the left and right children
+        if (next.first->left != NULL)
+            pending.push(make_pair(next.first->left, &clone->left));
+        if (next.first->right != NULL)
+            pending.push(make_pair(next.first->right, &clone->right));
     }
 }
 
@@ -104,16 +125,35 @@ Map<Key, Value>::~Map()
     mRoot = NULL;
 }
 
+template <class Key, class Value>
+void Map<Key, Value>::clear()
+{
+    destroyHelper(mRoot);
+    mRoot = NULL;
+}
+
 template <class Key, class Value>
 void Map<Key, Value>::destroyHelper(Node<Key, Value>* root)
 {
-    // Use a postorder traversal for deletion. Delete both
-    // the left and right children before we delete ourselves.
-    if (root != NULL)
+    // Without recursion, so that deep (unbalanced) trees cannot overflow
+    // the call stack. A node with a left child is rotated right until it
+    // has none, then deleted, and we move on to its right child. Every
+    // rotation puts one more node on the right spine, so this is O(N).
+    while (root != NULL)
     {
-        destroyHelper(root->left);
-        destroyHelper(root->right);
-        delete root;
+        if (root->left != NULL)
+        {
+            Node<Key, Value>* left = root->left;
+            root->left  = left->right;
+            left->right = root;
+            root = left;
+        }
+        else
+        {
+            Node<Key, Value>* right = root->right;
+            delete root;
+            root = right;
+        }
     }
 }
 
@@ -132,31 +172,31 @@ void Map<Key, Value>::insert(const Key& key, const Value& value)
 template <typename Key, typename Value>
 void Map<Key, Value>::insertHelper(const Key& key, const Value& value, Node<Key, Value>*& root)
 {
-    // When 'root' is NULL, we've found where to insert the value
-    if (root == NULL)
+    // Walk down the tree with a pointer to the link we follow, so the loop
+    // needs no recursion however deep the tree gets
+    Node<Key, Value>** link = &root;
+    while (*link != NULL)
     {
-        root         = new Node<Key, Value>();
-        root->key    = key;
-        root->value  = value;
-        root->left   = NULL;
-        root->right  = NULL;
+        // duplicate keys
+        if ((*link)->key == key)
+        {
+            (*link)->value = value;
+            return;
+        }
+        // Go either to the left or to the right to determine
+        // where 'value' should be placed.
+        else if ((*link)->key > key)
+            link = &(*link)->left;
+        else
+            link = &(*link)->right;
     }
     
-    // duplicate keys
-    else if (root->key == key)
-    {
-        root->value = value;
-    }    
-    // Recurse either to the left or to the right to determine
-    // where 'value' should be placed.
-    else if (root->key > key)
-    {
-        insertHelper(key, value, root->left);
-    }
-    else
-    {
-        insertHelper(key, value, root->right); 
-    }
+    // When the link is NULL, we've found where to insert the value
+    *link          = new Node<Key, Value>();
+    (*link)->key   = key;
+    (*link)->value = value;
+    (*link)->left  = NULL;
+    (*link)->right = NULL;
 }
 
 template <typename Key, typename Value>
@@ -171,29 +211,24 @@ bool Map<Key, Value>::remove(const Key& key, Value& value)
 template <typename Key, typename Value>
 bool Map<Key, Value>::removeHelper(const Key& key, Value& value, Node<Key, Value>*& root)
 {
-    // If the root is empty, 'value' wasn't in the tree.
-    if (root == NULL)
+    // Use binary search to find the link to the node holding 'key'
+    Node<Key, Value>** link = &root;
+    while (*link != NULL && !((*link)->key == key))
+    {
+        if ((*link)->key > key)
+            link = &(*link)->left;
+        else
+            link = &(*link)->right;
+    }
+    
+    // If we ran off the tree, 'value' wasn't in it.
+    if (*link == NULL)
         return false;
     
     // We found 'value'! Eliminate it and return true.
-    else if (root->key == key)
-    {
-        value = root->value;
-        // Remove root
-        deleteNode(root);
-        return true;
-    }
-    // basically recurse until you find the root i think
-    // 'value' must either be on the left branch or the
-    // right branch. Use binary search to find it.
-    else if (root->key > key)
-    {
-        return removeHelper(key, value, root->left);
-    }
-    else
-    {
-        return removeHelper(key, value, root->right);
-    }    
+    value = (*link)->value;
+    deleteNode(*link);
+    return true;
 }
 
 template <typename Key, typename Value>
@@ -267,25 +302,24 @@ template <typename Key, typename Value>
 bool Map<Key, Value>::searchHelper(const Key& key, Value& value, const Node<Key, 
         Value>* root) const
 {
-    // If the subtree is empty, we didn't find 'value'
-    if (root == NULL) return false;
-    
-    // We found 'value'!
-    else if (root->key == key)
-    {
-        value = root->value;
-        return true;
-    }
-    // We have to search either the left or the right
-    // subtree using binary search.
-    else if (root->key > key)
-    {
-        return searchHelper(key, value, root->left);
-    }
-    else
+    // Binary search down the tree, as a loop
+    while (root != NULL)
     {
-        return searchHelper(key, value, root->right);  
+        // We found 'value'!
+        if (root->key == key)
+        {
+            value = root->value;
+            return true;
+        }
+        // We have to search either the left or the right subtree
+        else if (root->key > key)
+            root = root->left;
+        else
+            root = root->right;
     }
+    
+    // If the subtree is empty, we didn't find 'value'
+    return false;
 }
 
 // ----------------------------------------------------//
@@ -300,15 +334,24 @@ void Map<Key, Value>::print() const
 template <class Key, class Value>
 void Map<Key, Value>::printHelper(const Node<Key, Value>* root) const
 {
-    // If the tree is empty, there is nothing to print
-    if (root == NULL)
-        return;
-    
     // Use an in-order traversal to print the tree's contents.
     // An in-order traversal will print the data in sorted order.
-    printHelper(root->left);
-    cout << "(" << root->key << ", " << root->value << ") ";
-    printHelper(root->right);
+    // 'pending' holds the nodes whose left subtree is being printed.
+    Stack<const Node<Key, Value>*> pending;
+    while (root != NULL || !pending.isEmpty())
+    {
+        if (root != NULL)
+        {
+            pending.push(root);
+            root = root->left;
+        }
+        else
+        {
+            pending.pop(root);
+            cout << "(" << root->key << ", " << root->value << ") ";
+            root = root->right;
+        }
+    }
 }
 
 // ----------------------------------------------------//
@@ -322,8 +365,63 @@ int Map<Key, Value>::size() const
 template <class Key, class Value>
 int Map<Key, Value>::sizeHelper(const Node<Key, Value>* root) const
 {
-    if (root == NULL) return 0;
-    else              return sizeHelper(root->left) + sizeHelper(root->right) + 1;
+    // Count the nodes in any order, keeping the subtrees still to visit
+    int count = 0;
+    Stack<const Node<Key, Value>*> pending;
+    if (root != NULL)
+        pending.push(root);
+    
+    while (pending.pop(root))
+    {
+        count++;
+        if (root->left != NULL)
+            pending.push(root->left);
+        if (root->right != NULL)
+            pending.push(root->right);
+    }
+    return count;
+}
+  
+// ----------------------------------------------------//
+
+template <class Key, class Value>
+size_t Map<Key, Value>::heapBytes() const
+{
+    return heapBytesHelper(mRoot);
+}
+
+template <class Key, class Value>
+size_t Map<Key, Value>::heapBytesHelper(const Node<Key, Value>* root) const
+{
+    // Every node is its own allocation, holding a key and a value that may
+    // own more memory themselves.
+    size_t bytes = 0;
+    Stack<const Node<Key, Value>*> pending;
+    if (root != NULL)
+        pending.push(root);
+    
+    while (pending.pop(root))
+    {
+        bytes += sizeof(Node<Key, Value>) + heapBytesOf(root->key) 
+               + heapBytesOf(root->value);
+        if (root->left != NULL)
+            pending.push(root->left);
+        if (root->right != NULL)
+            pending.push(root->right);
+    }
+    return bytes;
+}
+
+template <class Key, class Value>
+size_t Map<Key, Value>::memoryUsage() const
+{
+    return sizeof(*this) + heapBytes();
+}
+
+template <class Key, class Value>
+inline size_t heapBytesOf(const Map<Key, Value>& value)
+{
+    return value.heapBytes();
 }
   
 #endif
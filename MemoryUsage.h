@@ -0,0 +1,36 @@
+#ifndef MEMORY_USAGE_H
+#define MEMORY_USAGE_H
+
+// Necessary for size_t and string
+#include <cstddef>
+#include <string>
+using namespace std;
+
+// Memory accounting. heapBytesOf(x) returns the number of bytes 'x' owns on
+// the heap, not counting sizeof(x) itself, so the total footprint of an
+// object is sizeof(x) + heapBytesOf(x). The containers (Vector, Stack, Map)
+// add up heapBytesOf() for their elements; their heapBytes() and
+// memoryUsage() members give their own totals. Overloads for other types
+// are declared next to those types.
+
+// Plain values (numbers, Instructions, ...) own nothing
+template <class T>
+inline size_t heapBytesOf(const T&)
+{
+    return 0;
+}
+
+// Short strings are stored inside the string object itself. Only longer
+// ones have a separate heap buffer.
+inline size_t heapBytesOf(const string& value)
+{
+    const char* data  = value.data();
+    const char* begin = (const char*) &value;
+    const char* end   = begin + sizeof(value);
+
+    if (data >= begin && data < end)
+        return 0;
+    return value.capacity() + 1;
+}
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef MULTI_PROGRAM_H
+#define MULTI_PROGRAM_H
+
+// Necessary for the math functions and for comparing constants bit by bit
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "Vector.h"
+#include "Map.h"
+#include "PersistentMap.h"
+#include "Program.h"
+using namespace std;
+
+// Many compiled programs fused into one schedule, for evaluating thousands
+// of formulas against the same row of variable values.
+//
+// Evaluating the programs one by one loads the same variables and computes
+// the same sub-expressions over and over. Here every program is turned into
+// nodes of one shared DAG instead: a node is an operation on earlier nodes,
+// and a node that already exists (same operation on the same inputs) is
+// reused rather than added again. Each variable is loaded once, each
+// distinct sub-expression is computed once, and sub-expressions made only
+// of constants are folded while building. The nodes are created children
+// first, so running them in order is a topological order.
+//
+// Every node owns one slot of a register file that is shared by all the
+// programs. Constant nodes are written into it once, when the schedule is
+// built; evaluating a row only runs the remaining nodes.
+//
+// Conditionals are evaluated on both sides, as in evaluateProgramBatch(),
+// and then selected.
+
+struct MultiNode
+{
+    unsigned char opcode; // an Opcode; OP_VARIABLE reads inputs[left]
+    int left;             // register of the first operand
+    int right;            // register of the second operand
+    int third;            // register of the third operand (OP_SELECT)
+};
+
+struct MultiProgram
+{
+    // Name of each input slot, the union of the programs' variables
+    Vector<string> variables;
+    // Nodes that have to run for every row, in order
+    Vector<MultiNode> schedule;
+    // Register written by each scheduled node
+    Vector<int> targets;
+    // Register holding each program's result
+    Vector<int> results;
+    // One value per node; constants are filled in up front. Evaluation
+    // writes into this, so each thread needs its own copy.
+    Vector<double> registers;
+};
+
+// Identifies a node for common sub-expression elimination. Map is an
+// unbalanced tree, and nodes are created with increasing register numbers,
+// so keys are ordered by a hash first to keep the tree from degenerating
+// into a list.
+struct MultiNodeKey
+{
+    uint64_t hash;
+    int opcode;
+    int left;
+    int right;
+    int third;
+    uint64_t bits; // the value of a constant node
+
+    bool operator==(const MultiNodeKey& other) const
+    {
+        return hash == other.hash && opcode == other.opcode &&
+               left == other.left && right == other.right &&
+               third == other.third && bits == other.bits;
+    }
+
+    bool operator>(const MultiNodeKey& other) const
+    {
+        if (hash   != other.hash)   return hash   > other.hash;
+        if (opcode != other.opcode) return opcode > other.opcode;
+        if (left   != other.left)   return left   > other.left;
+        if (right  != other.right)  return right  > other.right;
+        if (third  != other.third)  return third  > other.third;
+        return bits > other.bits;
+    }
+};
+
+inline MultiNodeKey makeMultiNodeKey(int opcode, int left, int right, int third,
+    double value)
+{
+    MultiNodeKey key;
+    key.opcode = opcode;
+    key.left   = left;
+    key.right  = right;
+    key.third  = third;
+    memcpy(&key.bits, &value, sizeof(value));
+
+    // FNV-1a over the fields
+    uint64_t fields[5] = {(uint64_t) opcode, (uint64_t) left, (uint64_t) right,
+                          (uint64_t) third, key.bits};
+    key.hash = 1469598103934665603ULL;
+    for (int i = 0; i < 5; i++)
+    {
+        key.hash ^= fields[i];
+        key.hash *= 1099511628211ULL;
+    }
+    return key;
+}
+
+// ----------------------------------------------------//
+
+// Applies an opcode to its operands (unused ones are ignored). Shared by
+// constant folding and evaluation, so folded results are bit for bit what
+// evaluation would give.
+
+inline double applyOpcode(int opcode, double a, double b, double c)
+{
+    switch (opcode)
+    {
+        case OP_ADD:            return a + b;
+        case OP_SUBTRACT:       return a - b;
+        case OP_MULTIPLY:       return a * b;
+        case OP_DIVIDE:         return a / b;
+        case OP_MIN:            return selectMinimum(a, b);
+        case OP_MAX:            return selectMaximum(a, b);
+        case OP_SIN:            return sin(a);
+        case OP_COS:            return cos(a);
+        case OP_TAN:            return tan(a);
+        case OP_SELECT:         return (a != 0) ? b : c;
+        default:                return applyComparison(opcode, a, b);
+    }
+}
+
+// Returns the register for a node, adding the node if it does not exist
+// yet. 'isConstant' tells for every register whether it holds a constant.
+
+inline int addMultiNode(MultiProgram& multi, Map<MultiNodeKey, int>& nodes,
+    Vector<bool>& isConstant, int opcode, int left, int right, int third,
+    double value)
+{
+    // A conditional on a constant is just the side it picks
+    if (opcode == OP_SELECT && isConstant[left])
+        return (multi.registers[left] != 0) ? right : third;
+
+    // Fold operations on constants
+    if (opcode != OP_CONSTANT && opcode != OP_VARIABLE && isConstant[left] &&
+        (right < 0 || isConstant[right]) && (third < 0 || isConstant[third]))
+    {
+        double b = (right >= 0) ? multi.registers[right] : 0;
+        double c = (third >= 0) ? multi.registers[third] : 0;
+        value  = applyOpcode(opcode, multi.registers[left], b, c);
+        opcode = OP_CONSTANT;
+        left   = 0;
+        right  = -1;
+        third  = -1;
+    }
+
+    MultiNodeKey key = makeMultiNodeKey(opcode, left, right, third,
+        (opcode == OP_CONSTANT) ? value : 0.0);
+
+    int reg = 0;
+    if (nodes.search(key, reg))
+        return reg;
+
+    reg = multi.registers.getSize();
+    multi.registers.pushBack((opcode == OP_CONSTANT) ? value : 0.0);
+    isConstant.pushBack(opcode == OP_CONSTANT);
+    nodes.insert(key, reg);
+
+    if (opcode != OP_CONSTANT)
+    {
+        MultiNode node;
+        node.opcode = opcode;
+        node.left   = left;
+        node.right  = right;
+        node.third  = third;
+        multi.schedule.pushBack(node);
+        multi.targets.pushBack(reg);
+    }
+    return reg;
+}
+
+// Fuses 'programs' into 'multi'. Afterwards multi.results[i] is the register
+// that holds the result of programs[i].
+
+inline void buildMultiProgram(const Vector<Program>& programs,
+    MultiProgram& multi)
+{
+    multi.variables.clear();
+    multi.schedule.clear();
+    multi.targets.clear();
+    multi.results.clear();
+    multi.registers.clear();
+
+    Map<MultiNodeKey, int> nodes;
+    PersistentMap<string, int> slots; // balanced, for names in sorted order
+    Vector<bool> isConstant;
+    Vector<int> stack;
+
+    for (int p = 0; p < programs.getSize(); p++)
+    {
+        const Program& program = programs[p];
+        stack.clear();
+
+        // Replay the stack machine, but with registers instead of values
+        for (int i = 0; i < program.code.getSize(); i++)
+        {
+            const Instruction& instruction = program.code[i];
+            int opcode = instruction.opcode;
+
+            // Both sides of every conditional are part of the DAG
+            if (isSkip(instruction))
+                continue;
+
+            int top    = stack.getSize() - 1;
+            int reg    = 0;
+
+            if (opcode == OP_CONSTANT)
+            {
+                reg = addMultiNode(multi, nodes, isConstant, OP_CONSTANT, 0, -1, -1,
+                    program.constants[instruction.operand]);
+            }
+            else if (opcode == OP_VARIABLE)
+            {
+                // Variables are matched by name across programs
+                const string& name = program.variables[instruction.operand];
+                int slot = 0;
+                if (!slots.search(name, slot))
+                {
+                    slot = multi.variables.getSize();
+                    multi.variables.pushBack(name);
+                    slots.insert(name, slot);
+                }
+                reg = addMultiNode(multi, nodes, isConstant, OP_VARIABLE, slot, -1, -1, 0);
+            }
+            else if (opcode == OP_ARGUMENT)
+            {
+                // A parameter is simply the node its argument was
+                reg = stack[instruction.operand];
+            }
+            else if (opcode == OP_RETURN)
+            {
+                reg = stack[top];
+                for (int k = 0; k <= instruction.operand; k++)
+                    stack.popBack();
+            }
+            else if (operandCount(instruction) == 1)
+            {
+                reg = addMultiNode(multi, nodes, isConstant, opcode, stack[top], -1, -1, 0);
+                stack.popBack();
+            }
+            else if (operandCount(instruction) == 3)
+            {
+                reg = addMultiNode(multi, nodes, isConstant, opcode,
+                    stack[top - 2], stack[top - 1], stack[top], 0);
+                stack.popBack();
+                stack.popBack();
+                stack.popBack();
+            }
+            else
+            {
+                reg = addMultiNode(multi, nodes, isConstant, opcode,
+                    stack[top - 1], stack[top], -1, 0);
+                stack.popBack();
+                stack.popBack();
+            }
+
+            stack.pushBack(reg);
+        }
+
+        multi.results.pushBack(stack[0]);
+    }
+
+    multi.variables.shrinkToFit();
+    multi.schedule.shrinkToFit();
+    multi.targets.shrinkToFit();
+    multi.registers.shrinkToFit();
+}
+
+// Looks up every variable the fused programs use and stores its value in
+// 'inputs', indexed by slot. Returns false if a variable is not in the map.
+
+template <template <class, class> class M, class V>
+bool bindVariables(const MultiProgram& multi, const M<string, V>& variables,
+    Vector<double>& inputs)
+{
+    inputs.resize(multi.variables.getSize());
+
+    for (int i = 0; i < multi.variables.getSize(); i++)
+    {
+        V stored = V();
+        if (!variables.search(multi.variables[i], stored))
+            return false;
+
+        loadVariable(stored, inputs[i]);
+    }
+    return true;
+}
+
+// Evaluates every fused program for one row of inputs (one value per
+// variable slot) and writes program i's result to results[i].
+
+inline void evaluateMultiProgram(MultiProgram& multi, const double* inputs,
+    double* results)
+{
+    double* registers = (multi.registers.getSize() > 0) ? &multi.registers[0] : NULL;
+
+    for (int i = 0; i < multi.schedule.getSize(); i++)
+    {
+        const MultiNode& node = multi.schedule[i];
+        double& target = registers[multi.targets[i]];
+
+        if (node.opcode == OP_VARIABLE)
+            target = inputs[node.left];
+        else
+            target = applyOpcode(node.opcode, registers[node.left],
+                (node.right >= 0) ? registers[node.right] : 0.0,
+                (node.third >= 0) ? registers[node.third] : 0.0);
+    }
+
+    for (int p = 0; p < multi.results.getSize(); p++)
+        results[p] = registers[multi.results[p]];
+}
+
+inline size_t heapBytesOf(const MultiProgram& multi)
+{
+    return multi.variables.heapBytes() + multi.schedule.heapBytes()
+         + multi.targets.heapBytes() + multi.results.heapBytes()
+         + multi.registers.heapBytes();
+}
+
+#endif
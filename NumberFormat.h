@@ -0,0 +1,81 @@
+#ifndef NUMBER_FORMAT_H
+#define NUMBER_FORMAT_H
+
+// Necessary for from_chars() and to_chars()
+#include <charconv>
+#include <string>
+#include <system_error>
+using namespace std;
+
+// Controls how numbers are written out. In round-trip mode the shortest
+// string that reads back as exactly the same double is produced. Otherwise
+// 'precision' significant digits are used, the same as printf's "%g".
+struct NumberFormat
+{
+    bool roundTrip;
+    int precision;
+};
+
+// Large enough for any double in either mode ("-1.2345678901234567e-308"
+// needs 24 characters; a fixed precision is capped at 17 significant digits).
+const int NUMBER_BUFFER_SIZE = 64;
+
+// Converts 'token' to a double by variable reference. Unlike atof(), this does
+// not depend on the current locale and does not silently turn garbage into 0.
+// The whole token has to be a number, otherwise false is returned.
+
+inline bool parseNumber(const char* first, const char* last, double& value)
+{
+    // from_chars() does not accept a leading '+', but atof() did
+    if (first != last && *first == '+')
+        first++;
+
+    if (first == last)
+        return false;
+
+    from_chars_result parsed = from_chars(first, last, value);
+
+    // Trailing characters mean the token was not a number (e.g. "3x")
+    return (parsed.ec == errc() && parsed.ptr == last);
+}
+
+inline bool parseNumber(const string& token, double& value)
+{
+    return parseNumber(token.data(), token.data() + token.size(), value);
+}
+
+// Writes 'value' into 'buffer' and returns the number of characters written.
+// No terminating '\0' is added, and nothing is allocated, so this is cheap to
+// call once per row when writing out large batches.
+
+inline int formatNumber(double value, const NumberFormat& format, char* buffer,
+    int size)
+{
+    to_chars_result written;
+
+    if (format.roundTrip)
+        written = to_chars(buffer, buffer + size, value);
+    else
+    {
+        int precision = format.precision;
+        if (precision < 1)  precision = 1;
+        if (precision > 17) precision = 17;
+
+        written = to_chars(buffer, buffer + size, value, chars_format::general,
+            precision);
+    }
+
+    if (written.ec != errc())
+        return 0;
+
+    return (int) (written.ptr - buffer);
+}
+
+inline string formatNumber(double value, const NumberFormat& format)
+{
+    char buffer[NUMBER_BUFFER_SIZE];
+    int length = formatNumber(value, format, buffer, NUMBER_BUFFER_SIZE);
+    return string(buffer, length);
+}
+
+#endif
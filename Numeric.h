@@ -0,0 +1,659 @@
+#ifndef NUMERIC_H
+#define NUMERIC_H
+
+// Necessary for the math functions and for parsing literals
+#include <cmath>
+#include <charconv>
+#include <string>
+#include <system_error>
+#include "NumberFormat.h"
+using namespace std;
+
+// The evaluator is written once and instantiated for every numeric type
+// below. NumericTraits<T> describes how to turn literals and variables into
+// a T and how to do arithmetic on it. Each specialization provides:
+//
+//   name()              - printable name of the type
+//   fromDouble(value)   - convert a variable's value
+//   parse(token, value) - convert a literal, false if it is not a number
+//   toDouble(value)     - convert the result back for printing/storing
+//   add(), subtract(), multiply(), divide(), minimum(), maximum(),
+//   sine(), cosine(), tangent()
+//   less(), lessEqual(), greater(), greaterEqual(), equal(), notEqual(),
+//   logicalAnd(), logicalOr()
+//                       - 1 for true and 0 for false, as a T
+//   truth(value)        - 1 if 'value' counts as true (non-zero), 0 if not,
+//                         -1 if that is not known (see Interval.h)
+//   select(c, a, b)     - 'a' if 'c' is true, 'b' otherwise
+//   overflowed(value)   - true if 'value' is the result of an overflow, for
+//                         types that have no infinity to overflow to
+//
+// Comparisons follow IEEE rules for NaN: every comparison with NaN is false
+// except !=. NaN itself counts as true, since it is not zero.
+template <class T>
+struct NumericTraits;
+
+// ----------------------------------------------------//
+
+// min and max for the floating point types. These behave like fmin() and
+// fmax() (a NaN operand is ignored), but also pin down which operand wins a
+// tie between -0 and +0: always the first. fmin() leaves that unspecified,
+// and in practice an inlined fmin() and the libm one disagree, which made
+// otherwise identical evaluation paths return different signed zeros.
+
+template <class T>
+inline T selectMinimum(T a, T b)
+{
+    return (b < a || a != a) ? b : a;
+}
+
+template <class T>
+inline T selectMaximum(T a, T b)
+{
+    return (b > a || a != a) ? b : a;
+}
+
+// ----------------------------------------------------//
+
+// float, double and long double only differ in their types, so they share
+// one implementation.
+template <class T>
+struct FloatingTraits
+{
+    static T fromDouble(double value) { return (T) value; }
+    static double toDouble(T value)   { return (double) value; }
+
+    static bool parse(const string& token, T& value)
+    {
+        const char* first = token.data();
+        const char* last  = token.data() + token.size();
+
+        // from_chars() does not accept a leading '+'
+        if (first != last && *first == '+')
+            first++;
+
+        if (first == last)
+            return false;
+
+        from_chars_result parsed = from_chars(first, last, value);
+        return (parsed.ec == errc() && parsed.ptr == last);
+    }
+
+    static T add(T a, T b)      { return a + b; }
+    static T subtract(T a, T b) { return a - b; }
+    static T multiply(T a, T b) { return a * b; }
+    static T divide(T a, T b)   { return a / b; }
+    static T minimum(T a, T b)  { return selectMinimum(a, b); }
+    static T maximum(T a, T b)  { return selectMaximum(a, b); }
+    static T sine(T a)          { return sin(a); }
+    static T cosine(T a)        { return cos(a); }
+    static T tangent(T a)       { return tan(a); }
+
+    static T less(T a, T b)         { return (a <  b) ? 1 : 0; }
+    static T lessEqual(T a, T b)    { return (a <= b) ? 1 : 0; }
+    static T greater(T a, T b)      { return (a >  b) ? 1 : 0; }
+    static T greaterEqual(T a, T b) { return (a >= b) ? 1 : 0; }
+    static T equal(T a, T b)        { return (a == b) ? 1 : 0; }
+    static T notEqual(T a, T b)     { return (a != b) ? 1 : 0; }
+    static T logicalAnd(T a, T b)   { return (a != 0 && b != 0) ? 1 : 0; }
+    static T logicalOr(T a, T b)    { return (a != 0 || b != 0) ? 1 : 0; }
+    static int truth(T a)           { return (a != 0) ? 1 : 0; }
+    static T select(T c, T a, T b)  { return (c != 0) ? a : b; }
+    static bool overflowed(T)       { return false; }
+};
+
+template <>
+struct NumericTraits<float> : public FloatingTraits<float>
+{
+    static const char* name() { return "float"; }
+};
+
+template <>
+struct NumericTraits<double> : public FloatingTraits<double>
+{
+    static const char* name() { return "double"; }
+
+    // Reuse the shared literal parser so both paths agree exactly
+    static bool parse(const string& token, double& value)
+    {
+        return parseNumber(token, value);
+    }
+};
+
+template <>
+struct NumericTraits<long double> : public FloatingTraits<long double>
+{
+    static const char* name() { return "long double"; }
+};
+
+// ----------------------------------------------------//
+
+// A 128-bit decimal fixed-point number with 18 digits after the decimal
+// point. Literals such as "0.1" are stored exactly, so sums of money do not
+// pick up binary rounding errors. The range is about +/-1.7e20. Division by
+// zero saturates to the largest representable magnitude since there is no
+// infinity.
+//
+// Any result outside of the range, including a literal that is too large,
+// becomes DECIMAL_OVERFLOW. Like a NaN, it is passed on by every operation,
+// and the evaluators report it as ERROR_OUT_OF_RANGE; toDouble() turns it
+// into a NaN.
+struct Decimal
+{
+    __int128 units; // value * 10^18
+};
+
+const __int128 DECIMAL_SCALE    = (__int128) 1000000000000000000LL;
+const __int128 DECIMAL_MAX      = (__int128) (~(unsigned __int128) 0 >> 1);
+// The one value whose negation does not fit, so no arithmetic makes it
+const __int128 DECIMAL_OVERFLOW = -DECIMAL_MAX - 1;
+// Largest whole part, and a bound on it that fromLong() checks first
+const __int128 DECIMAL_MAX_WHOLE = DECIMAL_MAX / DECIMAL_SCALE;
+const long double DECIMAL_LIMIT  = 1.8e20L;
+
+template <>
+struct NumericTraits<Decimal>
+{
+    static const char* name() { return "decimal"; }
+
+    static Decimal fromDouble(double value)
+    {
+        return fromLong((long double) value);
+    }
+
+    static double toDouble(Decimal value)
+    {
+        if (value.units == DECIMAL_OVERFLOW)
+            return NAN;
+
+        // Split first so the whole part keeps all of its bits
+        __int128 whole = value.units / DECIMAL_SCALE;
+        __int128 frac  = value.units % DECIMAL_SCALE;
+        return (double) ((long double) whole + (long double) frac / 1e18L);
+    }
+
+    // Reads the digits directly, so "0.1" becomes exactly 10^17 units.
+    // Exponents fall back to going through a double. A number outside of
+    // the range is not accepted.
+    static bool parse(const string& token, Decimal& value)
+    {
+        int i = 0;
+        int n = (int) token.size();
+        bool negative = false;
+
+        if (i < n && (token[i] == '+' || token[i] == '-'))
+        {
+            negative = (token[i] == '-');
+            i++;
+        }
+
+        __int128 whole = 0;
+        __int128 frac  = 0;
+        int digits     = 0;
+        int fracDigits = 0;
+        bool tooLarge  = false;
+
+        // Once too large, the whole part stops growing so that it cannot
+        // overflow
+        for (; i < n && token[i] >= '0' && token[i] <= '9'; i++, digits++)
+        {
+            if (!tooLarge)
+                whole = whole * 10 + (token[i] - '0');
+            if (whole > DECIMAL_MAX_WHOLE)
+                tooLarge = true;
+        }
+
+        if (i < n && token[i] == '.')
+        {
+            for (i++; i < n && token[i] >= '0' && token[i] <= '9'; i++, digits++)
+            {
+                // Digits past the 18th are dropped
+                if (fracDigits < 18)
+                {
+                    frac = frac * 10 + (token[i] - '0');
+                    fracDigits++;
+                }
+            }
+        }
+
+        if (digits == 0)
+            return false;
+
+        if (i < n)
+        {
+            // Something like "1e5": let the double parser handle it
+            double approximate = 0;
+            if (!parseNumber(token, approximate))
+                return false;
+            value = fromDouble(approximate);
+            return !overflowed(value);
+        }
+
+        for (; fracDigits < 18; fracDigits++)
+            frac *= 10;
+
+        if (tooLarge || frac > DECIMAL_MAX - whole * DECIMAL_SCALE)
+            return false;
+
+        value.units = whole * DECIMAL_SCALE + frac;
+        if (negative)
+            value.units = -value.units;
+        return true;
+    }
+
+    static bool overflowed(Decimal value) { return value.units == DECIMAL_OVERFLOW; }
+
+    static Decimal add(Decimal a, Decimal b)
+    {
+        Decimal result;
+        if (overflowed(a) || overflowed(b) ||
+            __builtin_add_overflow(a.units, b.units, &result.units))
+            return overflow();
+        return result;
+    }
+
+    static Decimal subtract(Decimal a, Decimal b)
+    {
+        Decimal result;
+        if (overflowed(a) || overflowed(b) ||
+            __builtin_sub_overflow(a.units, b.units, &result.units))
+            return overflow();
+        return result;
+    }
+
+    // (ah*S + al) * (bh*S + bl) / S, split up so that no partial product
+    // overflows unless the result itself does, which is then checked for.
+    static Decimal multiply(Decimal a, Decimal b)
+    {
+        if (overflowed(a) || overflowed(b))
+            return overflow();
+
+        bool negative = ((a.units < 0) != (b.units < 0));
+        unsigned __int128 x = (a.units < 0) ? -a.units : a.units;
+        unsigned __int128 y = (b.units < 0) ? -b.units : b.units;
+        unsigned __int128 scale = DECIMAL_SCALE;
+
+        unsigned __int128 xh = x / scale, xl = x % scale;
+        unsigned __int128 yh = y / scale, yl = y % scale;
+
+        // Round the lowest partial product to nearest
+        unsigned __int128 low = (xl * yl + scale / 2) / scale;
+        unsigned __int128 product = 0;
+        if (__builtin_mul_overflow(xh, yh, &product) ||
+            __builtin_mul_overflow(product, scale, &product) ||
+            __builtin_add_overflow(product, xh * yl, &product) ||
+            __builtin_add_overflow(product, xl * yh + low, &product) ||
+            product > (unsigned __int128) DECIMAL_MAX)
+            return overflow();
+
+        Decimal result;
+        result.units = negative ? -(__int128) product : (__int128) product;
+        return result;
+    }
+
+    // Long division, one decimal digit at a time, so the remainder never
+    // has to be multiplied by the full scale.
+    static Decimal divide(Decimal a, Decimal b)
+    {
+        if (overflowed(a) || overflowed(b))
+            return overflow();
+
+        Decimal result;
+        bool negative = ((a.units < 0) != (b.units < 0));
+
+        if (b.units == 0)
+        {
+            result.units = negative ? -DECIMAL_MAX : DECIMAL_MAX;
+            return result;
+        }
+
+        unsigned __int128 x = (a.units < 0) ? -a.units : a.units;
+        unsigned __int128 y = (b.units < 0) ? -b.units : b.units;
+
+        unsigned __int128 quotient  = x / y;
+        unsigned __int128 remainder = x % y;
+        if (quotient > (unsigned __int128) DECIMAL_MAX_WHOLE)
+            return overflow();
+
+        for (int digit = 0; digit < 18; digit++)
+            quotient = quotient * 10 + nextDigit(remainder, y);
+
+        // Round to nearest; 'remainder' is below y, so 2 * remainder fits
+        if (remainder >= y - remainder)
+            quotient++;
+        if (quotient > (unsigned __int128) DECIMAL_MAX)
+            return overflow();
+
+        result.units = negative ? -(__int128) quotient : (__int128) quotient;
+        return result;
+    }
+
+    // An overflow is passed on by every operation below, as a NaN would be
+    static Decimal minimum(Decimal a, Decimal b)
+    {
+        return passed(a, b) ? overflow() : (b.units < a.units) ? b : a;
+    }
+
+    static Decimal maximum(Decimal a, Decimal b)
+    {
+        return passed(a, b) ? overflow() : (b.units > a.units) ? b : a;
+    }
+
+    // There is no exact decimal trigonometry, so go through long double
+    static Decimal sine(Decimal a)    { return fromLong(sinl(toLong(a))); }
+    static Decimal cosine(Decimal a)  { return fromLong(cosl(toLong(a))); }
+    static Decimal tangent(Decimal a) { return fromLong(tanl(toLong(a))); }
+
+    static Decimal less(Decimal a, Decimal b)         { return compared(a, b, a.units <  b.units); }
+    static Decimal lessEqual(Decimal a, Decimal b)    { return compared(a, b, a.units <= b.units); }
+    static Decimal greater(Decimal a, Decimal b)      { return compared(a, b, a.units >  b.units); }
+    static Decimal greaterEqual(Decimal a, Decimal b) { return compared(a, b, a.units >= b.units); }
+    static Decimal equal(Decimal a, Decimal b)        { return compared(a, b, a.units == b.units); }
+    static Decimal notEqual(Decimal a, Decimal b)     { return compared(a, b, a.units != b.units); }
+    static int truth(Decimal a)                       { return (a.units != 0) ? 1 : 0; }
+
+    // Only an overflow in an operand that decides the result is passed on,
+    // since compiled programs skip the other one (see Program.h)
+    static Decimal logicalAnd(Decimal a, Decimal b)
+    {
+        if (overflowed(a) || (a.units != 0 && overflowed(b)))
+            return overflow();
+        return fromBool(a.units != 0 && b.units != 0);
+    }
+
+    static Decimal logicalOr(Decimal a, Decimal b)
+    {
+        if (overflowed(a) || (a.units == 0 && overflowed(b)))
+            return overflow();
+        return fromBool(a.units != 0 || b.units != 0);
+    }
+
+    static Decimal select(Decimal c, Decimal a, Decimal b)
+    {
+        return overflowed(c) ? overflow() : (c.units != 0) ? a : b;
+    }
+
+private:
+    static Decimal overflow()
+    {
+        Decimal result;
+        result.units = DECIMAL_OVERFLOW;
+        return result;
+    }
+
+    static bool passed(Decimal a, Decimal b) { return overflowed(a) || overflowed(b); }
+
+    static Decimal compared(Decimal a, Decimal b, bool value)
+    {
+        return passed(a, b) ? overflow() : fromBool(value);
+    }
+
+    // The next digit of remainder / y, leaving the rest in 'remainder'.
+    // 10 * remainder can be too large for 128 bits when y is, so the
+    // remainder is added up ten times instead, which stays below 2 * y.
+    static int nextDigit(unsigned __int128& remainder, unsigned __int128 y)
+    {
+        if (remainder <= (~(unsigned __int128) 0) / 10)
+        {
+            remainder *= 10;
+            int digit = (int) (remainder / y);
+            remainder %= y;
+            return digit;
+        }
+
+        unsigned __int128 sum = 0;
+        int digit = 0;
+        for (int k = 0; k < 10; k++)
+        {
+            sum += remainder;
+            if (sum >= y)
+            {
+                sum -= y;
+                digit++;
+            }
+        }
+        remainder = sum;
+        return digit;
+    }
+
+    static Decimal fromBool(bool value)
+    {
+        Decimal result;
+        result.units = value ? DECIMAL_SCALE : 0;
+        return result;
+    }
+
+    // NaN for an overflow, which fromLong() turns back into one
+    static long double toLong(Decimal value)
+    {
+        if (overflowed(value))
+            return NAN;
+        return (long double) value.units / 1e18L;
+    }
+
+    // Anything outside of the range, infinity and NaN overflow
+    static Decimal fromLong(long double value)
+    {
+        // Roughly first, so that the whole part surely fits in 128 bits
+        if (!(fabsl(value) < DECIMAL_LIMIT))
+            return overflow();
+
+        // llroundl() only covers 64 bits, so convert the whole part
+        // separately from the fraction.
+        long double whole = truncl(value);
+        __int128 units = (__int128) whole;
+        if (units > DECIMAL_MAX_WHOLE || units < -DECIMAL_MAX_WHOLE)
+            return overflow();
+
+        Decimal result;
+        if (__builtin_add_overflow(units * DECIMAL_SCALE,
+                (__int128) llroundl((value - whole) * 1e18L), &result.units))
+            return overflow();
+        return result;
+    }
+};
+
+// ----------------------------------------------------//
+
+// A double with a running compensation term (Kahan/Neumaier summation,
+// extended to * and / with fma). The rounding error of every operation is
+// carried along instead of being thrown away, so long sums stay accurate to
+// roughly twice the precision of a double.
+struct Compensated
+{
+    double sum;
+    double error;
+};
+
+template <>
+struct NumericTraits<Compensated>
+{
+    static const char* name() { return "compensated"; }
+
+    static Compensated fromDouble(double value)
+    {
+        Compensated result = {value, 0.0};
+        return result;
+    }
+
+    static double toDouble(Compensated value)
+    {
+        return value.sum + value.error;
+    }
+
+    static bool parse(const string& token, Compensated& value)
+    {
+        double parsed = 0;
+        if (!parseNumber(token, parsed))
+            return false;
+        value = fromDouble(parsed);
+        return true;
+    }
+
+    static Compensated add(Compensated a, Compensated b)
+    {
+        // Neumaier's variant of TwoSum: the error is exact whichever
+        // operand is larger.
+        double sum = a.sum + b.sum;
+        double err;
+        if (fabs(a.sum) >= fabs(b.sum))
+            err = (a.sum - sum) + b.sum;
+        else
+            err = (b.sum - sum) + a.sum;
+
+        // Past the range of a double the error is inf - inf, a NaN that
+        // would turn the infinite sum into a NaN as well
+        Compensated result = {sum, a.error + b.error + err};
+        if (!isfinite(sum))
+            result.error = 0.0;
+        return result;
+    }
+
+    static Compensated subtract(Compensated a, Compensated b)
+    {
+        Compensated negated = {-b.sum, -b.error};
+        return add(a, negated);
+    }
+
+    static Compensated multiply(Compensated a, Compensated b)
+    {
+        double product = a.sum * b.sum;
+        double err     = fma(a.sum, b.sum, -product);
+
+        Compensated result = {product, err + a.sum * b.error + a.error * b.sum};
+        if (!isfinite(product))
+            result.error = 0.0;
+        return result;
+    }
+
+    static Compensated divide(Compensated a, Compensated b)
+    {
+        double quotient  = a.sum / b.sum;
+        double remainder = fma(-quotient, b.sum, a.sum) + a.error
+                         - quotient * b.error;
+
+        Compensated result = {quotient, remainder / b.sum};
+        if (!isfinite(quotient))
+            result.error = 0.0;
+        return result;
+    }
+
+    static Compensated minimum(Compensated a, Compensated b)
+    {
+        return (toDouble(b) < toDouble(a)) ? b : a;
+    }
+
+    static Compensated maximum(Compensated a, Compensated b)
+    {
+        return (toDouble(b) > toDouble(a)) ? b : a;
+    }
+
+    static Compensated sine(Compensated a)    { return fromDouble(sin(toDouble(a))); }
+    static Compensated cosine(Compensated a)  { return fromDouble(cos(toDouble(a))); }
+    static Compensated tangent(Compensated a) { return fromDouble(tan(toDouble(a))); }
+
+    // Compared by their full value, like minimum() and maximum()
+    static Compensated less(Compensated a, Compensated b)
+    {
+        return fromBool(toDouble(a) < toDouble(b));
+    }
+
+    static Compensated lessEqual(Compensated a, Compensated b)
+    {
+        return fromBool(toDouble(a) <= toDouble(b));
+    }
+
+    static Compensated greater(Compensated a, Compensated b)
+    {
+        return fromBool(toDouble(a) > toDouble(b));
+    }
+
+    static Compensated greaterEqual(Compensated a, Compensated b)
+    {
+        return fromBool(toDouble(a) >= toDouble(b));
+    }
+
+    static Compensated equal(Compensated a, Compensated b)
+    {
+        return fromBool(toDouble(a) == toDouble(b));
+    }
+
+    static Compensated notEqual(Compensated a, Compensated b)
+    {
+        return fromBool(toDouble(a) != toDouble(b));
+    }
+
+    static Compensated logicalAnd(Compensated a, Compensated b)
+    {
+        return fromBool(truth(a) && truth(b));
+    }
+
+    static Compensated logicalOr(Compensated a, Compensated b)
+    {
+        return fromBool(truth(a) || truth(b));
+    }
+
+    static int truth(Compensated a) { return (toDouble(a) != 0) ? 1 : 0; }
+    static bool overflowed(Compensated) { return false; }
+
+    static Compensated select(Compensated c, Compensated a, Compensated b)
+    {
+        return truth(c) ? a : b;
+    }
+
+private:
+    static Compensated fromBool(bool value) { return fromDouble(value ? 1.0 : 0.0); }
+};
+
+// ----------------------------------------------------//
+
+// Returns true if 'token' is written as a number but T cannot hold it, such
+// as "1e400" for a double or "1e30" for a Decimal, rather than not being a
+// number at all. For reporting a literal that NumericTraits<T>::parse()
+// rejected.
+
+template <class T>
+inline bool outOfRange(const string& token)
+{
+    const char* first = token.data();
+    const char* last  = token.data() + token.size();
+    if (first != last && *first == '+')
+        first++;
+    if (first == last)
+        return false;
+
+    double value = 0;
+    from_chars_result parsed = from_chars(first, last, value);
+    if (parsed.ptr != last)
+        return false;
+    if (parsed.ec == errc::result_out_of_range)
+        return true;
+
+    T converted;
+    return parsed.ec == errc() && !NumericTraits<T>::parse(token, converted);
+}
+
+// ----------------------------------------------------//
+
+// Converts a variable's stored value into the type the arithmetic is done in.
+// Variables are normally stored as doubles, but a map can also hold values
+// that are already of type T (e.g. Interval ranges).
+
+template <class T>
+inline void loadVariable(const double& stored, T& value)
+{
+    value = NumericTraits<T>::fromDouble(stored);
+}
+
+template <class T>
+inline void loadVariable(const T& stored, T& value)
+{
+    value = stored;
+}
+
+inline void loadVariable(const double& stored, double& value)
+{
+    value = stored;
+}
+
+#endif
@@ -0,0 +1,323 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+// Necessary for the worker threads, pinning and reading the NUMA layout
+#include <condition_variable>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include "Vector.h"
+#include "Program.h"
+using namespace std;
+
+// Parallel columnar evaluation. One formula over many rows is memory
+// bandwidth bound, so more cores only help if each core reads memory
+// attached to its own socket. A ParallelPool keeps one thread per worker,
+// pinned to a CPU, with workers spread over the NUMA nodes. Rows are split
+// into one contiguous range per worker, and the same split is used to
+// allocate columns (allocateColumn() has each worker touch its own range
+// first, so Linux places those pages on the worker's node) and to evaluate
+// them. Every range starts at a multiple of BATCH_SIZE rows, so no two
+// workers ever write to the same cache line of the output and no locking
+// is needed.
+
+// ----------------------------------------------------//
+
+// Parses a cpulist such as "0-3,8,10-11" into 'cpus'.
+
+inline void parseCpuList(const string& text, Vector<int>& cpus)
+{
+    stringstream ss(text);
+    string range;
+    while (getline(ss, range, ','))
+    {
+        if (range.empty() || range[0] < '0' || range[0] > '9')
+            continue;
+
+        int first = atoi(range.c_str());
+        int last  = first;
+        size_t dash = range.find('-');
+        if (dash != string::npos)
+            last = atoi(range.c_str() + dash + 1);
+
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.pushBack(cpu);
+    }
+}
+
+// Returns the CPUs in worker order: the first CPU of every NUMA node, then
+// the second of every node, and so on, so any number of workers is spread
+// evenly over the nodes. Without NUMA information (or off Linux) this is
+// just 0, 1, 2, ...
+
+inline void numaCpuOrder(Vector<int>& order)
+{
+    order.clear();
+
+    Vector< Vector<int> > nodes;
+    for (int node = 0; ; node++)
+    {
+        stringstream path;
+        path << "/sys/devices/system/node/node" << node << "/cpulist";
+        ifstream file(path.str().c_str());
+        if (!file)
+            break;
+
+        string text;
+        getline(file, text);
+        Vector<int> cpus;
+        parseCpuList(text, cpus);
+        if (cpus.getSize() > 0)
+            nodes.pushBack(cpus);
+    }
+
+    for (int index = 0; ; index++)
+    {
+        bool any = false;
+        for (int node = 0; node < nodes.getSize(); node++)
+        {
+            if (index < nodes[node].getSize())
+            {
+                order.pushBack(nodes[node][index]);
+                any = true;
+            }
+        }
+        if (!any)
+            break;
+    }
+
+    if (order.getSize() == 0)
+    {
+        int count = (int) thread::hardware_concurrency();
+        for (int cpu = 0; cpu < (count > 0 ? count : 1); cpu++)
+            order.pushBack(cpu);
+    }
+}
+
+// Restricts the calling thread to one CPU. Returns false if that is not
+// possible, in which case the thread simply stays unpinned.
+
+inline bool pinThread(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void) cpu;
+    return false;
+#endif
+}
+
+// Splits 'rows' into 'workers' contiguous ranges whose starts are multiples
+// of BATCH_SIZE, and returns range 'worker' as [begin, end).
+
+inline void partitionRows(size_t rows, int workers, int worker, size_t& begin,
+    size_t& end)
+{
+    size_t batches = (rows + BATCH_SIZE - 1) / BATCH_SIZE;
+    size_t first   = batches * worker / workers;
+    size_t last    = batches * (worker + 1) / workers;
+
+    begin = first * BATCH_SIZE;
+    end   = last  * BATCH_SIZE;
+    if (begin > rows) begin = rows;
+    if (end   > rows) end   = rows;
+}
+
+// ----------------------------------------------------//
+
+// A fixed set of pinned worker threads. run() hands the same task to every
+// worker and returns once all of them are done.
+class ParallelPool
+{
+public:
+    // 'workers' <= 0 uses one worker per CPU
+    ParallelPool(int workers = 0, bool pin = true);
+    ~ParallelPool();
+
+    int getWorkers() const { return mWorkers; }
+
+    // Calls task(worker) on every worker, including the calling thread as
+    // worker 0
+    void run(const function<void(int)>& task);
+
+private:
+    ParallelPool(const ParallelPool&);
+    ParallelPool& operator=(const ParallelPool&);
+
+    void workerLoop(int worker, int cpu);
+
+    int mWorkers;
+    bool mPin;
+    Vector<thread*> mThreads;
+
+    mutex mMutex;
+    condition_variable mStart;
+    condition_variable mDone;
+    const function<void(int)>* mTask;
+    long mGeneration;
+    int mRemaining;
+    bool mStopping;
+};
+
+inline ParallelPool::ParallelPool(int workers, bool pin)
+{
+    Vector<int> cpus;
+    numaCpuOrder(cpus);
+
+    mWorkers    = (workers > 0) ? workers : cpus.getSize();
+    mPin        = pin;
+    mTask       = NULL;
+    mGeneration = 0;
+    mRemaining  = 0;
+    mStopping   = false;
+
+    // The calling thread is worker 0. It belongs to the caller, so it is
+    // left unpinned.
+    for (int worker = 1; worker < mWorkers; worker++)
+    {
+        int cpu = cpus[worker % cpus.getSize()];
+        mThreads.pushBack(new thread(&ParallelPool::workerLoop, this, worker, cpu));
+    }
+}
+
+inline ParallelPool::~ParallelPool()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStopping = true;
+    }
+    mStart.notify_all();
+
+    for (int i = 0; i < mThreads.getSize(); i++)
+    {
+        mThreads[i]->join();
+        delete mThreads[i];
+    }
+}
+
+inline void ParallelPool::run(const function<void(int)>& task)
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mTask      = &task;
+        mRemaining = mWorkers - 1;
+        mGeneration++;
+    }
+    mStart.notify_all();
+
+    task(0);
+
+    unique_lock<mutex> lock(mMutex);
+    mDone.wait(lock, [this] { return mRemaining == 0; });
+    mTask = NULL;
+}
+
+inline void ParallelPool::workerLoop(int worker, int cpu)
+{
+    if (mPin)
+        pinThread(cpu);
+
+    long seen = 0;
+    for (;;)
+    {
+        const function<void(int)>* task = NULL;
+        {
+            unique_lock<mutex> lock(mMutex);
+            mStart.wait(lock, [&] { return mStopping || mGeneration != seen; });
+            if (mStopping)
+                return;
+            seen = mGeneration;
+            task = mTask;
+        }
+
+        (*task)(worker);
+
+        lock_guard<mutex> lock(mMutex);
+        if (--mRemaining == 0)
+            mDone.notify_one();
+    }
+}
+
+// ----------------------------------------------------//
+
+// Allocates a column of 'rows' doubles, aligned to a cache line, and zeroes
+// it from the workers that will later evaluate each range so the pages are
+// placed on their NUMA nodes. Release it with freeColumn().
+
+inline double* allocateColumn(ParallelPool& pool, size_t rows)
+{
+    size_t bytes = (rows * sizeof(double) + 63) / 64 * 64;
+    double* column = (double*) aligned_alloc(64, bytes > 0 ? bytes : 64);
+    if (column == NULL)
+        return NULL;
+
+    int workers = pool.getWorkers();
+    pool.run([&](int worker)
+    {
+        size_t begin, end;
+        partitionRows(rows, workers, worker, begin, end);
+        for (size_t r = begin; r < end; r++)
+            column[r] = 0;
+    });
+    return column;
+}
+
+inline void freeColumn(double* column)
+{
+    free(column);
+}
+
+// Same as evaluateProgramBatch(), with the rows split over the pool's
+// workers. Each worker evaluates its own range of every column into its own
+// range of 'out'. If 'errors' is given, every worker collects the failed
+// rows of its range on its own, and they are added to 'errors' afterwards
+// in row order.
+
+inline void evaluateProgramParallel(const Program& program,
+    const Vector<const double*>& columns, size_t rows, double* out,
+    ParallelPool& pool, BatchErrors* errors = NULL)
+{
+    int workers = pool.getWorkers();
+
+    Vector<BatchErrors> found;
+    if (errors != NULL)
+    {
+        for (int w = 0; w < workers; w++)
+            found.pushBack(makeBatchErrors(errors->strict, errors->limit));
+    }
+
+    pool.run([&](int worker)
+    {
+        size_t begin, end;
+        partitionRows(rows, workers, worker, begin, end);
+        if (begin >= end)
+            return;
+
+        Vector<const double*> range;
+        range.reserve(columns.getSize());
+        for (int i = 0; i < columns.getSize(); i++)
+            range.pushBack(columns[i] + begin);
+
+        evaluateProgramBatch(program, range, end - begin, out + begin,
+            (errors != NULL) ? &found[worker] : NULL, begin);
+    });
+
+    for (int w = 0; w < found.getSize(); w++)
+    {
+        errors->count += found[w].count - found[w].rows.getSize();
+        for (int k = 0; k < found[w].rows.getSize(); k++)
+            addRowError(*errors, found[w].rows[k].row, found[w].rows[k].code);
+    }
+}
+
+#endif
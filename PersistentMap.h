@@ -0,0 +1,485 @@
+#ifndef PERSISTENT_MAP_H
+#define PERSISTENT_MAP_H
+
+// Necessary for print()
+#include <iostream>
+#include "Vector.h"
+#include "MemoryUsage.h"
+using namespace std;
+
+// A node of a PersistentMap. Nodes are never changed once built, so any
+// number of maps can share them; 'refs' counts the maps and parent nodes
+// that point to this one.
+template <class Key, class Value>
+struct PersistentNode
+{
+    Key key;
+    Value value;
+    const PersistentNode<Key, Value>* left;
+    const PersistentNode<Key, Value>* right;
+    int height;
+    mutable int refs;
+};
+
+// A map with the same interface as Map, whose copies share their nodes.
+// It is a balanced (AVL) binary tree, so search(), insert() and remove()
+// are O(lg N) whatever order the keys come in. insert() and remove() never
+// change a node: they build new copies of the nodes on the path from the
+// root to the key (about lg N of them) and share the rest with the old
+// tree. Copying a map, which takes a snapshot of it, is therefore O(1),
+// and a snapshot keeps its values however the map changes afterwards.
+//
+// begin() starts a transaction by remembering the current version.
+// rollback() goes back to it and commit() keeps the changes. Transactions
+// nest, and both are O(1). A copy of a map takes its current contents but
+// none of its open transactions.
+//
+// Reference counts are not atomic: share snapshots between threads only if
+// no thread copies or destroys them while others do.
+template <class Key, class Value>
+class PersistentMap
+{
+public:
+    // Constructors / Destructors
+    PersistentMap();
+    PersistentMap(const PersistentMap<Key, Value>& orig);
+    ~PersistentMap();
+    PersistentMap<Key, Value>& operator=(const PersistentMap<Key, Value>& orig);
+
+    // Tree modification
+    void insert(const Key& key, const Value& value);
+    bool remove(const Key& key, Value& value);
+    void clear();
+
+    // Transactions
+    void begin();
+    bool commit();
+    bool rollback();
+    int transactions() const;
+
+    // Tree statistics
+    bool search(const Key& key, Value& value) const;
+    void print() const;
+    int size() const;
+
+    // Memory accounting (see MemoryUsage.h). Nodes shared with other
+    // versions are counted in full, so the heapBytes() of two snapshots
+    // can add up to more than they really use together.
+    size_t heapBytes() const;
+    size_t memoryUsage() const;
+
+private:
+    typedef PersistentNode<Key, Value> Node;
+
+    const Node* mRoot;
+    int mSize;
+
+    // The root and size at each begin() that is still open
+    Vector<const Node*> mSavedRoots;
+    Vector<int> mSavedSizes;
+
+    // These work on the nodes. Each function that returns a node gives the
+    // caller one reference to it. The helpers recurse, but only as deep as
+    // the tree, which is balanced.
+    static const Node* retain(const Node* node);
+    static void release(const Node* node);
+    static int height(const Node* node);
+    static const Node* makeNode(const Key& key, const Value& value,
+        const Node* left, const Node* right);
+    static const Node* balance(const Key& key, const Value& value,
+        const Node* left, const Node* right);
+
+    static const Node* insertHelper(const Node* root, const Key& key,
+        const Value& value, bool& added);
+    static const Node* removeHelper(const Node* root, const Key& key,
+        Value& value, bool& removed);
+
+    void printHelper(const Node* root) const;
+    size_t heapBytesHelper(const Node* root) const;
+};
+
+// ----------------------------------------------------//
+
+template <class Key, class Value>
+PersistentMap<Key, Value>::PersistentMap()
+{
+    mRoot = NULL;
+    mSize = 0;
+}
+
+template <class Key, class Value>
+PersistentMap<Key, Value>::PersistentMap(const PersistentMap<Key, Value>& orig)
+{
+    // A snapshot: share the whole tree
+    mRoot = retain(orig.mRoot);
+    mSize = orig.mSize;
+}
+
+template <class Key, class Value>
+PersistentMap<Key, Value>::~PersistentMap()
+{
+    clear();
+    mRoot = NULL;
+}
+
+template <class Key, class Value>
+PersistentMap<Key, Value>& PersistentMap<Key, Value>::operator=(
+    const PersistentMap<Key, Value>& orig)
+{
+    // Take the new tree before letting go of ours, in case they are the same
+    const Node* root = retain(orig.mRoot);
+    int size = orig.mSize;
+
+    clear();
+    mRoot = root;
+    mSize = size;
+    return *this;
+}
+
+template <class Key, class Value>
+void PersistentMap<Key, Value>::clear()
+{
+    // Also ends every open transaction
+    for (int i = 0; i < mSavedRoots.getSize(); i++)
+        release(mSavedRoots[i]);
+    mSavedRoots.clear();
+    mSavedSizes.clear();
+
+    release(mRoot);
+    mRoot = NULL;
+    mSize = 0;
+}
+
+// ----------------------------------------------------//
+
+template <class Key, class Value>
+const PersistentNode<Key, Value>* PersistentMap<Key, Value>::retain(const Node* node)
+{
+    if (node != NULL)
+        node->refs++;
+    return node;
+}
+
+template <class Key, class Value>
+void PersistentMap<Key, Value>::release(const Node* node)
+{
+    // The last reference frees the node, and with it the node's own
+    // references to its children
+    if (node != NULL && --node->refs == 0)
+    {
+        release(node->left);
+        release(node->right);
+        delete node;
+    }
+}
+
+template <class Key, class Value>
+int PersistentMap<Key, Value>::height(const Node* node)
+{
+    return (node == NULL) ? 0 : node->height;
+}
+
+template <class Key, class Value>
+const PersistentNode<Key, Value>* PersistentMap<Key, Value>::makeNode(
+    const Key& key, const Value& value, const Node* left, const Node* right)
+{
+    Node* node   = new Node();
+    node->key    = key;
+    node->value  = value;
+    node->left   = retain(left);
+    node->right  = retain(right);
+    node->height = 1 + ((height(left) > height(right)) ? height(left) : height(right));
+    node->refs   = 1;
+    return node;
+}
+
+// Builds a node for 'key' over the two subtrees, rotating if one is more
+// than one level taller than the other. The subtrees are only borrowed.
+
+template <class Key, class Value>
+const PersistentNode<Key, Value>* PersistentMap<Key, Value>::balance(
+    const Key& key, const Value& value, const Node* left, const Node* right)
+{
+    if (height(left) > height(right) + 1)
+    {
+        // Single rotation: 'left' becomes the root
+        if (height(left->left) >= height(left->right))
+        {
+            const Node* lower = makeNode(key, value, left->right, right);
+            const Node* root  = makeNode(left->key, left->value, left->left, lower);
+            release(lower);
+            return root;
+        }
+
+        // Double rotation: the right child of 'left' becomes the root
+        const Node* middle = left->right;
+        const Node* first  = makeNode(left->key, left->value, left->left, middle->left);
+        const Node* second = makeNode(key, value, middle->right, right);
+        const Node* root   = makeNode(middle->key, middle->value, first, second);
+        release(first);
+        release(second);
+        return root;
+    }
+
+    if (height(right) > height(left) + 1)
+    {
+        // The mirror images of the above
+        if (height(right->right) >= height(right->left))
+        {
+            const Node* lower = makeNode(key, value, left, right->left);
+            const Node* root  = makeNode(right->key, right->value, lower, right->right);
+            release(lower);
+            return root;
+        }
+
+        const Node* middle = right->left;
+        const Node* first  = makeNode(key, value, left, middle->left);
+        const Node* second = makeNode(right->key, right->value, middle->right, right->right);
+        const Node* root   = makeNode(middle->key, middle->value, first, second);
+        release(first);
+        release(second);
+        return root;
+    }
+
+    return makeNode(key, value, left, right);
+}
+
+// ----------------------------------------------------//
+
+template <class Key, class Value>
+void PersistentMap<Key, Value>::insert(const Key& key, const Value& value)
+{
+    // insert() does not allow duplicate keys. If the key is already there,
+    // its value is updated instead.
+    bool added = false;
+    const Node* root = insertHelper(mRoot, key, value, added);
+    release(mRoot);
+    mRoot = root;
+    if (added)
+        mSize++;
+}
+
+template <class Key, class Value>
+const PersistentNode<Key, Value>* PersistentMap<Key, Value>::insertHelper(
+    const Node* root, const Key& key, const Value& value, bool& added)
+{
+    // When 'root' is NULL, we've found where to insert the value
+    if (root == NULL)
+    {
+        added = true;
+        return makeNode(key, value, NULL, NULL);
+    }
+
+    // duplicate keys: a copy of the node with the new value
+    if (root->key == key)
+        return makeNode(key, value, root->left, root->right);
+
+    // Copy the path down to where 'value' should be placed
+    const Node* child = NULL;
+    const Node* node  = NULL;
+    if (root->key > key)
+    {
+        child = insertHelper(root->left, key, value, added);
+        node  = balance(root->key, root->value, child, root->right);
+    }
+    else
+    {
+        child = insertHelper(root->right, key, value, added);
+        node  = balance(root->key, root->value, root->left, child);
+    }
+    release(child);
+    return node;
+}
+
+template <class Key, class Value>
+bool PersistentMap<Key, Value>::remove(const Key& key, Value& value)
+{
+    // remove() returns the value of the removed key along with the flag
+    // indicating whether or not the operation was successful.
+    bool removed = false;
+    const Node* root = removeHelper(mRoot, key, value, removed);
+    release(mRoot);
+    mRoot = root;
+    if (removed)
+        mSize--;
+    return removed;
+}
+
+template <class Key, class Value>
+const PersistentNode<Key, Value>* PersistentMap<Key, Value>::removeHelper(
+    const Node* root, const Key& key, Value& value, bool& removed)
+{
+    // If the root is empty, 'key' wasn't in the tree.
+    if (root == NULL)
+        return NULL;
+
+    if (root->key == key)
+    {
+        value   = root->value;
+        removed = true;
+
+        // Zero or one child - the child takes our place
+        if (root->left == NULL)
+            return retain(root->right);
+        if (root->right == NULL)
+            return retain(root->left);
+
+        // Two children - our successor (leftmost node of the right
+        // subtree) takes our place. The old right subtree is still
+        // referenced by 'root', so 'successor' stays valid.
+        const Node* successor = root->right;
+        while (successor->left != NULL)
+            successor = successor->left;
+
+        Value unused = Value();
+        bool found = false;
+        const Node* right = removeHelper(root->right, successor->key, unused, found);
+        const Node* node  = balance(successor->key, successor->value, root->left, right);
+        release(right);
+        return node;
+    }
+
+    // Search the left or the right subtree. Nothing needs copying if the
+    // key is not there.
+    bool left = root->key > key;
+    const Node* child = removeHelper(left ? root->left : root->right, key, value, removed);
+    if (!removed)
+    {
+        release(child);
+        return retain(root);
+    }
+
+    const Node* node = left ? balance(root->key, root->value, child, root->right) :
+                              balance(root->key, root->value, root->left, child);
+    release(child);
+    return node;
+}
+
+template <class Key, class Value>
+bool PersistentMap<Key, Value>::search(const Key& key, Value& value) const
+{
+    // Binary search down the tree, as a loop
+    const Node* node = mRoot;
+    while (node != NULL)
+    {
+        if (node->key == key)
+        {
+            value = node->value;
+            return true;
+        }
+        else if (node->key > key)
+            node = node->left;
+        else
+            node = node->right;
+    }
+    return false;
+}
+
+// ----------------------------------------------------//
+
+template <class Key, class Value>
+void PersistentMap<Key, Value>::begin()
+{
+    mSavedRoots.pushBack(retain(mRoot));
+    mSavedSizes.pushBack(mSize);
+}
+
+// Keeps the changes since the last begin(). Returns false if there is no
+// open transaction.
+
+template <class Key, class Value>
+bool PersistentMap<Key, Value>::commit()
+{
+    int last = mSavedRoots.getSize() - 1;
+    if (last < 0)
+        return false;
+
+    release(mSavedRoots[last]);
+    mSavedRoots.popBack();
+    mSavedSizes.popBack();
+    return true;
+}
+
+// Undoes the changes since the last begin(). Returns false if there is no
+// open transaction.
+
+template <class Key, class Value>
+bool PersistentMap<Key, Value>::rollback()
+{
+    int last = mSavedRoots.getSize() - 1;
+    if (last < 0)
+        return false;
+
+    // The saved reference becomes the map's
+    release(mRoot);
+    mRoot = mSavedRoots[last];
+    mSize = mSavedSizes[last];
+    mSavedRoots.popBack();
+    mSavedSizes.popBack();
+    return true;
+}
+
+// Returns the number of open transactions.
+
+template <class Key, class Value>
+int PersistentMap<Key, Value>::transactions() const
+{
+    return mSavedRoots.getSize();
+}
+
+// ----------------------------------------------------//
+
+template <class Key, class Value>
+void PersistentMap<Key, Value>::print() const
+{
+    printHelper(mRoot);
+    cout << endl;
+}
+
+template <class Key, class Value>
+void PersistentMap<Key, Value>::printHelper(const Node* root) const
+{
+    // An in-order traversal prints the data in sorted order.
+    if (root == NULL)
+        return;
+
+    printHelper(root->left);
+    cout << "(" << root->key << ", " << root->value << ") ";
+    printHelper(root->right);
+}
+
+template <class Key, class Value>
+int PersistentMap<Key, Value>::size() const
+{
+    return mSize;
+}
+
+template <class Key, class Value>
+size_t PersistentMap<Key, Value>::heapBytes() const
+{
+    return heapBytesHelper(mRoot) + mSavedRoots.heapBytes() + mSavedSizes.heapBytes();
+}
+
+template <class Key, class Value>
+size_t PersistentMap<Key, Value>::heapBytesHelper(const Node* root) const
+{
+    if (root == NULL) return 0;
+    else              return sizeof(Node) + heapBytesOf(root->key)
+                           + heapBytesOf(root->value)
+                           + heapBytesHelper(root->left)
+                           + heapBytesHelper(root->right);
+}
+
+template <class Key, class Value>
+size_t PersistentMap<Key, Value>::memoryUsage() const
+{
+    return sizeof(*this) + heapBytes();
+}
+
+template <class Key, class Value>
+inline size_t heapBytesOf(const PersistentMap<Key, Value>& value)
+{
+    return value.heapBytes();
+}
+
+#endif
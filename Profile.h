@@ -0,0 +1,648 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+// Necessary for reading and writing profile files
+#include <fstream>
+#include <sstream>
+#include <string>
+#include "Vector.h"
+#include "Map.h"
+#include "Program.h"
+using namespace std;
+
+// Profile-guided specialization. In a typical workload a few operators,
+// expressions and variables account for almost all of the work. A Profile
+// records which ones, and is saved to a text file at the end of a run. A
+// later run loads it and uses it to
+//  - turn the instruction sequences that were common into superinstructions
+//    (see specializeProgram()), so there are fewer dispatches per row,
+//  - compile the expressions that were evaluated most often before they are
+//    first needed, and
+//  - give the most used variables the first slots of every program, so
+//    their inputs sit next to each other.
+//
+// Operator counts are taken from the compiled code of each evaluation, so a
+// side of a conditional that is skipped still counts.
+//
+// The file has one record per line:
+//
+//     opcode multiply 1200
+//     pattern multiply-add 400
+//     variable x 900
+//     expression 300 x 2 * y +
+//
+// An expression is written as its postfix tokens, separated by spaces.
+
+// Instruction sequences that can become one superinstruction
+enum Superinstruction
+{
+    SUPER_MULTIPLY_ADD,   // MULTIPLY ADD           -> MULTIPLY_ADD
+    SUPER_SCALE_VARIABLE, // VARIABLE CONSTANT MULTIPLY -> SCALE_VARIABLE
+    SUPERINSTRUCTION_COUNT
+};
+
+// A pattern is used once it makes up this share of all instructions run
+const double SUPERINSTRUCTION_SHARE = 0.01;
+
+// Number of expressions compiled up front when a profile is loaded
+const int HOT_EXPRESSIONS = 64;
+
+// Number of programs a ProgramCache holds before it drops the ones that
+// were not compiled up front
+const int MAX_CACHED_PROGRAMS = 4096;
+
+struct Profile
+{
+    // Instructions run, by Opcode
+    Vector<long> opcodes;
+    // Instruction sequences seen, by Superinstruction
+    Vector<long> patterns;
+    // Postfix text of every expression and the number of evaluations
+    Vector<string> expressions;
+    Vector<long> expressionCounts;
+    Map<string, int> expressionIndex;
+    // Every variable and the number of evaluations that read it
+    Vector<string> variables;
+    Vector<long> variableCounts;
+    Map<string, int> variableIndex;
+};
+
+// What a profile asks for: which superinstructions to make, and the
+// variables to put first, most used first.
+struct Specialization
+{
+    bool superinstructions[SUPERINSTRUCTION_COUNT];
+    Vector<string> hotVariables;
+};
+
+// Returns a Specialization that changes nothing, for running without a
+// profile.
+
+inline Specialization noSpecialization()
+{
+    Specialization specialization;
+    for (int i = 0; i < SUPERINSTRUCTION_COUNT; i++)
+        specialization.superinstructions[i] = false;
+    return specialization;
+}
+
+// ----------------------------------------------------//
+
+// Returns the name an opcode has in a profile file.
+
+inline const char* opcodeName(int opcode)
+{
+    static const char* names[OPCODE_COUNT] =
+    {
+        "constant", "variable", "add", "subtract", "multiply", "divide",
+        "min", "max", "sin", "cos", "tan", "argument", "return",
+        "less", "less-equal", "greater", "greater-equal", "equal",
+        "not-equal", "and", "or", "select", "skip-if-false",
+        "skip-if-true", "skip-else", "multiply-add", "scale-variable"
+    };
+    return (opcode >= 0 && opcode < OPCODE_COUNT) ? names[opcode] : "";
+}
+
+inline const char* superinstructionName(int pattern)
+{
+    static const char* names[SUPERINSTRUCTION_COUNT] =
+    {
+        "multiply-add", "scale-variable"
+    };
+    return (pattern >= 0 && pattern < SUPERINSTRUCTION_COUNT) ? names[pattern] : "";
+}
+
+inline void clearProfile(Profile& profile)
+{
+    profile.opcodes.clear();
+    profile.opcodes.resize(OPCODE_COUNT);
+    profile.patterns.clear();
+    profile.patterns.resize(SUPERINSTRUCTION_COUNT);
+    for (int i = 0; i < OPCODE_COUNT; i++)
+        profile.opcodes[i] = 0;
+    for (int i = 0; i < SUPERINSTRUCTION_COUNT; i++)
+        profile.patterns[i] = 0;
+
+    profile.expressions.clear();
+    profile.expressionCounts.clear();
+    profile.expressionIndex.clear();
+    profile.variables.clear();
+    profile.variableCounts.clear();
+    profile.variableIndex.clear();
+}
+
+// Adds 'count' to the counter for 'name', creating it if needed.
+
+inline void countName(Vector<string>& names, Vector<long>& counts,
+    Map<string, int>& index, const string& name, long count)
+{
+    int position = 0;
+    if (!index.search(name, position))
+    {
+        position = names.getSize();
+        names.pushBack(name);
+        counts.pushBack(0);
+        index.insert(name, position);
+    }
+    counts[position] += count;
+}
+
+// Returns the text an expression is recorded under: its postfix tokens
+// separated by spaces.
+
+inline string expressionKey(const Vector<string>& postfix)
+{
+    string key;
+    for (int i = 0; i < postfix.getSize(); i++)
+    {
+        if (i > 0)
+            key += ' ';
+        key += postfix[i];
+    }
+    return key;
+}
+
+// ----------------------------------------------------//
+
+// Marks every instruction a skip jumps to. A superinstruction may start at
+// such an instruction, but must not swallow one.
+
+inline void findJumpTargets(const Program& program, Vector<bool>& targets)
+{
+    targets.resize(program.code.getSize() + 1);
+    for (int i = 0; i < targets.getSize(); i++)
+        targets[i] = false;
+
+    for (int i = 0; i < program.code.getSize(); i++)
+    {
+        if (isSkip(program.code[i]))
+            targets[i + program.code[i].operand] = true;
+    }
+}
+
+// Returns the superinstruction that can replace the code starting at
+// instruction 'i', or -1. 'length' is set to the number of instructions it
+// replaces.
+
+inline int matchSuperinstruction(const Program& program,
+    const Vector<bool>& targets, int i, int& length)
+{
+    const Vector<Instruction>& code = program.code;
+    int size = code.getSize();
+
+    if (i + 1 < size && !targets[i + 1] &&
+        code[i].opcode == OP_MULTIPLY && code[i + 1].opcode == OP_ADD)
+    {
+        length = 2;
+        return SUPER_MULTIPLY_ADD;
+    }
+
+    // The slot and the constant share the operand, 16 bits each
+    if (i + 2 < size && !targets[i + 1] && !targets[i + 2] &&
+        code[i].opcode == OP_VARIABLE && code[i + 1].opcode == OP_CONSTANT &&
+        code[i + 2].opcode == OP_MULTIPLY &&
+        code[i].operand < 0x10000 && code[i + 1].operand < 0x8000)
+    {
+        length = 3;
+        return SUPER_SCALE_VARIABLE;
+    }
+
+    length = 1;
+    return -1;
+}
+
+// Adds one evaluation of 'program', compiled from 'postfix', to 'profile'.
+// A superinstruction counts as the instructions it replaced, so profiles of
+// specialized and plain programs are the same.
+
+inline void recordEvaluation(Profile& profile, const Vector<string>& postfix,
+    const Program& program)
+{
+    if (profile.opcodes.getSize() != OPCODE_COUNT)
+        clearProfile(profile);
+
+    for (int i = 0; i < program.code.getSize(); i++)
+    {
+        int opcode = program.code[i].opcode;
+        if (opcode == OP_MULTIPLY_ADD)
+        {
+            profile.opcodes[OP_MULTIPLY]++;
+            profile.opcodes[OP_ADD]++;
+            profile.patterns[SUPER_MULTIPLY_ADD]++;
+        }
+        else if (opcode == OP_SCALE_VARIABLE)
+        {
+            profile.opcodes[OP_VARIABLE]++;
+            profile.opcodes[OP_CONSTANT]++;
+            profile.opcodes[OP_MULTIPLY]++;
+            profile.patterns[SUPER_SCALE_VARIABLE]++;
+        }
+        else
+            profile.opcodes[opcode]++;
+    }
+
+    Vector<bool> targets;
+    findJumpTargets(program, targets);
+    for (int i = 0; i < program.code.getSize(); i++)
+    {
+        int length = 1;
+        int pattern = matchSuperinstruction(program, targets, i, length);
+        if (pattern >= 0)
+            profile.patterns[pattern]++;
+    }
+
+    for (int i = 0; i < program.variables.getSize(); i++)
+    {
+        countName(profile.variables, profile.variableCounts,
+            profile.variableIndex, program.variables[i], 1);
+    }
+
+    countName(profile.expressions, profile.expressionCounts,
+        profile.expressionIndex, expressionKey(postfix), 1);
+}
+
+// ----------------------------------------------------//
+
+// Saves 'profile' to 'path'. Returns false if the file cannot be written.
+
+inline bool writeProfile(const Profile& profile, const string& path)
+{
+    ofstream file(path.c_str());
+    if (!file)
+        return false;
+
+    for (int i = 0; i < profile.opcodes.getSize(); i++)
+    {
+        if (profile.opcodes[i] > 0)
+            file << "opcode " << opcodeName(i) << " " << profile.opcodes[i] << "\n";
+    }
+    for (int i = 0; i < profile.patterns.getSize(); i++)
+    {
+        if (profile.patterns[i] > 0)
+        {
+            file << "pattern " << superinstructionName(i) << " "
+                 << profile.patterns[i] << "\n";
+        }
+    }
+    for (int i = 0; i < profile.variables.getSize(); i++)
+    {
+        file << "variable " << profile.variables[i] << " "
+             << profile.variableCounts[i] << "\n";
+    }
+    for (int i = 0; i < profile.expressions.getSize(); i++)
+    {
+        file << "expression " << profile.expressionCounts[i] << " "
+             << profile.expressions[i] << "\n";
+    }
+    return (bool) file;
+}
+
+// Loads a profile written by writeProfile(), adding its counts to
+// 'profile'. On failure 'error' names the line that could not be read.
+
+inline bool readProfile(const string& path, Profile& profile, string& error)
+{
+    ifstream file(path.c_str());
+    if (!file)
+    {
+        error = "Could not open " + path;
+        return false;
+    }
+    if (profile.opcodes.getSize() != OPCODE_COUNT)
+        clearProfile(profile);
+
+    string line;
+    for (int number = 1; getline(file, line); number++)
+    {
+        stringstream ss(line);
+        string kind, name;
+        long count = -1;
+        bool valid = false;
+
+        ss >> kind;
+        if (kind.empty())
+            continue;
+
+        if (kind == "opcode" || kind == "pattern")
+        {
+            valid = (ss >> name >> count) && count >= 0;
+            bool known = false;
+            for (int i = 0; valid && kind == "opcode" && i < OPCODE_COUNT; i++)
+            {
+                if (name == opcodeName(i))
+                {
+                    profile.opcodes[i] += count;
+                    known = true;
+                }
+            }
+            for (int i = 0; valid && kind == "pattern" && i < SUPERINSTRUCTION_COUNT; i++)
+            {
+                if (name == superinstructionName(i))
+                {
+                    profile.patterns[i] += count;
+                    known = true;
+                }
+            }
+            valid = valid && known;
+        }
+        else if (kind == "variable")
+        {
+            valid = (ss >> name >> count) && count >= 0;
+            if (valid)
+            {
+                countName(profile.variables, profile.variableCounts,
+                    profile.variableIndex, name, count);
+            }
+        }
+        else if (kind == "expression")
+        {
+            Vector<string> postfix;
+            string token;
+            valid = (ss >> count) && count >= 0;
+            while (valid && ss >> token)
+                postfix.pushBack(token);
+            valid = valid && postfix.getSize() > 0;
+            if (valid)
+            {
+                countName(profile.expressions, profile.expressionCounts,
+                    profile.expressionIndex, expressionKey(postfix), count);
+            }
+        }
+
+        if (!valid)
+        {
+            stringstream message;
+            message << path << ", line " << number << ": not a profile record";
+            error = message.str();
+            return false;
+        }
+    }
+    return true;
+}
+
+// ----------------------------------------------------//
+
+// Sets 'order' to the indices of 'counts', largest count first. Profiles
+// are small, so a simple insertion sort will do.
+
+inline void rankByCount(const Vector<long>& counts, Vector<int>& order)
+{
+    order.clear();
+    for (int i = 0; i < counts.getSize(); i++)
+    {
+        order.pushBack(i);
+        for (int k = order.getSize() - 1; k > 0 && counts[order[k - 1]] < counts[i]; k--)
+        {
+            order[k] = order[k - 1];
+            order[k - 1] = i;
+        }
+    }
+}
+
+// Picks what to specialize for the workload 'profile' describes.
+
+inline void chooseSpecialization(const Profile& profile,
+    Specialization& specialization)
+{
+    long total = 0;
+    for (int i = 0; i < profile.opcodes.getSize(); i++)
+        total += profile.opcodes[i];
+
+    for (int i = 0; i < SUPERINSTRUCTION_COUNT; i++)
+    {
+        long count = (i < profile.patterns.getSize()) ? profile.patterns[i] : 0;
+        specialization.superinstructions[i] =
+            (count > 0 && count >= total * SUPERINSTRUCTION_SHARE);
+    }
+
+    Vector<int> order;
+    rankByCount(profile.variableCounts, order);
+    specialization.hotVariables.clear();
+    for (int i = 0; i < order.getSize(); i++)
+        specialization.hotVariables.pushBack(profile.variables[order[i]]);
+}
+
+// Sets 'expressions' to the postfix tokens of the (at most) 'count'
+// expressions that were evaluated most often, most often first.
+
+inline void hotExpressions(const Profile& profile, int count,
+    Vector< Vector<string> >& expressions)
+{
+    Vector<int> order;
+    rankByCount(profile.expressionCounts, order);
+
+    expressions.clear();
+    for (int i = 0; i < order.getSize() && i < count; i++)
+    {
+        Vector<string> postfix;
+        tokenize(profile.expressions[order[i]], postfix);
+        expressions.pushBack(postfix);
+    }
+}
+
+// ----------------------------------------------------//
+
+// Rewrites a compiled program for the workload 'specialization' describes:
+// the hot variables get the first slots, in order, and the chosen
+// instruction sequences become superinstructions. The results are bit for
+// bit the same; a multiply-add is still rounded twice, like the multiply
+// and the add it replaces. If 'origins' holds the origin of each
+// instruction (see compileProgram()), it is updated to match.
+//
+// A specialized program is only for evaluateProgram(),
+// evaluateProgramBatch() and evaluateProgramParallel(). Differentiate or
+// fuse (buildMultiProgram()) the program as compiled.
+
+inline void specializeProgram(Program& program,
+    const Specialization& specialization, Vector<int>* origins = NULL)
+{
+    // Renumber the slots: hot variables first, then the rest in their
+    // current order
+    int slots = program.variables.getSize();
+    Vector<int> newSlot(slots);
+    Vector<string> names;
+    for (int i = 0; i < slots; i++)
+        newSlot[i] = -1;
+
+    for (int h = 0; h < specialization.hotVariables.getSize(); h++)
+    {
+        for (int i = 0; i < slots; i++)
+        {
+            if (newSlot[i] < 0 && program.variables[i] == specialization.hotVariables[h])
+            {
+                newSlot[i] = names.getSize();
+                names.pushBack(program.variables[i]);
+            }
+        }
+    }
+    for (int i = 0; i < slots; i++)
+    {
+        if (newSlot[i] < 0)
+        {
+            newSlot[i] = names.getSize();
+            names.pushBack(program.variables[i]);
+        }
+    }
+    program.variables = names;
+
+    for (int i = 0; i < program.code.getSize(); i++)
+    {
+        if (program.code[i].opcode == OP_VARIABLE)
+            program.code[i].operand = newSlot[program.code[i].operand];
+    }
+
+    // Fuse. Skips jump over fewer instructions afterwards, so remember
+    // where every old instruction went.
+    Vector<bool> targets;
+    findJumpTargets(program, targets);
+
+    Vector<Instruction> code;
+    Vector<int> moved(program.code.getSize() + 1);
+    Vector<int> fusedOrigins;
+
+    for (int i = 0; i < program.code.getSize(); )
+    {
+        int length = 1;
+        int pattern = matchSuperinstruction(program, targets, i, length);
+        if (pattern >= 0 && !specialization.superinstructions[pattern])
+        {
+            pattern = -1;
+            length  = 1;
+        }
+
+        Instruction instruction = program.code[i];
+        if (pattern == SUPER_MULTIPLY_ADD)
+        {
+            instruction.opcode  = OP_MULTIPLY_ADD;
+            instruction.operand = 0;
+        }
+        else if (pattern == SUPER_SCALE_VARIABLE)
+        {
+            instruction.opcode  = OP_SCALE_VARIABLE;
+            instruction.operand = (program.code[i + 1].operand << 16) |
+                program.code[i].operand;
+        }
+
+        for (int k = 0; k < length; k++)
+            moved[i + k] = code.getSize();
+        if (origins != NULL)
+            fusedOrigins.pushBack((*origins)[i]);
+
+        code.pushBack(instruction);
+        i += length;
+    }
+    moved[program.code.getSize()] = code.getSize();
+
+    for (int i = 0; i < program.code.getSize(); i++)
+    {
+        if (isSkip(program.code[i]))
+        {
+            int from = moved[i];
+            code[from].operand = moved[i + program.code[i].operand] - from;
+        }
+    }
+
+    program.code = code;
+    shrinkProgram(program);
+    if (origins != NULL)
+        *origins = fusedOrigins;
+}
+
+// ----------------------------------------------------//
+
+// Compiled programs by expression, so an expression that is evaluated again
+// is not parsed and compiled again. Programs are inlined copies of the
+// functions they call, so the cache has to be cleared whenever a function
+// is (re)defined. A session that types many different expressions would
+// otherwise grow it without bound, so once it holds MAX_CACHED_PROGRAMS it
+// drops everything but the hot expressions warmProgramCache() compiled.
+// Call clearProgramCache() or warmProgramCache() before using one.
+struct ProgramCache
+{
+    // Applied to every program as it is compiled; noSpecialization() when
+    // there is no profile
+    Specialization specialization;
+    // For each entry, the program, the postfix index of every instruction
+    // and the expressionKey() it was found by
+    Vector<Program> programs;
+    Vector< Vector<int> > origins;
+    Vector<string> keys;
+    // Entry of each expression, by expressionKey()
+    Map<string, int> index;
+    // The first 'warmed' entries are the hot expressions, kept when the
+    // cache is full
+    int warmed;
+};
+
+inline void clearProgramCache(ProgramCache& cache)
+{
+    cache.programs.clear();
+    cache.origins.clear();
+    cache.keys.clear();
+    cache.index.clear();
+    cache.warmed = 0;
+}
+
+// Drops every entry after the hot expressions.
+
+inline void trimProgramCache(ProgramCache& cache)
+{
+    cache.programs.resize(cache.warmed);
+    cache.origins.resize(cache.warmed);
+    cache.keys.resize(cache.warmed);
+    cache.index.clear();
+    for (int i = 0; i < cache.warmed; i++)
+        cache.index.insert(cache.keys[i], i);
+}
+
+// Finds the program for 'postfix', compiling and specializing it if it is
+// not in the cache yet, and sets 'entry' to its place in the cache, which
+// is valid until the next call. Returns false, with 'diagnostic' filled in,
+// if the expression does not compile; those are not cached.
+
+inline bool findProgram(ProgramCache& cache, const Vector<string>& postfix,
+    const Map<string, Function>& functions, int& entry, Diagnostic* diagnostic = NULL)
+{
+    string key = expressionKey(postfix);
+    if (cache.index.search(key, entry))
+        return true;
+
+    Program program;
+    Vector<int> origins;
+    if (!compileProgram(postfix, functions, program, diagnostic, &origins))
+        return false;
+    specializeProgram(program, cache.specialization, &origins);
+
+    if (cache.programs.getSize() >= MAX_CACHED_PROGRAMS)
+        trimProgramCache(cache);
+
+    entry = cache.programs.getSize();
+    cache.programs.pushBack(program);
+    cache.origins.pushBack(origins);
+    cache.keys.pushBack(key);
+    cache.index.insert(key, entry);
+    return true;
+}
+
+// Sets up 'cache' for the workload 'profile' describes: picks the
+// specialization and compiles the most frequent expressions. Expressions
+// that no longer compile (e.g. they call a function that is not defined in
+// this run) are left out.
+
+inline void warmProgramCache(ProgramCache& cache, const Profile& profile,
+    const Map<string, Function>& functions)
+{
+    clearProgramCache(cache);
+    chooseSpecialization(profile, cache.specialization);
+
+    Vector< Vector<string> > expressions;
+    hotExpressions(profile, HOT_EXPRESSIONS, expressions);
+    for (int i = 0; i < expressions.getSize(); i++)
+    {
+        int entry = 0;
+        findProgram(cache, expressions[i], functions, entry);
+    }
+    cache.warmed = cache.programs.getSize();
+}
+
+#endif
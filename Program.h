@@ -0,0 +1,1015 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+// Necessary for the math functions
+#include <cmath>
+#include <cstring>
+#include <string>
+#include "Vector.h"
+#include "Map.h"
+#include "PersistentMap.h"
+#include "Numeric.h"
+#include "Diagnostics.h"
+#include "Calculator.h"
+using namespace std;
+
+// A postfix expression compiled once into a flat list of instructions.
+// evaluatePostfix() has to compare every token against every operator name
+// and search the variable map on each evaluation. A Program does that work
+// up front: literals are parsed into 'constants', variables are given slot
+// numbers, and each token becomes an Opcode. Evaluating it only needs an
+// array of input values indexed by slot.
+//
+// Conditionals are compiled so that evaluateProgram() only evaluates the
+// operands it needs. For "if ( c , a , b )" the code is
+//
+//     c  SKIP_IF_FALSE  a  SKIP_ELSE  b  SELECT
+//
+// If c is false, SKIP_IF_FALSE jumps straight to b, pushing a placeholder
+// where a's value would have been; if c is true, SKIP_ELSE jumps over b the
+// same way. Either way SELECT finds c, a and b on the stack and picks one.
+// "a and b" is "a SKIP_IF_FALSE b AND", "a or b" is "a SKIP_IF_TRUE b OR".
+// The batch evaluators ignore the skips, evaluate both sides for every row
+// and blend them with SELECT, so there are no branches per row.
+
+enum Opcode
+{
+    OP_CONSTANT,  // push constants[operand]
+    OP_VARIABLE,  // push inputs[operand]
+    OP_ADD,
+    OP_SUBTRACT,
+    OP_MULTIPLY,
+    OP_DIVIDE,
+    OP_MIN,
+    OP_MAX,
+    OP_SIN,
+    OP_COS,
+    OP_TAN,
+    OP_ARGUMENT,  // push stack[operand], a parameter of an inlined function
+    OP_RETURN,    // replace the 'operand' arguments below the top with the top
+    OP_LESS,
+    OP_LESS_EQUAL,
+    OP_GREATER,
+    OP_GREATER_EQUAL,
+    OP_EQUAL,
+    OP_NOT_EQUAL,
+    OP_AND,
+    OP_OR,
+    OP_SELECT,    // c a b -> a if c is true, else b
+    // Skips jump 'operand' instructions forward, pushing a placeholder for
+    // the operand they skip:
+    OP_SKIP_IF_FALSE, // if the top is false
+    OP_SKIP_IF_TRUE,  // if the top is true
+    OP_SKIP_ELSE,     // if the value below the top is true
+    // Superinstructions, only made by specializeProgram() (see Profile.h):
+    OP_MULTIPLY_ADD,    // c a b -> c + a * b, rounded as the two operations
+    OP_SCALE_VARIABLE,  // push inputs[operand & 0xffff] * constants[operand >> 16]
+    OPCODE_COUNT        // the number of opcodes, not an instruction
+};
+
+// Packed to 5 bytes: a 1-byte opcode and a 4-byte operand (constant index,
+// variable slot, stack position or argument count). Without packing the
+// operand would be padded out to 8 bytes.
+#pragma pack(push, 1)
+struct Instruction
+{
+    unsigned char opcode;
+    int operand;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(Instruction) == 5, "Instruction should be packed");
+
+struct Program
+{
+    Vector<Instruction> code;
+    Vector<double> constants;
+    // The same constants read from their literals as long double and as
+    // Decimal, which hold digits a double loses (DECIMAL_OVERFLOW where a
+    // literal does not fit a Decimal)
+    Vector<long double> wideConstants;
+    Vector<Decimal> decimalConstants;
+    // Name of each variable slot, in order of first use
+    Vector<string> variables;
+    // Largest number of values on the stack at any point
+    int maxDepth;
+};
+
+// A user-defined function such as "f ( x , y ) = x * y + sin ( x )". The
+// body is compiled once, when the function is defined, with each parameter
+// becoming an OP_ARGUMENT. Calls are inlined by copying the body into the
+// calling program, so a call costs no parsing and no lookups at run time.
+struct Function
+{
+    Vector<string> parameters;
+    Program body;
+};
+
+// Values are computed this many rows at a time by evaluateProgramBatch()
+const int BATCH_SIZE = 256;
+
+// ----------------------------------------------------//
+
+// Returns the opcode for an operator token by variable reference, false if
+// 'token' is not an operator. Tokens are told apart by length first, so a
+// variable or number costs a few compares rather than one per operator.
+
+inline bool operatorOpcode(const string& token, int& opcode)
+{
+    switch (token.size())
+    {
+        case 1:
+            switch (token[0])
+            {
+                case '+': opcode = OP_ADD;      return true;
+                case '-': opcode = OP_SUBTRACT; return true;
+                case '*': opcode = OP_MULTIPLY; return true;
+                case '/': opcode = OP_DIVIDE;   return true;
+                case '<': opcode = OP_LESS;     return true;
+                case '>': opcode = OP_GREATER;  return true;
+            }
+            return false;
+        case 2:
+            if      (token == "<=") opcode = OP_LESS_EQUAL;
+            else if (token == ">=") opcode = OP_GREATER_EQUAL;
+            else if (token == "==") opcode = OP_EQUAL;
+            else if (token == "!=") opcode = OP_NOT_EQUAL;
+            else if (token == "or") opcode = OP_OR;
+            else if (token == "if") opcode = OP_SELECT;
+            else return false;
+            return true;
+        case 3:
+            if      (token == "min") opcode = OP_MIN;
+            else if (token == "max") opcode = OP_MAX;
+            else if (token == "sin") opcode = OP_SIN;
+            else if (token == "cos") opcode = OP_COS;
+            else if (token == "tan") opcode = OP_TAN;
+            else if (token == "and") opcode = OP_AND;
+            else return false;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Returns true for the skip instructions, which only steer evaluateProgram()
+// and neither pop nor push a value when not taken.
+
+inline bool isSkip(const Instruction& instruction)
+{
+    return instruction.opcode == OP_SKIP_IF_FALSE ||
+           instruction.opcode == OP_SKIP_IF_TRUE  ||
+           instruction.opcode == OP_SKIP_ELSE;
+}
+
+// Returns the number of values an instruction pops off the stack. Every
+// instruction except the skips pushes exactly one value back.
+
+inline int operandCount(const Instruction& instruction)
+{
+    switch (instruction.opcode)
+    {
+        case OP_CONSTANT:
+        case OP_VARIABLE:
+        case OP_ARGUMENT:
+        case OP_SKIP_IF_FALSE:
+        case OP_SKIP_IF_TRUE:
+        case OP_SKIP_ELSE:
+        case OP_SCALE_VARIABLE: return 0;
+        case OP_SIN:
+        case OP_COS:
+        case OP_TAN:            return 1;
+        case OP_SELECT:
+        case OP_MULTIPLY_ADD:   return 3;
+        case OP_RETURN:         return instruction.operand + 1;
+        default:                return 2;
+    }
+}
+
+// Returns 1 or 0 for a comparison or logic opcode. The evaluators that work
+// on plain doubles share this.
+inline double applyComparison(int opcode, double a, double b)
+{
+    switch (opcode)
+    {
+        case OP_LESS:          return (a <  b) ? 1 : 0;
+        case OP_LESS_EQUAL:    return (a <= b) ? 1 : 0;
+        case OP_GREATER:       return (a >  b) ? 1 : 0;
+        case OP_GREATER_EQUAL: return (a >= b) ? 1 : 0;
+        case OP_EQUAL:         return (a == b) ? 1 : 0;
+        case OP_NOT_EQUAL:     return (a != b) ? 1 : 0;
+        case OP_AND:           return (a != 0 && b != 0) ? 1 : 0;
+        case OP_OR:            return (a != 0 || b != 0) ? 1 : 0;
+        default:               return 0;
+    }
+}
+
+// Finds, for every token of 'postfix', the token that uses its value
+// ('consumer', -1 for the result) and which of that token's operands it is
+// ('position'). Returns false if an operator lacks operands.
+
+inline bool findConsumers(const Vector<string>& postfix,
+    const Map<string, Function>& functions, Vector<int>& consumer,
+    Vector<int>& position, Diagnostic* diagnostic = NULL)
+{
+    consumer.resize(postfix.getSize());
+    position.resize(postfix.getSize());
+
+    Vector<int> roots;
+    Function function;
+
+    for (int i = 0; i < postfix.getSize(); i++)
+    {
+        Instruction instruction;
+        int opcode = 0;
+        int count  = 0;
+
+        if (operatorOpcode(postfix[i], opcode))
+        {
+            instruction.opcode  = opcode;
+            instruction.operand = 0;
+            count = operandCount(instruction);
+        }
+        else if (functions.search(postfix[i], function))
+            count = function.parameters.getSize();
+
+        if (roots.getSize() < count)
+            return report(diagnostic, ERROR_MISSING_OPERAND, i);
+
+        for (int k = 0; k < count; k++)
+        {
+            int root = roots[roots.getSize() - count + k];
+            consumer[root] = i;
+            position[root] = k;
+        }
+        for (int k = 0; k < count; k++)
+            roots.popBack();
+
+        consumer[i] = -1;
+        roots.pushBack(i);
+    }
+    return true;
+}
+
+// Adds the literal of a new constant to the tables for the types more
+// precise than double. It is read once here rather than on every
+// evaluation.
+
+inline void addPreciseConstant(Program& program, const string& literal)
+{
+    long double wide = 0;
+    NumericTraits<long double>::parse(literal, wide);
+    program.wideConstants.pushBack(wide);
+
+    Decimal decimal = {0};
+    if (!NumericTraits<Decimal>::parse(literal, decimal))
+        decimal.units = DECIMAL_OVERFLOW;
+    program.decimalConstants.pushBack(decimal);
+}
+
+// Appends the instructions for 'postfix' to 'program'. 'depth' is the number
+// of values already on the stack, and 'parameters' the names that refer to
+// them (both are empty/0 outside of a function body). Calls to functions in
+// 'functions' are inlined. Returns false if the expression is malformed.
+// 'diagnostic' and 'origins' are as for compileProgram().
+
+inline bool compileTokens(const Vector<string>& postfix,
+    const Map<string, Function>& functions, const Vector<string>& parameters,
+    int depth, Program& program, Diagnostic* diagnostic = NULL,
+    Vector<int>* origins = NULL)
+{
+    const int startDepth = depth;
+
+    // Slot of each variable seen so far. A balanced map, as the names often
+    // come in sorted order (x1, x2, ...)
+    PersistentMap<string, int> slots;
+    for (int i = 0; i < program.variables.getSize(); i++)
+        slots.insert(program.variables[i], i);
+
+    // Reused for every function call, so the vectors are only set up once
+    Function function;
+
+    // Conditionals need a skip right after the code of some of their
+    // operands, so find out up front which operand each token completes.
+    // skipAfter[k] and elseAfter[k] are the skips emitted for the
+    // conditional at token k.
+    bool conditional = false;
+    for (int i = 0; i < postfix.getSize(); i++)
+    {
+        if (postfix[i] == "if" || postfix[i] == "and" || postfix[i] == "or")
+            conditional = true;
+    }
+
+    Vector<int> consumer, position, skipAfter, elseAfter;
+    if (conditional)
+    {
+        if (!findConsumers(postfix, functions, consumer, position, diagnostic))
+            return false;
+        skipAfter.resize(postfix.getSize());
+        elseAfter.resize(postfix.getSize());
+    }
+
+    for (int i = 0; i < postfix.getSize(); i++)
+    {
+        Instruction instruction;
+        double value = 0;
+
+        int opcode = 0;
+        int slot   = 0;
+
+        if (operatorOpcode(postfix[i], opcode))
+        {
+            instruction.opcode  = opcode;
+            instruction.operand = 0;
+
+            // Error checking for malformed expressions
+            int count = operandCount(instruction);
+            if (depth < count)
+                return report(diagnostic, ERROR_MISSING_OPERAND, i);
+            depth = depth - count + 1;
+        }
+        else if (functions.search(postfix[i], function))
+        {
+            // The arguments are the top 'arity' values on the stack
+            int arity = function.parameters.getSize();
+            if (depth < arity)
+                return report(diagnostic, ERROR_MISSING_OPERAND, i);
+
+            int base = depth - arity;
+            int constantOffset = program.constants.getSize();
+
+            for (int k = 0; k < function.body.constants.getSize(); k++)
+            {
+                program.constants.pushBack(function.body.constants[k]);
+                program.wideConstants.pushBack(function.body.wideConstants[k]);
+                program.decimalConstants.pushBack(function.body.decimalConstants[k]);
+            }
+
+            // Copy the body, moving its constants, variables and arguments
+            // to where they are in this program
+            for (int k = 0; k < function.body.code.getSize(); k++)
+            {
+                Instruction copy = function.body.code[k];
+
+                if (copy.opcode == OP_CONSTANT)
+                    copy.operand += constantOffset;
+                else if (copy.opcode == OP_ARGUMENT)
+                    copy.operand += base;
+                else if (copy.opcode == OP_VARIABLE)
+                {
+                    const string& name = function.body.variables[copy.operand];
+                    if (!slots.search(name, slot))
+                    {
+                        slot = program.variables.getSize();
+                        program.variables.pushBack(name);
+                        slots.insert(name, slot);
+                    }
+                    copy.operand = slot;
+                }
+                program.code.pushBack(copy);
+                if (origins != NULL)
+                    origins->pushBack(i);
+            }
+
+            if (base + function.body.maxDepth > program.maxDepth)
+                program.maxDepth = base + function.body.maxDepth;
+
+            // Drop the arguments, keeping the result
+            instruction.opcode  = OP_RETURN;
+            instruction.operand = arity;
+            depth = base + 1;
+        }
+        else if (parseNumber(postfix[i], value))
+        {
+            instruction.opcode  = OP_CONSTANT;
+            instruction.operand = program.constants.getSize();
+            program.constants.pushBack(value);
+            addPreciseConstant(program, postfix[i]);
+            depth++;
+        }
+        else if (outOfRange<double>(postfix[i]))
+            return report(diagnostic, ERROR_OUT_OF_RANGE, i);
+        else
+        {
+            // A parameter of the function being compiled
+            instruction.operand = -1;
+            for (int k = 0; k < parameters.getSize(); k++)
+            {
+                if (parameters[k] == postfix[i])
+                    instruction.operand = k;
+            }
+
+            if (instruction.operand >= 0)
+                instruction.opcode = OP_ARGUMENT;
+
+            // Otherwise a variable
+            else
+            {
+                instruction.opcode = OP_VARIABLE;
+                if (!slots.search(postfix[i], slot))
+                {
+                    slot = program.variables.getSize();
+                    program.variables.pushBack(postfix[i]);
+                    slots.insert(postfix[i], slot);
+                }
+                instruction.operand = slot;
+            }
+            depth++;
+        }
+
+        if (depth > program.maxDepth)
+            program.maxDepth = depth;
+
+        // A conditional: point its skips at the right instructions
+        int here = program.code.getSize();
+        if (instruction.opcode == OP_SELECT)
+        {
+            program.code[skipAfter[i]].operand = elseAfter[i] + 1 - skipAfter[i];
+            program.code[elseAfter[i]].operand = here - elseAfter[i];
+        }
+        else if (instruction.opcode == OP_AND || instruction.opcode == OP_OR)
+            program.code[skipAfter[i]].operand = here - skipAfter[i];
+
+        program.code.pushBack(instruction);
+        if (origins != NULL)
+            origins->pushBack(i);
+
+        // The operand of a conditional is complete: add its skip
+        int parent = conditional ? consumer[i] : -1;
+        if (parent >= 0)
+        {
+            Instruction skip;
+            skip.opcode  = OP_SKIP_IF_FALSE;
+            skip.operand = 0;
+
+            if (postfix[parent] == "if" && position[i] == 0)
+                skipAfter[parent] = program.code.getSize();
+            else if (postfix[parent] == "if" && position[i] == 1)
+            {
+                skip.opcode = OP_SKIP_ELSE;
+                elseAfter[parent] = program.code.getSize();
+            }
+            else if (postfix[parent] == "and" && position[i] == 0)
+                skipAfter[parent] = program.code.getSize();
+            else if (postfix[parent] == "or" && position[i] == 0)
+            {
+                skip.opcode = OP_SKIP_IF_TRUE;
+                skipAfter[parent] = program.code.getSize();
+            }
+            else
+                parent = -1;
+
+            if (parent >= 0)
+            {
+                program.code.pushBack(skip);
+                if (origins != NULL)
+                    origins->pushBack(i);
+            }
+        }
+    }
+
+    // Exactly one value, the result, has to be added
+    if (depth == startDepth + 1)
+        return true;
+    return report(diagnostic, (depth == startDepth) ? ERROR_MISSING_OPERAND : 
+        ERROR_EXTRA_VALUES, -1);
+}
+
+// Releases the spare capacity of a program's vectors.
+
+inline void shrinkProgram(Program& program)
+{
+    program.code.shrinkToFit();
+    program.constants.shrinkToFit();
+    program.wideConstants.shrinkToFit();
+    program.decimalConstants.shrinkToFit();
+    program.variables.shrinkToFit();
+}
+
+// Bytes owned by a program on the heap (see MemoryUsage.h)
+
+inline size_t heapBytesOf(const Program& program)
+{
+    return program.code.heapBytes() + program.constants.heapBytes()
+         + program.wideConstants.heapBytes() + program.decimalConstants.heapBytes()
+         + program.variables.heapBytes();
+}
+
+inline size_t heapBytesOf(const Function& function)
+{
+    return function.parameters.heapBytes() + heapBytesOf(function.body);
+}
+
+// Checks the calls shuntingYard() left to the caller ('calls' and 'counts'):
+// a call to a function in 'functions' has to have one argument per
+// parameter. Returns false otherwise, with 'diagnostic' pointing at the
+// function's name in the infix expression.
+
+inline bool checkArguments(const Vector<int>& calls, const Vector<int>& counts,
+    const Map<string, Function>& functions, const Vector<string>& expression,
+    Diagnostic* diagnostic = NULL)
+{
+    Function function;
+    for (int i = 0; i < calls.getSize(); i++)
+    {
+        if (functions.search(expression[calls[i]], function) &&
+            function.parameters.getSize() != counts[i])
+            return report(diagnostic, ERROR_WRONG_ARGUMENTS, calls[i]);
+    }
+    return true;
+}
+
+// shuntingYard() for an expression that can call the functions in
+// 'functions', which also fails if one of them is called with the wrong
+// number of arguments.
+
+inline bool shuntingYard(const Vector<string>& expression, const int startIndex,
+    const Map<string, Function>& functions, Vector<string>& postfix,
+    Diagnostic* diagnostic = NULL, Vector<int>* origins = NULL)
+{
+    Vector<int> calls, counts;
+    return shuntingYard(expression, startIndex, postfix, diagnostic, origins,
+        &calls, &counts) &&
+        checkArguments(calls, counts, functions, expression, diagnostic);
+}
+
+// Compiles the output of shuntingYard() into 'program'. Returns false if the
+// postfix expression is malformed (an operator without enough operands, or
+// more than one value left at the end), the same cases in which
+// evaluatePostfix() fails. A number a double cannot hold, such as 1e400, is
+// out of range. Other tokens that are not operators, functions or numbers
+// become variables; whether they are defined is checked by bindVariables().
+// 'diagnostic', if given, tells which postfix token failed (see
+// Diagnostics.h). 'origins', if given, is set to the index in 'postfix' of
+// the token each instruction was compiled from, which is how errors that
+// evaluateProgram() reports by instruction are traced back to the tokens.
+
+inline bool compileProgram(const Vector<string>& postfix,
+    const Map<string, Function>& functions, Program& program,
+    Diagnostic* diagnostic = NULL, Vector<int>* origins = NULL)
+{
+    program.code.clear();
+    program.constants.clear();
+    program.wideConstants.clear();
+    program.decimalConstants.clear();
+    program.variables.clear();
+    program.maxDepth = 0;
+    if (origins != NULL)
+        origins->clear();
+
+    Vector<string> noParameters;
+    if (!compileTokens(postfix, functions, noParameters, 0, program, 
+        diagnostic, origins))
+        return false;
+
+    // Programs are usually kept around, so drop the spare capacity
+    shrinkProgram(program);
+    return true;
+}
+
+inline bool compileProgram(const Vector<string>& postfix, Program& program,
+    Diagnostic* diagnostic = NULL, Vector<int>* origins = NULL)
+{
+    Map<string, Function> noFunctions;
+    return compileProgram(postfix, noFunctions, program, diagnostic, origins);
+}
+
+// Compiles the body of a user-defined function. 'postfix' is the output of
+// shuntingYard() for the part after the "=". Returns false if the body is
+// malformed or a parameter name is repeated.
+
+inline bool defineFunction(const Vector<string>& parameters,
+    const Vector<string>& postfix, const Map<string, Function>& functions,
+    Function& function)
+{
+    for (int i = 0; i < parameters.getSize(); i++)
+    {
+        for (int j = i + 1; j < parameters.getSize(); j++)
+        {
+            if (parameters[i] == parameters[j])
+                return false;
+        }
+    }
+
+    function.parameters = parameters;
+
+    Program& body = function.body;
+    body.code.clear();
+    body.constants.clear();
+    body.wideConstants.clear();
+    body.decimalConstants.clear();
+    body.variables.clear();
+    body.maxDepth = parameters.getSize();
+
+    // The arguments are already on the stack when the body starts
+    if (!compileTokens(postfix, functions, parameters, parameters.getSize(),
+        body))
+        return false;
+
+    shrinkProgram(body);
+    return true;
+}
+
+// Looks up every variable the program uses and stores its value in 'inputs',
+// indexed by slot. Returns false if a variable is not in the map.
+
+template <class T, template <class, class> class M, class V>
+bool bindVariables(const Program& program, const M<string, V>& variables,
+    Vector<T>& inputs)
+{
+    inputs.resize(program.variables.getSize());
+
+    for (int i = 0; i < program.variables.getSize(); i++)
+    {
+        V stored = V();
+        if (!variables.search(program.variables[i], stored))
+            return false;
+
+        loadVariable(stored, inputs[i]);
+    }
+    return true;
+}
+
+// Returns the slot of the first variable of 'program' that is not in
+// 'variables', or -1 if they are all there. For reporting what made
+// bindVariables() fail.
+
+template <template <class, class> class M, class V>
+int findUnboundVariable(const Program& program, const M<string, V>& variables)
+{
+    V stored = V();
+    for (int i = 0; i < program.variables.getSize(); i++)
+    {
+        if (!variables.search(program.variables[i], stored))
+            return i;
+    }
+    return -1;
+}
+
+// ----------------------------------------------------//
+
+// Returns constant number 'index' of 'program' as a T. Constants are kept
+// as doubles, which is exact for double and float. Types with more
+// precision use the value compileTokens() read from the literal as written,
+// the same as evaluatePostfix() does (e.g. "0.1" is exactly 0.1 as a
+// Decimal).
+
+template <class T>
+inline T constantValue(const Program& program, int index)
+{
+    return NumericTraits<T>::fromDouble(program.constants[index]);
+}
+
+template <>
+inline long double constantValue<long double>(const Program& program, int index)
+{
+    return program.wideConstants[index];
+}
+
+template <>
+inline Decimal constantValue<Decimal>(const Program& program, int index)
+{
+    return program.decimalConstants[index];
+}
+
+// Evaluates 'program' with the given input values (one per variable slot)
+// and saves the result in 'result'. The arithmetic is done in T through
+// NumericTraits<T>, so this works for every type evaluatePostfix() does.
+// If 'diagnostic' is given, divisions are checked for a zero divisor, and
+// the first one makes the function return false with the instruction's
+// index as the token; 'result' still gets the IEEE value. Without a
+// diagnostic nothing is checked and the function always returns true.
+
+template <class T>
+bool evaluateProgram(const Program& program, const T* inputs, T& result,
+    Diagnostic* diagnostic = NULL)
+{
+    typedef NumericTraits<T> Traits;
+
+    // Small programs use an array on the call stack, larger ones allocate
+    T local[32];
+    T* stack = (program.maxDepth <= 32) ? local : new T[program.maxDepth];
+    int top = -1;
+    bool valid = true;
+
+    for (int i = 0; i < program.code.getSize(); i++)
+    {
+        const Instruction& instruction = program.code[i];
+        switch (instruction.opcode)
+        {
+            case OP_CONSTANT:
+                stack[++top] = constantValue<T>(program, instruction.operand);
+                break;
+            case OP_VARIABLE:
+                stack[++top] = inputs[instruction.operand];
+                break;
+            case OP_ARGUMENT:
+                stack[top + 1] = stack[instruction.operand];
+                top++;
+                break;
+            case OP_RETURN:
+                stack[top - instruction.operand] = stack[top];
+                top -= instruction.operand;
+                break;
+            case OP_ADD:
+                top--;
+                stack[top] = Traits::add(stack[top], stack[top + 1]);
+                break;
+            case OP_SUBTRACT:
+                top--;
+                stack[top] = Traits::subtract(stack[top], stack[top + 1]);
+                break;
+            case OP_MULTIPLY:
+                top--;
+                stack[top] = Traits::multiply(stack[top], stack[top + 1]);
+                break;
+            case OP_DIVIDE:
+                top--;
+                if (diagnostic != NULL && valid && Traits::truth(stack[top + 1]) == 0)
+                    valid = report(diagnostic, ERROR_DIVISION_BY_ZERO, i);
+                stack[top] = Traits::divide(stack[top], stack[top + 1]);
+                break;
+            case OP_MIN:
+                top--;
+                stack[top] = Traits::minimum(stack[top], stack[top + 1]);
+                break;
+            case OP_MAX:
+                top--;
+                stack[top] = Traits::maximum(stack[top], stack[top + 1]);
+                break;
+            case OP_SIN:
+                stack[top] = Traits::sine(stack[top]);
+                break;
+            case OP_COS:
+                stack[top] = Traits::cosine(stack[top]);
+                break;
+            case OP_TAN:
+                stack[top] = Traits::tangent(stack[top]);
+                break;
+            case OP_LESS:
+                top--;
+                stack[top] = Traits::less(stack[top], stack[top + 1]);
+                break;
+            case OP_LESS_EQUAL:
+                top--;
+                stack[top] = Traits::lessEqual(stack[top], stack[top + 1]);
+                break;
+            case OP_GREATER:
+                top--;
+                stack[top] = Traits::greater(stack[top], stack[top + 1]);
+                break;
+            case OP_GREATER_EQUAL:
+                top--;
+                stack[top] = Traits::greaterEqual(stack[top], stack[top + 1]);
+                break;
+            case OP_EQUAL:
+                top--;
+                stack[top] = Traits::equal(stack[top], stack[top + 1]);
+                break;
+            case OP_NOT_EQUAL:
+                top--;
+                stack[top] = Traits::notEqual(stack[top], stack[top + 1]);
+                break;
+            case OP_AND:
+                top--;
+                stack[top] = Traits::logicalAnd(stack[top], stack[top + 1]);
+                break;
+            case OP_OR:
+                top--;
+                stack[top] = Traits::logicalOr(stack[top], stack[top + 1]);
+                break;
+            case OP_SELECT:
+                top -= 2;
+                stack[top] = Traits::select(stack[top], stack[top + 1], stack[top + 2]);
+                break;
+            case OP_MULTIPLY_ADD:
+                top -= 2;
+                stack[top] = Traits::add(stack[top],
+                    Traits::multiply(stack[top + 1], stack[top + 2]));
+                break;
+            case OP_SCALE_VARIABLE:
+                stack[++top] = Traits::multiply(inputs[instruction.operand & 0xffff],
+                    constantValue<T>(program, instruction.operand >> 16));
+                break;
+            // A truth of -1 (not known, for intervals) never skips
+            case OP_SKIP_IF_FALSE:
+            case OP_SKIP_IF_TRUE:
+            case OP_SKIP_ELSE:
+            {
+                int wanted = (instruction.opcode == OP_SKIP_IF_FALSE) ? 0 : 1;
+                int tested = (instruction.opcode == OP_SKIP_ELSE) ? top - 1 : top;
+                if (Traits::truth(stack[tested]) == wanted)
+                {
+                    stack[top + 1] = stack[top];
+                    top++;
+                    i += instruction.operand - 1;
+                }
+                break;
+            }
+        }
+    }
+
+    // A compiled program always leaves exactly one value
+    if (top == 0)
+        result = stack[0];
+
+    if (stack != local)
+        delete[] stack;
+    return valid;
+}
+
+// Checks the rows of one batch that may have failed: those in which a
+// division had a zero divisor ('zero'), and in strict mode those whose
+// result is not finite. The batch evaluated every operand of every
+// conditional, so each such row is evaluated again on its own with
+// evaluateProgram(), which only sees the divisions the row really uses.
+
+inline void checkBatchRows(const Program& program,
+    const Vector<const double*>& columns, size_t first, int lanes,
+    const double* out, const unsigned char* zero, BatchErrors& errors,
+    size_t rowOffset)
+{
+    // One pass without branches decides whether anything needs a look
+    int strict = errors.strict ? 1 : 0;
+    int suspect = 0;
+    for (int r = 0; r < lanes; r++)
+        suspect |= zero[r] | (strict & (out[r] - out[r] != 0));
+    if (suspect == 0)
+        return;
+
+    Vector<double> inputs(program.variables.getSize());
+    for (int r = 0; r < lanes; r++)
+    {
+        bool finite = (out[r] - out[r] == 0);
+        if (!zero[r] && (finite || !errors.strict))
+            continue;
+
+        for (int j = 0; j < inputs.getSize(); j++)
+            inputs[j] = columns[j][first + r];
+
+        double value = 0;
+        Diagnostic diagnostic;
+        if (!evaluateProgram(program, (inputs.getSize() > 0) ? &inputs[0] : NULL,
+            value, &diagnostic))
+            addRowError(errors, rowOffset + first + r, ERROR_DIVISION_BY_ZERO);
+        else if (!finite && errors.strict)
+            addRowError(errors, rowOffset + first + r, ERROR_NOT_FINITE);
+    }
+}
+
+// Evaluates 'program' for 'rows' rows of columnar input. 'columns' holds one
+// array per variable slot, each with 'rows' values, and one result per row
+// is written to 'out'. Rows are processed BATCH_SIZE at a time, one
+// instruction at a time over the whole batch, so the inner loops are simple
+// enough for the compiler to vectorize.
+// If 'errors' is given, rows that divide by zero (and in strict mode, rows
+// with a NaN or infinite result) are added to it, numbered from
+// 'rowOffset'. The checks are extra loops over each batch, without branches
+// per row, and failed rows still get their IEEE result in 'out'.
+
+inline void evaluateProgramBatch(const Program& program,
+    const Vector<const double*>& columns, size_t rows, double* out,
+    BatchErrors* errors = NULL, size_t rowOffset = 0)
+{
+    // One BATCH_SIZE-wide register per stack level
+    double* registers = new double[program.maxDepth * BATCH_SIZE];
+
+    // Lanes of the current batch in which a division had a zero divisor
+    unsigned char zero[BATCH_SIZE];
+
+    for (size_t first = 0; first < rows; first += BATCH_SIZE)
+    {
+        int lanes = (rows - first < (size_t) BATCH_SIZE) ? (int) (rows - first) : BATCH_SIZE;
+        int top   = -1;
+
+        if (errors != NULL)
+            memset(zero, 0, sizeof(zero));
+
+        for (int i = 0; i < program.code.getSize(); i++)
+        {
+            const Instruction& instruction = program.code[i];
+
+            // Every row evaluates both sides of a conditional
+            if (isSkip(instruction))
+                continue;
+
+            // 'a' is the register written to, 'b' and 'c' the ones above it
+            int count = operandCount(instruction);
+            top = top - count + 1;
+            double* a       = registers + top * BATCH_SIZE;
+            const double* b = a + BATCH_SIZE;
+            const double* c = b + BATCH_SIZE;
+
+            switch (instruction.opcode)
+            {
+                case OP_CONSTANT:
+                {
+                    double value = program.constants[instruction.operand];
+                    for (int r = 0; r < lanes; r++) a[r] = value;
+                    break;
+                }
+                case OP_VARIABLE:
+                {
+                    const double* column = columns[instruction.operand] + first;
+                    for (int r = 0; r < lanes; r++) a[r] = column[r];
+                    break;
+                }
+                case OP_ARGUMENT:
+                {
+                    const double* argument = registers + instruction.operand * BATCH_SIZE;
+                    for (int r = 0; r < lanes; r++) a[r] = argument[r];
+                    break;
+                }
+                case OP_RETURN:
+                {
+                    const double* value = registers + (top + count - 1) * BATCH_SIZE;
+                    for (int r = 0; r < lanes; r++) a[r] = value[r];
+                    break;
+                }
+                case OP_ADD:
+                    for (int r = 0; r < lanes; r++) a[r] = a[r] + b[r];
+                    break;
+                case OP_SUBTRACT:
+                    for (int r = 0; r < lanes; r++) a[r] = a[r] - b[r];
+                    break;
+                case OP_MULTIPLY:
+                    for (int r = 0; r < lanes; r++) a[r] = a[r] * b[r];
+                    break;
+                case OP_DIVIDE:
+                    if (errors != NULL)
+                    {
+                        for (int r = 0; r < lanes; r++) zero[r] |= (b[r] == 0);
+                    }
+                    for (int r = 0; r < lanes; r++) a[r] = a[r] / b[r];
+                    break;
+                case OP_MIN:
+                    for (int r = 0; r < lanes; r++) a[r] = selectMinimum(a[r], b[r]);
+                    break;
+                case OP_MAX:
+                    for (int r = 0; r < lanes; r++) a[r] = selectMaximum(a[r], b[r]);
+                    break;
+                case OP_SIN:
+                    for (int r = 0; r < lanes; r++) a[r] = sin(a[r]);
+                    break;
+                case OP_COS:
+                    for (int r = 0; r < lanes; r++) a[r] = cos(a[r]);
+                    break;
+                case OP_TAN:
+                    for (int r = 0; r < lanes; r++) a[r] = tan(a[r]);
+                    break;
+                // Comparisons and selects are written as blends, which the
+                // compiler turns into compare and mask instructions
+                case OP_LESS:
+                    for (int r = 0; r < lanes; r++) a[r] = (a[r] < b[r]) ? 1.0 : 0.0;
+                    break;
+                case OP_LESS_EQUAL:
+                    for (int r = 0; r < lanes; r++) a[r] = (a[r] <= b[r]) ? 1.0 : 0.0;
+                    break;
+                case OP_GREATER:
+                    for (int r = 0; r < lanes; r++) a[r] = (a[r] > b[r]) ? 1.0 : 0.0;
+                    break;
+                case OP_GREATER_EQUAL:
+                    for (int r = 0; r < lanes; r++) a[r] = (a[r] >= b[r]) ? 1.0 : 0.0;
+                    break;
+                case OP_EQUAL:
+                    for (int r = 0; r < lanes; r++) a[r] = (a[r] == b[r]) ? 1.0 : 0.0;
+                    break;
+                case OP_NOT_EQUAL:
+                    for (int r = 0; r < lanes; r++) a[r] = (a[r] != b[r]) ? 1.0 : 0.0;
+                    break;
+                case OP_AND:
+                    for (int r = 0; r < lanes; r++)
+                        a[r] = ((a[r] != 0) & (b[r] != 0)) ? 1.0 : 0.0;
+                    break;
+                case OP_OR:
+                    for (int r = 0; r < lanes; r++)
+                        a[r] = ((a[r] != 0) | (b[r] != 0)) ? 1.0 : 0.0;
+                    break;
+                case OP_SELECT:
+                    for (int r = 0; r < lanes; r++) a[r] = (a[r] != 0) ? b[r] : c[r];
+                    break;
+                case OP_MULTIPLY_ADD:
+                    for (int r = 0; r < lanes; r++) a[r] = a[r] + b[r] * c[r];
+                    break;
+                case OP_SCALE_VARIABLE:
+                {
+                    const double* column = columns[instruction.operand & 0xffff] + first;
+                    double value = program.constants[instruction.operand >> 16];
+                    for (int r = 0; r < lanes; r++) a[r] = column[r] * value;
+                    break;
+                }
+            }
+        }
+
+        for (int r = 0; r < lanes; r++)
+            out[first + r] = registers[r];
+
+        if (errors != NULL)
+            checkBatchRows(program, columns, first, lanes, out + first, zero,
+                *errors, rowOffset);
+    }
+
+    delete[] registers;
+}
+
+#endif
@@ -0,0 +1,584 @@
+#ifndef REGISTER_MACHINE_H
+#define REGISTER_MACHINE_H
+
+// Necessary for the math functions
+#include <cmath>
+#include <string>
+#include "Vector.h"
+#include "Map.h"
+#include "Program.h"
+#include "Diagnostics.h"
+using namespace std;
+
+// A register-based form of a compiled Program, for evaluating one row at a
+// time as fast as possible.
+//
+// The stack code of a Program pushes every operand before it is used, so
+// "x * 2 + y" is five instructions that each read and write the stack. Here
+// each instruction names where its operands come from and where its result
+// goes, and variables and constants can be used directly as operands:
+//
+//     stack code                 register code
+//     VARIABLE x                 r0 = x * 2    (MULTIPLY_VARIABLE_CONSTANT)
+//     CONSTANT 2                 r0 = r0 + y   (ADD_VARIABLE)
+//     MULTIPLY
+//     VARIABLE y
+//     ADD
+//
+// Registers are the stack positions of the Program, so a value stays in the
+// register its stack slot would have had. Loads of variables and constants
+// are put off until an instruction needs the value in a register, and +, -,
+// * and / take a register, variable or constant as operands (see
+// RegisterOpcode). A multiply whose result is added right away becomes one
+// MULTIPLY_ADD. It is still rounded as a multiply and an add, as long as
+// the compiler does not contract the two into a fused multiply-add (the
+// build passes -ffp-contract=off), so the results are bit for bit those of
+// evaluateProgram().
+//
+// Conditionals keep their short-circuit jumps. evaluateRegisterProgram()
+// dispatches with computed gotos (a table of label addresses, one indirect
+// jump per instruction) when compiled with GCC or Clang, and with a switch
+// otherwise.
+
+enum RegisterOpcode
+{
+    REG_END,           // stop; the result is in r0
+    REG_LOAD_CONSTANT, // r[target] = constants[left]
+    REG_LOAD_VARIABLE, // r[target] = inputs[left]
+    REG_MOVE,          // r[target] = r[left]
+
+    // Every arithmetic operator comes in five forms, in this order:
+    //   r[target] = r[left]      op r[right]
+    //   r[target] = r[left]      op inputs[right]
+    //   r[target] = r[left]      op constants[right]
+    //   r[target] = inputs[left] op inputs[right]
+    //   r[target] = inputs[left] op constants[right]
+    REG_ADD,
+    REG_ADD_VARIABLE,
+    REG_ADD_CONSTANT,
+    REG_ADD_VARIABLES,
+    REG_ADD_VARIABLE_CONSTANT,
+    REG_SUBTRACT,
+    REG_SUBTRACT_VARIABLE,
+    REG_SUBTRACT_CONSTANT,
+    REG_SUBTRACT_VARIABLES,
+    REG_SUBTRACT_VARIABLE_CONSTANT,
+    REG_MULTIPLY,
+    REG_MULTIPLY_VARIABLE,
+    REG_MULTIPLY_CONSTANT,
+    REG_MULTIPLY_VARIABLES,
+    REG_MULTIPLY_VARIABLE_CONSTANT,
+    REG_DIVIDE,
+    REG_DIVIDE_VARIABLE,
+    REG_DIVIDE_CONSTANT,
+    REG_DIVIDE_VARIABLES,
+    REG_DIVIDE_VARIABLE_CONSTANT,
+
+    REG_MULTIPLY_ADD,  // r[target] = r[target] + r[left] * r[right]
+    REG_MIN,           // the rest are r[target] = f(r[left], r[right])
+    REG_MAX,
+    REG_SIN,
+    REG_COS,
+    REG_TAN,
+    REG_LESS,
+    REG_LESS_EQUAL,
+    REG_GREATER,
+    REG_GREATER_EQUAL,
+    REG_EQUAL,
+    REG_NOT_EQUAL,
+    REG_AND,
+    REG_OR,
+    REG_SELECT,        // r[target] = r[target] != 0 ? r[left] : r[right]
+
+    // Jumps 'right' instructions forward if r[left] is false (true), after
+    // filling r[target], the register of the skipped operand, with
+    // r[target - 1], as the skips of a Program do
+    REG_JUMP_IF_FALSE,
+    REG_JUMP_IF_TRUE,
+    REG_OPCODE_COUNT
+};
+
+// Forms of the arithmetic operators, added to REG_ADD etc.
+enum OperandForm
+{
+    FORM_REGISTERS,
+    FORM_VARIABLE,
+    FORM_CONSTANT,
+    FORM_VARIABLES,
+    FORM_VARIABLE_CONSTANT
+};
+
+struct RegisterInstruction
+{
+    unsigned short opcode;
+    unsigned short target; // register written
+    int left;              // register, variable slot or constant index
+    int right;             // register, variable slot, constant index or jump
+};
+
+struct RegisterProgram
+{
+    Vector<RegisterInstruction> code;
+    Vector<double> constants;
+    // Name of each variable slot, the same as in the Program
+    Vector<string> variables;
+    // Number of registers used
+    int registers;
+};
+
+// ----------------------------------------------------//
+
+// Where the value of a stack slot is while translating: already in its
+// register, or still a variable or constant that has not been loaded.
+enum SlotKind
+{
+    SLOT_REGISTER,
+    SLOT_VARIABLE,
+    SLOT_CONSTANT
+};
+
+struct PendingSlot
+{
+    int kind;  // a SlotKind
+    int index; // variable slot or constant index
+};
+
+inline void emitRegister(RegisterProgram& out, int opcode, int target, int left,
+    int right)
+{
+    RegisterInstruction instruction;
+    instruction.opcode = (unsigned short) opcode;
+    instruction.target = (unsigned short) target;
+    instruction.left   = left;
+    instruction.right  = right;
+    out.code.pushBack(instruction);
+}
+
+// Loads stack slot 'slot' into its register if it is not there yet.
+
+inline void materialize(RegisterProgram& out, Vector<PendingSlot>& slots, int slot)
+{
+    if (slots[slot].kind == SLOT_VARIABLE)
+        emitRegister(out, REG_LOAD_VARIABLE, slot, slots[slot].index, 0);
+    else if (slots[slot].kind == SLOT_CONSTANT)
+        emitRegister(out, REG_LOAD_CONSTANT, slot, slots[slot].index, 0);
+    slots[slot].kind = SLOT_REGISTER;
+}
+
+// Returns the register opcode for a comparison, logic or function opcode of
+// a Program, or -1.
+
+inline int registerOpcode(int opcode)
+{
+    switch (opcode)
+    {
+        case OP_MIN:           return REG_MIN;
+        case OP_MAX:           return REG_MAX;
+        case OP_SIN:           return REG_SIN;
+        case OP_COS:           return REG_COS;
+        case OP_TAN:           return REG_TAN;
+        case OP_LESS:          return REG_LESS;
+        case OP_LESS_EQUAL:    return REG_LESS_EQUAL;
+        case OP_GREATER:       return REG_GREATER;
+        case OP_GREATER_EQUAL: return REG_GREATER_EQUAL;
+        case OP_EQUAL:         return REG_EQUAL;
+        case OP_NOT_EQUAL:     return REG_NOT_EQUAL;
+        case OP_AND:           return REG_AND;
+        case OP_OR:            return REG_OR;
+        case OP_SELECT:        return REG_SELECT;
+        default:               return -1;
+    }
+}
+
+// Emits 'a op b' into the register of slot 'a', using the form that reads
+// the operands where they are. + and * are commutative (bit for bit in
+// IEEE arithmetic), so their operands may be swapped to find a form.
+// 'fusable' is the index of the last instruction if a MULTIPLY_ADD may
+// replace it, -1 otherwise.
+
+inline void emitArithmetic(RegisterProgram& out, Vector<PendingSlot>& slots,
+    int base, int a, int b, int fusable)
+{
+    bool commutative = (base == REG_ADD || base == REG_MULTIPLY);
+    PendingSlot left  = slots[a];
+    PendingSlot right = slots[b];
+
+    // Put a register or variable on the left where the operator allows it
+    if (commutative && left.kind != SLOT_REGISTER && right.kind == SLOT_REGISTER)
+    {
+        PendingSlot swap = left; left = right; right = swap;
+        left.index = b;
+    }
+    else if (commutative && left.kind == SLOT_CONSTANT && right.kind == SLOT_VARIABLE)
+    {
+        PendingSlot swap = left; left = right; right = swap;
+    }
+    else if (left.kind == SLOT_REGISTER)
+        left.index = a;
+
+    // A constant on the left, or a variable with a register on the right,
+    // has no form of its own
+    if (left.kind == SLOT_CONSTANT ||
+        (left.kind == SLOT_VARIABLE && right.kind == SLOT_REGISTER))
+    {
+        materialize(out, slots, a);
+        left.kind  = SLOT_REGISTER;
+        left.index = a;
+        fusable = -1;
+    }
+    if (right.kind == SLOT_REGISTER)
+        right.index = b;
+
+    int form = FORM_REGISTERS;
+    if (left.kind == SLOT_REGISTER)
+        form = (right.kind == SLOT_VARIABLE) ? FORM_VARIABLE :
+               (right.kind == SLOT_CONSTANT) ? FORM_CONSTANT : FORM_REGISTERS;
+    else
+        form = (right.kind == SLOT_VARIABLE) ? FORM_VARIABLES : FORM_VARIABLE_CONSTANT;
+
+    // c + a * b, with the product computed just before into b's register
+    if (base == REG_ADD && form == FORM_REGISTERS && fusable >= 0 &&
+        fusable == out.code.getSize() - 1 && left.index == a &&
+        out.code[fusable].opcode == REG_MULTIPLY && out.code[fusable].target == b)
+    {
+        out.code[fusable].opcode = REG_MULTIPLY_ADD;
+        out.code[fusable].target = (unsigned short) a;
+    }
+    else
+        emitRegister(out, base + form, a, left.index, right.index);
+
+    slots[a].kind = SLOT_REGISTER;
+}
+
+// Translates the stack code of 'program' (as compiled, or specialized by
+// specializeProgram()) into register code. Returns false if the program
+// needs more registers than an instruction can name.
+
+inline bool compileRegisterProgram(const Program& program, RegisterProgram& out)
+{
+    out.code.clear();
+    out.constants  = program.constants;
+    out.variables  = program.variables;
+    out.registers  = (program.maxDepth > 0) ? program.maxDepth : 1;
+    if (program.maxDepth > 0xffff)
+        return false;
+
+    int length = program.code.getSize();
+
+    // Instructions that skips jump to, and where each went
+    Vector<bool> targets(length + 1);
+    for (int i = 0; i <= length; i++)
+        targets[i] = false;
+    for (int i = 0; i < length; i++)
+    {
+        if (isSkip(program.code[i]))
+            targets[i + program.code[i].operand] = true;
+    }
+    Vector<int> moved(length + 1);
+    Vector<int> jumps;
+
+    Vector<PendingSlot> slots(out.registers + 1);
+    int top = -1;
+    int fusable = -1;
+
+    for (int i = 0; i < length; i++)
+    {
+        const Instruction& instruction = program.code[i];
+
+        // Both paths have to arrive with every value in its register. The
+        // loads belong to the path that falls through, so the jump lands
+        // after them.
+        if (targets[i])
+        {
+            for (int k = 0; k <= top; k++)
+                materialize(out, slots, k);
+            fusable = -1;
+        }
+        moved[i] = out.code.getSize();
+
+        int count = operandCount(instruction);
+        int a = top - count + 1;
+        int opcode = instruction.opcode;
+        int last = -1;
+
+        switch (opcode)
+        {
+            case OP_CONSTANT:
+            case OP_VARIABLE:
+                top++;
+                slots[top].kind  = (opcode == OP_CONSTANT) ? SLOT_CONSTANT : SLOT_VARIABLE;
+                slots[top].index = instruction.operand;
+                break;
+            case OP_ARGUMENT:
+            case OP_RETURN:
+            {
+                // A pending value is simply copied along
+                int from = (opcode == OP_ARGUMENT) ? instruction.operand : top;
+                if (slots[from].kind == SLOT_REGISTER)
+                    emitRegister(out, REG_MOVE, a, from, 0);
+                slots[a] = slots[from];
+                top = a;
+                break;
+            }
+            case OP_SCALE_VARIABLE:
+                top++;
+                emitRegister(out, REG_MULTIPLY_VARIABLE_CONSTANT, top,
+                    instruction.operand & 0xffff, instruction.operand >> 16);
+                slots[top].kind = SLOT_REGISTER;
+                break;
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+            {
+                int base = (opcode == OP_ADD)      ? REG_ADD :
+                           (opcode == OP_SUBTRACT) ? REG_SUBTRACT :
+                           (opcode == OP_MULTIPLY) ? REG_MULTIPLY : REG_DIVIDE;
+                emitArithmetic(out, slots, base, a, a + 1, fusable);
+                if (out.code[out.code.getSize() - 1].opcode == REG_MULTIPLY)
+                    last = out.code.getSize() - 1;
+                top = a;
+                break;
+            }
+            case OP_MULTIPLY_ADD:
+                for (int k = a; k <= top; k++)
+                    materialize(out, slots, k);
+                emitRegister(out, REG_MULTIPLY_ADD, a, a + 1, a + 2);
+                top = a;
+                break;
+            case OP_SKIP_IF_FALSE:
+            case OP_SKIP_IF_TRUE:
+            case OP_SKIP_ELSE:
+            {
+                for (int k = 0; k <= top; k++)
+                    materialize(out, slots, k);
+                int tested = (opcode == OP_SKIP_ELSE) ? top - 1 : top;
+                int jump   = (opcode == OP_SKIP_IF_FALSE) ? REG_JUMP_IF_FALSE : REG_JUMP_IF_TRUE;
+                jumps.pushBack(out.code.getSize());
+                emitRegister(out, jump, top + 1, tested, i + instruction.operand);
+                break;
+            }
+            default:
+                for (int k = a; k <= top; k++)
+                    materialize(out, slots, k);
+                // SELECT keeps its condition in the target register
+                if (count == 3)
+                    emitRegister(out, registerOpcode(opcode), a, a + 1, a + 2);
+                else
+                    emitRegister(out, registerOpcode(opcode), a, a, a + 1);
+                top = a;
+                break;
+        }
+        fusable = last;
+    }
+    moved[length] = out.code.getSize();
+
+    if (top >= 0)
+        materialize(out, slots, 0);
+    emitRegister(out, REG_END, 0, 0, 0);
+
+    // Jumps were given the stack code index they go to
+    for (int k = 0; k < jumps.getSize(); k++)
+    {
+        RegisterInstruction& jump = out.code[jumps[k]];
+        jump.right = moved[jump.right] - jumps[k];
+    }
+
+    out.code.shrinkToFit();
+    return true;
+}
+
+// Compiles the output of shuntingYard() straight into register code. See
+// compileProgram() for 'functions' and 'diagnostic'.
+
+inline bool compileRegisterProgram(const Vector<string>& postfix,
+    const Map<string, Function>& functions, RegisterProgram& out,
+    Diagnostic* diagnostic = NULL)
+{
+    Program program;
+    return compileProgram(postfix, functions, program, diagnostic) &&
+           compileRegisterProgram(program, out);
+}
+
+// Looks up every variable the program uses and stores its value in
+// 'inputs', indexed by slot. Returns false if a variable is not in the map.
+
+template <template <class, class> class M, class V>
+bool bindVariables(const RegisterProgram& program, const M<string, V>& variables,
+    Vector<double>& inputs)
+{
+    inputs.resize(program.variables.getSize());
+    for (int i = 0; i < program.variables.getSize(); i++)
+    {
+        V stored = V();
+        if (!variables.search(program.variables[i], stored))
+            return false;
+        loadVariable(stored, inputs[i]);
+    }
+    return true;
+}
+
+// ----------------------------------------------------//
+
+#if defined(__GNUC__) && !defined(CALCULATOR_SWITCH_DISPATCH)
+#define REGISTER_COMPUTED_GOTO
+#endif
+
+// Evaluates 'program' with the given input values (one per variable slot)
+// and saves the result in 'result'. Gives the same results as
+// evaluateProgram<double>() on the Program it was made from.
+
+inline void evaluateRegisterProgram(const RegisterProgram& program,
+    const double* inputs, double& result)
+{
+    // Small programs use an array on the call stack, larger ones allocate
+    double local[32];
+    double* r = (program.registers <= 32) ? local : new double[program.registers];
+    const double* k = (program.constants.getSize() > 0) ? &program.constants[0] : NULL;
+    const RegisterInstruction* code = &program.code[0];
+    const RegisterInstruction* instruction = code;
+
+#ifdef REGISTER_COMPUTED_GOTO
+    // In RegisterOpcode order
+    static const void* labels[] =
+    {
+        &&do_REG_END, &&do_REG_LOAD_CONSTANT, &&do_REG_LOAD_VARIABLE, &&do_REG_MOVE,
+        &&do_REG_ADD, &&do_REG_ADD_VARIABLE, &&do_REG_ADD_CONSTANT,
+        &&do_REG_ADD_VARIABLES, &&do_REG_ADD_VARIABLE_CONSTANT,
+        &&do_REG_SUBTRACT, &&do_REG_SUBTRACT_VARIABLE, &&do_REG_SUBTRACT_CONSTANT,
+        &&do_REG_SUBTRACT_VARIABLES, &&do_REG_SUBTRACT_VARIABLE_CONSTANT,
+        &&do_REG_MULTIPLY, &&do_REG_MULTIPLY_VARIABLE, &&do_REG_MULTIPLY_CONSTANT,
+        &&do_REG_MULTIPLY_VARIABLES, &&do_REG_MULTIPLY_VARIABLE_CONSTANT,
+        &&do_REG_DIVIDE, &&do_REG_DIVIDE_VARIABLE, &&do_REG_DIVIDE_CONSTANT,
+        &&do_REG_DIVIDE_VARIABLES, &&do_REG_DIVIDE_VARIABLE_CONSTANT,
+        &&do_REG_MULTIPLY_ADD, &&do_REG_MIN, &&do_REG_MAX,
+        &&do_REG_SIN, &&do_REG_COS, &&do_REG_TAN,
+        &&do_REG_LESS, &&do_REG_LESS_EQUAL, &&do_REG_GREATER,
+        &&do_REG_GREATER_EQUAL, &&do_REG_EQUAL, &&do_REG_NOT_EQUAL,
+        &&do_REG_AND, &&do_REG_OR, &&do_REG_SELECT,
+        &&do_REG_JUMP_IF_FALSE, &&do_REG_JUMP_IF_TRUE
+    };
+    static_assert(sizeof(labels) / sizeof(labels[0]) == REG_OPCODE_COUNT,
+        "labels must list every RegisterOpcode");
+
+#define VM_CASE(op) do_##op:
+#define VM_NEXT     instruction++; goto *labels[instruction->opcode]
+    goto *labels[instruction->opcode];
+#else
+#define VM_CASE(op) case op:
+#define VM_NEXT     instruction++; continue
+    for (;;)
+    switch (instruction->opcode)
+#endif
+    {
+        VM_CASE(REG_END)
+            goto done;
+        VM_CASE(REG_LOAD_CONSTANT)
+            r[instruction->target] = k[instruction->left];
+            VM_NEXT;
+        VM_CASE(REG_LOAD_VARIABLE)
+            r[instruction->target] = inputs[instruction->left];
+            VM_NEXT;
+        VM_CASE(REG_MOVE)
+            r[instruction->target] = r[instruction->left];
+            VM_NEXT;
+
+#define VM_ARITHMETIC(name, op) \
+        VM_CASE(name) \
+            r[instruction->target] = r[instruction->left] op r[instruction->right]; \
+            VM_NEXT; \
+        VM_CASE(name##_VARIABLE) \
+            r[instruction->target] = r[instruction->left] op inputs[instruction->right]; \
+            VM_NEXT; \
+        VM_CASE(name##_CONSTANT) \
+            r[instruction->target] = r[instruction->left] op k[instruction->right]; \
+            VM_NEXT; \
+        VM_CASE(name##_VARIABLES) \
+            r[instruction->target] = inputs[instruction->left] op inputs[instruction->right]; \
+            VM_NEXT; \
+        VM_CASE(name##_VARIABLE_CONSTANT) \
+            r[instruction->target] = inputs[instruction->left] op k[instruction->right]; \
+            VM_NEXT;
+
+        VM_ARITHMETIC(REG_ADD, +)
+        VM_ARITHMETIC(REG_SUBTRACT, -)
+        VM_ARITHMETIC(REG_MULTIPLY, *)
+        VM_ARITHMETIC(REG_DIVIDE, /)
+#undef VM_ARITHMETIC
+
+        VM_CASE(REG_MULTIPLY_ADD)
+        {
+            double product = r[instruction->left] * r[instruction->right];
+            r[instruction->target] = r[instruction->target] + product;
+            VM_NEXT;
+        }
+        VM_CASE(REG_MIN)
+            r[instruction->target] = selectMinimum(r[instruction->left], r[instruction->right]);
+            VM_NEXT;
+        VM_CASE(REG_MAX)
+            r[instruction->target] = selectMaximum(r[instruction->left], r[instruction->right]);
+            VM_NEXT;
+        VM_CASE(REG_SIN)
+            r[instruction->target] = sin(r[instruction->left]);
+            VM_NEXT;
+        VM_CASE(REG_COS)
+            r[instruction->target] = cos(r[instruction->left]);
+            VM_NEXT;
+        VM_CASE(REG_TAN)
+            r[instruction->target] = tan(r[instruction->left]);
+            VM_NEXT;
+        VM_CASE(REG_LESS)
+            r[instruction->target] = (r[instruction->left] < r[instruction->right]) ? 1 : 0;
+            VM_NEXT;
+        VM_CASE(REG_LESS_EQUAL)
+            r[instruction->target] = (r[instruction->left] <= r[instruction->right]) ? 1 : 0;
+            VM_NEXT;
+        VM_CASE(REG_GREATER)
+            r[instruction->target] = (r[instruction->left] > r[instruction->right]) ? 1 : 0;
+            VM_NEXT;
+        VM_CASE(REG_GREATER_EQUAL)
+            r[instruction->target] = (r[instruction->left] >= r[instruction->right]) ? 1 : 0;
+            VM_NEXT;
+        VM_CASE(REG_EQUAL)
+            r[instruction->target] = (r[instruction->left] == r[instruction->right]) ? 1 : 0;
+            VM_NEXT;
+        VM_CASE(REG_NOT_EQUAL)
+            r[instruction->target] = (r[instruction->left] != r[instruction->right]) ? 1 : 0;
+            VM_NEXT;
+        VM_CASE(REG_AND)
+            r[instruction->target] =
+                (r[instruction->left] != 0 && r[instruction->right] != 0) ? 1 : 0;
+            VM_NEXT;
+        VM_CASE(REG_OR)
+            r[instruction->target] =
+                (r[instruction->left] != 0 || r[instruction->right] != 0) ? 1 : 0;
+            VM_NEXT;
+        VM_CASE(REG_SELECT)
+            r[instruction->target] = (r[instruction->target] != 0) ?
+                r[instruction->left] : r[instruction->right];
+            VM_NEXT;
+        VM_CASE(REG_JUMP_IF_FALSE)
+            if (r[instruction->left] == 0)
+            {
+                r[instruction->target] = r[instruction->target - 1];
+                instruction += instruction->right - 1;
+            }
+            VM_NEXT;
+        VM_CASE(REG_JUMP_IF_TRUE)
+            if (r[instruction->left] != 0)
+            {
+                r[instruction->target] = r[instruction->target - 1];
+                instruction += instruction->right - 1;
+            }
+            VM_NEXT;
+    }
+#undef VM_CASE
+#undef VM_NEXT
+
+done:
+    result = r[0];
+    if (r != local)
+        delete[] r;
+}
+
+#endif
@@ -3,12 +3,17 @@
 
 // Necessary for print()
 #include <iostream>
+// Necessary for move()
+#include <utility>
+#include "MemoryUsage.h"
 using namespace std;
 
 
 // This class implements a simple array-based stack.
 // All types that support assignment (=) and optionally
 // the stream insertion operator (<<) are supported.
+// The array doubles when it is full, so the stack holds as many values as
+// memory allows and pushing stays O(1) amortized.
 template <class T>
 class Stack
 {
@@ -31,6 +36,10 @@ public:
     
     int size() const;
     
+    // Memory accounting (see MemoryUsage.h)
+    size_t heapBytes() const;
+    size_t memoryUsage() const;
+    
 private:
     static const int DEFAULT_SIZE = 32;
     
@@ -68,7 +77,7 @@ Stack<T>::Stack(const Stack<T>& orig)
     mTop      = orig.mTop;
     
     // Copy the data over
-    for (int i = 0; i < mCapacity; ++i)
+    for (int i = 0; i <= mTop; ++i)
         mData[i] = orig.mData[i];
 }
 
@@ -85,17 +94,23 @@ Stack<T>::~Stack()
 template <class T>
 bool Stack<T>::push(const T& value)
 {    
-    // Ensure we're still in the array
-    if (mTop < mCapacity - 1)
+    // Make room by doubling the array, moving the values over
+    if (mTop >= mCapacity - 1)
     {
-        // Move top forward, and fill the cell
-        mTop++;
-        mData[mTop] = value;
-        return true;
+        int capacity = (mCapacity > 0) ? mCapacity * 2 : DEFAULT_SIZE;
+        T* data = new T[capacity];
+        for (int i = 0; i <= mTop; ++i)
+            data[i] = std::move(mData[i]);
+        
+        delete[] mData;
+        mData     = data;
+        mCapacity = capacity;
     }
     
-    // The stack must be full. Sorry. :-(
-    else return false;
+    // Move top forward, and fill the cell
+    mTop++;
+    mData[mTop] = value;
+    return true;
 }
 
 template <class T>
@@ -158,4 +173,26 @@ int Stack<T>::size() const
     return mTop + 1;
 }
 
+template <class T>
+size_t Stack<T>::heapBytes() const
+{
+    // The array itself, plus whatever the values on the stack own
+    size_t bytes = mCapacity * sizeof(T);
+    for (int i = 0; i <= mTop; ++i)
+        bytes += heapBytesOf(mData[i]);
+    return bytes;
+}
+
+template <class T>
+size_t Stack<T>::memoryUsage() const
+{
+    return sizeof(*this) + heapBytes();
+}
+
+template <class T>
+inline size_t heapBytesOf(const Stack<T>& value)
+{
+    return value.heapBytes();
+}
+
 #endif
\ No newline at end of file
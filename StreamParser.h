@@ -0,0 +1,576 @@
+#ifndef STREAM_PARSER_H
+#define STREAM_PARSER_H
+
+// Necessary for isspace()
+#include <cctype>
+#include <string>
+#include "Stack.h"
+#include "Vector.h"
+#include "Map.h"
+#include "Calculator.h"
+#include "Program.h"
+#include "Diagnostics.h"
+using namespace std;
+
+// An operator waiting on the operation stack of a StreamParser: what it is
+// (a PostfixOperator, STREAM_OPEN for "(" or STREAM_CALL for a user-defined
+// function, whose name is on a stack of its own), its precedence and its
+// index in the infix expression. A "(" also counts the commas inside it,
+// or holds -1 if it does not open the arguments of a call. Deep nesting
+// keeps millions of these.
+struct StreamOperator
+{
+    int symbol;
+    int level;
+    int position;
+    int commas;
+};
+
+const int STREAM_OPEN = -1;
+const int STREAM_CALL = -2;
+
+// The token of a PostfixOperator
+inline const string& operatorToken(int symbol)
+{
+    static const string tokens[] =
+    {
+        "", "min", "max", "sin", "cos", "tan", "+", "-", "*", "/", "<", "<=",
+        ">", ">=", "==", "!=", "and", "or", "if"
+    };
+    return tokens[symbol];
+}
+
+// shuntingYard() for input that arrives in pieces. push() takes the text
+// of an infix expression a chunk at a time, cut anywhere, even inside a
+// token. Every postfix token is handed to the sink as soon as it is known,
+// together with the index of the infix token it came from:
+//
+//     bool Sink::consume(const string& token, int origin);
+//
+// A sink that returns false stops the parser (and is expected to fill in
+// the diagnostic). StreamEvaluator below evaluates the tokens as they come,
+// so no stage ever holds the whole expression. The parser keeps only the
+// operation stack and the one token that may be cut by the end of a chunk,
+// and the evaluator only its value stack: memory grows with the nesting
+// depth of the expression, not its length.
+//
+// The postfix tokens, their origins and the errors are the same as those
+// of shuntingYard() on the same tokens, or of the shuntingYard() in
+// Program.h when 'functions' is given. Tokens are separated by whitespace,
+// as in the driver.
+template <class Sink>
+class StreamParser
+{
+public:
+    // 'first' is the index of the first token, for origins and errors.
+    // Calls to 'functions', if given, have to have one argument per
+    // parameter.
+    StreamParser(Sink& sink, Diagnostic* diagnostic = NULL, int first = 0,
+        const Map<string, Function>* functions = NULL);
+
+    // Parses the next 'size' characters. Returns false once the expression
+    // is known to be malformed, or the sink has stopped.
+    bool push(const char* data, int size);
+
+    // Ends the expression. Returns false if it is malformed.
+    bool finish();
+
+    // Number of infix tokens so far, and the text of the token at fault
+    // after a failure (empty if the sink failed)
+    int tokens() const;
+    const string& errorToken() const;
+
+    // Memory accounting (see MemoryUsage.h)
+    size_t heapBytes() const;
+
+private:
+    bool token(string& text);
+    bool resolvePending(bool call);
+    bool checkArity(const StreamOperator& open, int close);
+    bool emit(const string& text, int origin);
+    bool movePrecedence(int operation);
+    bool fail(int code, const string& text, int position);
+
+    Sink& mSink;
+    Diagnostic* mDiagnostic;
+
+    // The user-defined functions, and the number of parameters of each one
+    // called so far
+    const Map<string, Function>* mFunctions;
+    Map<string, int> mArities;
+
+    // The operation stack, and the names of the functions called on it
+    Stack<StreamOperator> mOperators;
+    Stack<string> mCalls;
+
+    // A token cut by the end of the last chunk
+    string mPartial;
+
+    // A name or number whose meaning depends on the next token: followed
+    // by "(" it is the name of a called function
+    string mPending;
+    bool mHasPending;
+    int mPendingPosition;
+
+    int mIndex;      // index of the next token
+    bool mFailed;
+    string mErrorToken;
+};
+
+template <class Sink>
+StreamParser<Sink>::StreamParser(Sink& sink, Diagnostic* diagnostic, int first,
+    const Map<string, Function>* functions) :
+    mSink(sink), mDiagnostic(diagnostic), mFunctions(functions),
+    mHasPending(false), mPendingPosition(0),
+    mIndex(first),
+    mFailed(false)
+{
+}
+
+template <class Sink>
+bool StreamParser<Sink>::push(const char* data, int size)
+{
+    int i = 0;
+    while (i < size && !mFailed)
+    {
+        // Skip whitespace, which ends the token cut by the last chunk
+        if (isspace((unsigned char) data[i]))
+        {
+            if (!mPartial.empty() && !token(mPartial))
+                return false;
+            mPartial.clear();
+            while (i < size && isspace((unsigned char) data[i]))
+                i++;
+            continue;
+        }
+
+        // Take a whole run of non-space characters at once
+        int start = i;
+        while (i < size && !isspace((unsigned char) data[i]))
+            i++;
+        mPartial.append(data + start, i - start);
+
+        // The token is complete unless the chunk ended inside it
+        if (i < size)
+        {
+            if (!token(mPartial))
+                return false;
+            mPartial.clear();
+        }
+    }
+    return !mFailed;
+}
+
+template <class Sink>
+bool StreamParser<Sink>::finish()
+{
+    if (mFailed)
+        return false;
+    if (!mPartial.empty() && !token(mPartial))
+        return false;
+    mPartial.clear();
+    if (mHasPending && !resolvePending(false))
+        return false;
+
+    // Push the final operators in the operation stack onto postfix
+    if (!movePrecedence(PRECEDENCE_OR))
+        return false;
+
+    // An unclosed "(" is left on top
+    StreamOperator open;
+    if (mOperators.top(open))
+        return fail(ERROR_MISMATCHED_PARENTHESES, "(", open.position);
+    return true;
+}
+
+template <class Sink>
+int StreamParser<Sink>::tokens() const
+{
+    return mIndex;
+}
+
+template <class Sink>
+const string& StreamParser<Sink>::errorToken() const
+{
+    return mErrorToken;
+}
+
+template <class Sink>
+size_t StreamParser<Sink>::heapBytes() const
+{
+    return mOperators.heapBytes() + mCalls.heapBytes() + mPartial.capacity() + 
+        mPending.capacity() + mArities.heapBytes();
+}
+
+// One infix token, handled as the body of the loop in shuntingYard(). The
+// text may be swapped away.
+
+template <class Sink>
+bool StreamParser<Sink>::token(string& text)
+{
+    int i = mIndex++;
+
+    // The previous token was a call if this one opens its arguments
+    int precedence = 0;
+    int kind = classifyToken(text, precedence);
+    if (mHasPending && !resolvePending(kind == TOKEN_OPEN))
+        return false;
+
+    StreamOperator entry;
+    switch (kind)
+    {
+        case TOKEN_OPEN:
+            // The "(" of a call comes right after the function
+            entry.commas   = (mOperators.top(entry) && entry.level == PRECEDENCE_FUNCTION &&
+                              entry.position == i - 1) ? 0 : -1;
+            entry.symbol   = STREAM_OPEN;
+            entry.level    = precedence;
+            entry.position = i;
+            mOperators.push(entry);
+            break;
+
+        case TOKEN_FUNCTION:
+            entry.symbol   = postfixOperator(text);
+            entry.level    = precedence;
+            entry.position = i;
+            entry.commas   = -1;
+            mOperators.push(entry);
+            break;
+
+        case TOKEN_CLOSE:
+            if (!movePrecedence(PRECEDENCE_OR))
+                return false;
+
+            // Error checking for missing parenthesis
+            if (!mOperators.top(entry) || entry.level != 0)
+                return fail(ERROR_MISMATCHED_PARENTHESES, text, i);
+            mOperators.pop(entry);
+            if (entry.commas >= 0 && !checkArity(entry, i))
+                return false;
+            break;
+
+        case TOKEN_COMMA:
+            // Finish the current argument, leaving the function's "("
+            if (!movePrecedence(PRECEDENCE_OR))
+                return false;
+
+            // Error checking for a comma outside of the parentheses of a call
+            if (!mOperators.pop(entry) || entry.level != 0 || entry.commas < 0)
+                return fail(ERROR_MISPLACED_COMMA, text, i);
+            entry.commas++;
+            mOperators.push(entry);
+            break;
+
+        case TOKEN_INFIX:
+            // All operators are left associative
+            if (!movePrecedence(precedence))
+                return false;
+            entry.symbol   = postfixOperator(text);
+            entry.level    = precedence;
+            entry.position = i;
+            entry.commas   = -1;
+            mOperators.push(entry);
+            break;
+
+        default:
+            // Wait for the next token to tell a value from a call
+            mPending.swap(text);
+            mHasPending = true;
+            mPendingPosition = i;
+            break;
+    }
+    return true;
+}
+
+// Decides what the waiting token is, now that the next one is known.
+
+template <class Sink>
+bool StreamParser<Sink>::resolvePending(bool call)
+{
+    mHasPending = false;
+    if (!call)
+        return emit(mPending, mPendingPosition);
+
+    // A call to a user-defined function
+    StreamOperator entry;
+    entry.symbol   = STREAM_CALL;
+    entry.level    = PRECEDENCE_FUNCTION;
+    entry.position = mPendingPosition;
+    entry.commas   = -1;
+    mOperators.push(entry);
+    mCalls.push(mPending);
+    return true;
+}
+
+// Checks the number of arguments of a call, 'open' being the "(" of the
+// call and 'close' the index of its ")". The function is the operator below
+// the "(".
+
+template <class Sink>
+bool StreamParser<Sink>::checkArity(const StreamOperator& open, int close)
+{
+    StreamOperator function = {0, 0, 0, -1};
+    string name;
+    mOperators.top(function);
+    if (function.symbol != STREAM_CALL)
+        name = operatorToken(function.symbol);
+    else
+        mCalls.top(name);
+
+    // "f ( )" has no arguments, otherwise there is one more than commas
+    int arguments = (close == open.position + 1) ? 0 : open.commas + 1;
+    int arity = builtinArity(name);
+    if (arity < 0 && mFunctions != NULL && !mArities.search(name, arity))
+    {
+        Function called;
+        arity = mFunctions->search(name, called) ? called.parameters.getSize() : -1;
+        mArities.insert(name, arity);
+    }
+    if (arity >= 0 && arguments != arity)
+        return fail(ERROR_WRONG_ARGUMENTS, name, function.position);
+    return true;
+}
+
+template <class Sink>
+bool StreamParser<Sink>::emit(const string& text, int origin)
+{
+    if (!mSink.consume(text, origin))
+    {
+        mFailed = true;
+        mErrorToken.clear();
+        return false;
+    }
+    return true;
+}
+
+// Pops the operators of at least 'operation' precedence and hands them to
+// the sink, stopping at a "(", as movePrecedence() in Calculator.h does.
+
+template <class Sink>
+bool StreamParser<Sink>::movePrecedence(int operation)
+{
+    StreamOperator entry;
+    while (mOperators.top(entry) && entry.level > 0 && entry.level >= operation)
+    {
+        mOperators.pop(entry);
+        if (entry.symbol != STREAM_CALL)
+        {
+            if (!emit(operatorToken(entry.symbol), entry.position))
+                return false;
+        }
+        else
+        {
+            string name;
+            mCalls.pop(name);
+            if (!emit(name, entry.position))
+                return false;
+        }
+    }
+    return true;
+}
+
+template <class Sink>
+bool StreamParser<Sink>::fail(int code, const string& text, int position)
+{
+    mFailed = true;
+    mErrorToken = text;
+    return report(mDiagnostic, code, position);
+}
+
+// ----------------------------------------------------//
+
+// A sink that collects the postfix tokens, and optionally their origins,
+// the same as shuntingYard() would
+
+struct PostfixCollector
+{
+    Vector<string>* postfix;
+    Vector<int>* origins;
+
+    bool consume(const string& token, int origin)
+    {
+        postfix->pushBack(token);
+        if (origins != NULL)
+            origins->pushBack(origin);
+        return true;
+    }
+};
+
+// A sink that evaluates the postfix tokens as they arrive, with the same
+// results and errors as evaluatePostfix() on the whole postfix expression.
+// It also calls user-defined functions: a call evaluates the compiled body
+// (see Program.h) on the arguments, the same as a compiled program that
+// inlines it. Errors report the origin of the token at fault.
+// Divisions by zero are told apart by postfix position, as in
+// evaluatePostfix(), so the one reported is the same; the origins of those
+// are kept until the end.
+template <class T, template <class, class> class M, class V>
+class StreamEvaluator
+{
+public:
+    StreamEvaluator(const M<string, V>& variables,
+        const Map<string, Function>& functions, Diagnostic* diagnostic = NULL);
+
+    bool consume(const string& token, int origin);
+
+    // Takes the result once the parser has finished
+    bool finish(T& result);
+
+    // Number of values on the stack: at most the nesting depth
+    int depth() const;
+
+    // The token at fault after a failure (empty for a division by zero or
+    // a missing value at the end)
+    const string& errorToken() const;
+
+private:
+    bool evaluate(const string& token, int index);
+    bool call(int entry, int index);
+
+    const M<string, V>& mVariables;
+    const Map<string, Function>& mFunctions;
+    Diagnostic* mDiagnostic;
+    PostfixState<T> mState;
+
+    // Each function called so far, by name: the number of its parameters
+    // and a program that calls it on placeholder variables "$0", "$1", ...,
+    // which come first in its variable slots
+    Map<string, int> mEntries;
+    Vector<int> mArities;
+    Vector<Program> mCalls;
+    Vector<T> mInputs;
+
+    // Postfix tokens so far, and the origin of each division by zero
+    int mCount;
+    Map<int, int> mDivisionOrigins;
+    string mErrorToken;
+};
+
+template <class T, template <class, class> class M, class V>
+StreamEvaluator<T, M, V>::StreamEvaluator(const M<string, V>& variables,
+    const Map<string, Function>& functions, Diagnostic* diagnostic) :
+    mVariables(variables), mFunctions(functions), mDiagnostic(diagnostic), mCount(0)
+{
+}
+
+template <class T, template <class, class> class M, class V>
+bool StreamEvaluator<T, M, V>::consume(const string& token, int origin)
+{
+    int index = mCount++;
+    if (!evaluate(token, index))
+    {
+        // Any error but a division is about the current token
+        if (mDiagnostic != NULL)
+            mDiagnostic->token = origin;
+        mErrorToken = token;
+        return false;
+    }
+
+    int division = -1;
+    if (mDiagnostic != NULL && mState.divisions.top(division) && division == index)
+        mDivisionOrigins.insert(index, origin);
+    return true;
+}
+
+// Evaluates the postfix token at 'index'.
+
+template <class T, template <class, class> class M, class V>
+bool StreamEvaluator<T, M, V>::evaluate(const string& token, int index)
+{
+    if (postfixOperator(token) != POSTFIX_VALUE)
+        return evaluateToken(token, index, mVariables, mState, mDiagnostic);
+
+    // Functions take precedence over variables, as in compileProgram().
+    // Each one is compiled into a call the first time it is used.
+    int entry = 0;
+    if (mEntries.search(token, entry))
+        return call(entry, index);
+
+    Function function;
+    if (!mFunctions.search(token, function))
+        return evaluateToken(token, index, mVariables, mState, mDiagnostic);
+
+    int arity = function.parameters.getSize();
+    Vector<string> postfix;
+    for (int k = 0; k < arity; k++)
+        postfix.pushBack("$" + to_string(k));
+    postfix.pushBack(token);
+
+    Program program;
+    if (!compileProgram(postfix, mFunctions, program))
+        return report(mDiagnostic, ERROR_UNKNOWN_TOKEN, index);
+    entry = mCalls.getSize();
+    mCalls.pushBack(program);
+    mArities.pushBack(arity);
+    mEntries.insert(token, entry);
+    return call(entry, index);
+}
+
+template <class T, template <class, class> class M, class V>
+bool StreamEvaluator<T, M, V>::finish(T& result)
+{
+    if (finishPostfix(mState, result, mDiagnostic))
+        return true;
+
+    int origin = -1;
+    if (mDiagnostic != NULL && mDiagnostic->code == ERROR_DIVISION_BY_ZERO &&
+        mDivisionOrigins.search(mDiagnostic->token, origin))
+        mDiagnostic->token = origin;
+    return false;
+}
+
+template <class T, template <class, class> class M, class V>
+int StreamEvaluator<T, M, V>::depth() const
+{
+    return mState.values.size();
+}
+
+template <class T, template <class, class> class M, class V>
+const string& StreamEvaluator<T, M, V>::errorToken() const
+{
+    return mErrorToken;
+}
+
+// Replaces the arguments on top of the stack by the value of the function.
+
+template <class T, template <class, class> class M, class V>
+bool StreamEvaluator<T, M, V>::call(int entry, int index)
+{
+    const Program& program = mCalls[entry];
+    int arity = mArities[entry];
+    if (mState.values.size() < arity)
+        return report(mDiagnostic, ERROR_MISSING_OPERAND, index);
+
+    // The arguments, then the variables the body uses
+    mInputs.resize(program.variables.getSize());
+    int division = -1, operand = -1;
+    for (int k = arity - 1; k >= 0; k--)
+    {
+        mState.values.pop(mInputs[k]);
+        if (mDiagnostic != NULL)
+        {
+            mState.divisions.pop(operand);
+            division = firstDivision(division, operand);
+        }
+    }
+    V variable = V();
+    for (int k = arity; k < program.variables.getSize(); k++)
+    {
+        if (!mVariables.search(program.variables[k], variable))
+            return report(mDiagnostic, ERROR_UNDEFINED_VARIABLE, index);
+        loadVariable(variable, mInputs[k]);
+    }
+
+    T value;
+    Diagnostic inside;
+    if (!evaluateProgram(program, (mInputs.getSize() > 0) ? &mInputs[0] : NULL, value,
+        (mDiagnostic != NULL) ? &inside : NULL))
+        division = firstDivision(division, index);
+
+    mState.values.push(value);
+    if (mDiagnostic != NULL)
+        mState.divisions.push(division);
+    return true;
+}
+
+#endif
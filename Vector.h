@@ -3,6 +3,9 @@
 
 // Necessary for print()
 #include <iostream>
+// Necessary for move()
+#include <utility>
+#include "MemoryUsage.h"
 using namespace std;
 
 template <class T>
@@ -13,8 +16,13 @@ public:
     Vector();
     Vector(const int size);
     Vector(const Vector<T>& orig);
+    // Takes over the array of 'orig', which is left empty
+    Vector(Vector<T>&& orig);
     // Prevents memory leak
     ~Vector();
+    // Deep copy, so vectors (and structs holding them) can be assigned
+    Vector<T>& operator=(const Vector<T>& orig);
+    Vector<T>& operator=(Vector<T>&& orig);
     
     // Adjust size/capacity
     void resize(const int size);
@@ -28,12 +36,20 @@ public:
     void pushBack(const T& value);
     // decrement size by one
     void popBack();
+    // size becomes 0, capacity is kept for reuse
+    void clear();
+    // release unused capacity, e.g. before keeping the vector long term
+    void shrinkToFit();
     
     // Getters
     int getCapacity() const;
     int getSize() const;
     void print() const;
     
+    // Memory accounting (see MemoryUsage.h)
+    size_t heapBytes() const;
+    size_t memoryUsage() const;
+    
 private:
     T* mData;
     // Size of the array
@@ -47,14 +63,12 @@ private:
 template <class T>
 Vector<T>::Vector()
 {
-    // Start out in a simple default state
+    // Start out in a simple default state. Nothing is allocated until
+    // the first pushBack(), so empty vectors (and structs full of them)
+    // cost no heap memory.
     mData     = NULL;
     mCapacity = 0;
     mSize     = 0;
-    
-    // Use reserve() to do the hard work of actually creating
-    // the underlying array.
-    reserve(16);
 }
 
 template <class T>
@@ -87,6 +101,19 @@ Vector<T>::Vector(const Vector<T>& orig)
         mData[i] = orig.mData[i];
 }
 
+template <class T>
+Vector<T>::Vector(Vector<T>&& orig)
+{
+    // Nothing is copied, not even the elements
+    mData     = orig.mData;
+    mCapacity = orig.mCapacity;
+    mSize     = orig.mSize;
+    
+    orig.mData     = NULL;
+    orig.mCapacity = 0;
+    orig.mSize     = 0;
+}
+
 template <class T>
 Vector<T>::~Vector()
 {
@@ -98,6 +125,41 @@ Vector<T>::~Vector()
     mData = NULL;
 }
 
+template <class T>
+Vector<T>& Vector<T>::operator=(const Vector<T>& orig)
+{
+    // Assigning a vector to itself must not throw away its contents
+    if (this != &orig)
+    {
+        // Forget our own elements, then copy like the copy constructor.
+        // reserve() keeps the existing array if it is already big enough.
+        mSize = 0;
+        resize(orig.mSize);
+        
+        for (int i = 0; i < mSize; ++i)
+            mData[i] = orig.mData[i];
+    }
+    return *this;
+}
+
+template <class T>
+Vector<T>& Vector<T>::operator=(Vector<T>&& orig)
+{
+    // Like the move constructor, after freeing our own array
+    if (this != &orig)
+    {
+        delete[] mData;
+        mData     = orig.mData;
+        mCapacity = orig.mCapacity;
+        mSize     = orig.mSize;
+        
+        orig.mData     = NULL;
+        orig.mCapacity = 0;
+        orig.mSize     = 0;
+    }
+    return *this;
+}
+
 template <class T>
 void Vector<T>::resize(const int size)
 {
@@ -117,7 +179,8 @@ void Vector<T>::resize(const int size)
 template <class T>
 void Vector<T>::reserve(const int capacity)
 {
-    if (capacity >= mCapacity)
+    // Only ever grow; asking for the current capacity or less is a NOP
+    if (capacity > mCapacity)
     {
         // Allocate a new array. The () syntax will cause
         // 'new' to initialize the memory to 0's initially.
@@ -125,12 +188,13 @@ void Vector<T>::reserve(const int capacity)
         // guaranteeing that all "0" i think
         T* data   = new T[capacity]();
         
-        // Copy any existing data into the new array
-        // copy as long as there is actually data to copy
+        // Move any existing data into the new array. Moving a string or a
+        // vector takes its buffer instead of copying it, so growing a
+        // vector of them costs no allocations per element.
         if (mData != NULL)
         {
             for (int i = 0; i < mSize; ++i)
-                data[i] = mData[i];
+                data[i] = std::move(mData[i]);
         }
         
         // Swap the two arrays
@@ -185,7 +249,8 @@ void Vector<T>::pushBack(const T& value)
         // does reallocation does resizing
         // this doubles the size of the "array"
         // order of  N operation
-        reserve(mCapacity * 2);
+        // A vector created with size 0 has no space to double yet
+        reserve((mCapacity > 0) ? mCapacity * 2 : 16);
     
     // Insert into the last cell of the array.
     mData[mSize] = value;
@@ -201,6 +266,29 @@ void Vector<T>::popBack()
         mSize--;
 }
 
+template <class T>
+void Vector<T>::clear()
+{
+    // Like popBack(), the old cells are simply no longer part of the vector
+    mSize = 0;
+}
+
+template <class T>
+void Vector<T>::shrinkToFit()
+{
+    if (mCapacity == mSize)
+        return;
+    
+    // Same as reserve(), but the new array is exactly big enough
+    T* data = (mSize > 0) ? new T[mSize]() : NULL;
+    for (int i = 0; i < mSize; ++i)
+        data[i] = std::move(mData[i]);
+    
+    delete[] mData;
+    mData     = data;
+    mCapacity = mSize;
+}
+
 template <class T>
 int Vector<T>::getCapacity() const
 {
@@ -221,4 +309,26 @@ void Vector<T>::print() const
     cout << endl;
 }
 
+template <class T>
+size_t Vector<T>::heapBytes() const
+{
+    // The array itself, plus whatever the elements own
+    size_t bytes = mCapacity * sizeof(T);
+    for (int i = 0; i < mSize; ++i)
+        bytes += heapBytesOf(mData[i]);
+    return bytes;
+}
+
+template <class T>
+size_t Vector<T>::memoryUsage() const
+{
+    return sizeof(*this) + heapBytes();
+}
+
+template <class T>
+inline size_t heapBytesOf(const Vector<T>& value)
+{
+    return value.heapBytes();
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,176 @@
+
+// File:   ingest_bench.cpp
+// Compares two ways of getting data into the evaluator: the text path the
+// driver uses for "name = value" lines (stringstream, shuntingYard() and
+// evaluatePostfix() for every value), and ColumnTable reading a mapped CSV
+// file, or a binary column file, straight into columns. Then evaluates a
+// formula over the loaded columns.
+//
+// Build: g++ -std=c++17 -O2 -pthread -I.. ingest_bench.cpp -o ingest_bench
+// Usage: ingest_bench [rows] [columns] [directory for the data files]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include "../Calculator.h"
+#include "../Program.h"
+#include "../ColumnInput.h"
+#include "../ExpressionGenerator.h"
+using namespace std;
+
+volatile double benchmarkSink;
+
+double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    int rows    = (argc > 1) ? atoi(argv[1]) : 2000000;
+    int columns = (argc > 2) ? atoi(argv[2]) : 4;
+    string dir  = (argc > 3) ? argv[3] : "/tmp";
+    string csvPath = dir + "/ingest_bench.csv";
+    string binPath = dir + "/ingest_bench.bin";
+
+    // Write the data files
+    Random random(5);
+    NumberFormat format = {true, 17};
+    FILE* csv = fopen(csvPath.c_str(), "w");
+    FILE* bin = fopen(binPath.c_str(), "wb");
+    if (csv == NULL || bin == NULL)
+    {
+        cout << "Could not write to " << dir << "\n";
+        return 1;
+    }
+    for (int c = 0; c < columns; c++)
+        fprintf(csv, c == 0 ? "%s" : ",%s", generatorVariable(c).c_str());
+    fprintf(csv, "\n");
+    for (int r = 0; r < rows; r++)
+    {
+        for (int c = 0; c < columns; c++)
+        {
+            double value = random.below(100000) / 100.0;
+            fprintf(csv, c == 0 ? "%s" : ",%s", formatNumber(value, format).c_str());
+            if (c == 0)
+                fwrite(&value, sizeof(value), 1, bin);
+        }
+        fprintf(csv, "\n");
+    }
+    fclose(csv);
+    fclose(bin);
+
+    long values = (long) rows * columns;
+    cout << rows << " rows x " << columns << " columns\n\n";
+    cout << fixed << setprecision(1);
+
+    // The driver's path, on a sample of the lines
+    int sample = (rows < 100000) ? rows : 100000;
+    Map<string, double> variables;
+    Map<string, Function> functions;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < sample; r++)
+    {
+        for (int c = 0; c < columns; c++)
+        {
+            Vector<string> expression;
+            tokenize(generatorVariable(c) + " = " +
+                formatNumber(random.below(100000) / 100.0, format), expression);
+
+            Vector<string> postfix;
+            double result = 0;
+            if (shuntingYard(expression, 2, postfix) &&
+                evaluatePostfix(postfix, variables, result))
+                variables.insert(expression[0], result);
+        }
+    }
+    double textSeconds = secondsSince(start);
+    double textRate = (double) sample * columns / textSeconds;
+    cout << "name = value lines     " << setw(10) << textRate / 1e6 << " M values/s"
+         << "  (" << sample << " rows sampled)\n";
+
+    // Mapped CSV, from one worker up to one per CPU
+    int cpus = (int) thread::hardware_concurrency();
+    if (cpus < 1) cpus = 1;
+    for (int workers = 1; ; workers = (workers * 2 > cpus) ? cpus : workers * 2)
+    {
+        ParallelPool pool(workers);
+        ColumnTable table;
+        string error;
+
+        start = chrono::steady_clock::now();
+        if (!table.readCsv(csvPath, pool, error))
+        {
+            cout << error << "\n";
+            return 1;
+        }
+        double seconds = secondsSince(start);
+        cout << "CSV, " << setw(2) << workers << " workers        " << setw(10)
+             << values / seconds / 1e6 << " M values/s  ("
+             << values / seconds / textRate << "x)\n";
+
+        if (workers == cpus)
+            break;
+    }
+
+    // Binary column, then a formula over everything
+    ParallelPool pool;
+    ColumnTable table;
+    string error;
+    if (!table.readCsv(csvPath, pool, error))
+    {
+        cout << error << "\n";
+        return 1;
+    }
+
+    start = chrono::steady_clock::now();
+    if (!table.addBinary(binPath, "raw", pool, error))
+    {
+        cout << error << "\n";
+        return 1;
+    }
+    double binarySeconds = secondsSince(start);
+    cout << "binary column          " << setw(10) << setprecision(3)
+         << binarySeconds * 1e3 << " ms for " << rows << " values\n";
+
+    Vector<string> tokens;
+    tokens.pushBack("raw");
+    tokens.pushBack("-");
+    tokens.pushBack(generatorVariable(0));
+    for (int c = 1; c < columns; c++)
+    {
+        tokens.pushBack("+");
+        tokens.pushBack(generatorVariable(c));
+    }
+
+    Vector<string> postfix;
+    Program program;
+    Vector<const double*> bound;
+    if (!shuntingYard(tokens, 0, postfix) || !compileProgram(postfix, program) ||
+        !bindColumns(program, table, bound))
+    {
+        cout << "Could not bind " << joinTokens(tokens) << "\n";
+        return 1;
+    }
+
+    double* out = allocateColumn(pool, rows);
+    start = chrono::steady_clock::now();
+    evaluateProgramParallel(program, bound, rows, out, pool);
+    double evaluateSeconds = secondsSince(start);
+
+    // raw and x0 hold the same values, so the result is the sum of the rest
+    double check = 0;
+    for (int r = 0; r < rows; r++)
+        check += out[r];
+    benchmarkSink = check;
+    freeColumn(out);
+
+    cout << "evaluate " << joinTokens(tokens) << ": " << setprecision(1)
+         << rows / evaluateSeconds / 1e6 << " M rows/s\n";
+
+    remove(csvPath.c_str());
+    remove(binPath.c_str());
+    return 0;
+}
@@ -0,0 +1,160 @@
+
+// File:   interval_bench.cpp
+// Shows how many blocks of a columnar data set can be skipped by evaluating a
+// predicate once per block with Interval bounds instead of once per row.
+//
+// Each column is split into blocks with min/max metadata, like a column
+// store keeps per page. For every block, the variables are bound to the
+// block's [min, max] and the expression is evaluated as an Interval. If the
+// upper bound is not above the threshold, no row in the block can match and
+// the block is skipped. If the lower bound already is above it, every row
+// matches. Only the remaining blocks are evaluated row by row.
+//
+// Build: g++ -std=c++17 -O2 -I.. interval_bench.cpp -o interval_bench
+// Usage: interval_bench [rows] [block size]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include "../Calculator.h"
+#include "../Interval.h"
+using namespace std;
+
+
+// Counts the rows in [first, last) where the expression is above 'threshold'
+// by evaluating every row.
+
+int scanRows(const Vector<string>& postfix, const double* x, const double* y,
+    int first, int last, double threshold)
+{
+    Map<string, double> row;
+    int matches = 0;
+
+    for (int i = first; i < last; i++)
+    {
+        double result = 0;
+        row.insert("x", x[i]);
+        row.insert("y", y[i]);
+
+        if (evaluatePostfix(postfix, row, result) && result > threshold)
+            matches++;
+    }
+    return matches;
+}
+
+int main(int argc, char* argv[])
+{
+    int rows      = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int blockSize = (argc > 2) ? atoi(argv[2]) : 1024;
+
+    // 'x' moves slowly, like a sensor reading, so each block covers a
+    // narrow range. 'y' is noise in [0, 1].
+    double* x = new double[rows];
+    double* y = new double[rows];
+    srand(42);
+    for (int i = 0; i < rows; i++)
+    {
+        double noise = rand() / (double) RAND_MAX - 0.5;
+        x[i] = 3 * sin(i * 20.0 / rows) + noise * 0.1;
+        y[i] = rand() / (double) RAND_MAX;
+    }
+
+    const string text = "x * 2 + sin ( y * 3 ) - ( max x 0 ) / 4";
+    const double threshold = 1.5;
+
+    Vector<string> expression;
+    Vector<string> postfix;
+    tokenize(text, expression);
+    if (!shuntingYard(expression, 0, postfix))
+    {
+        cout << "Mismatched parentheses.\n";
+        return 1;
+    }
+
+    // Per-block min/max metadata
+    int blocks = (rows + blockSize - 1) / blockSize;
+    Interval* xBounds = new Interval[blocks];
+    Interval* yBounds = new Interval[blocks];
+    for (int b = 0; b < blocks; b++)
+    {
+        int first = b * blockSize;
+        int last  = (first + blockSize < rows) ? first + blockSize : rows;
+        xBounds[b] = makeInterval(x[first], x[first]);
+        yBounds[b] = makeInterval(y[first], y[first]);
+        for (int i = first + 1; i < last; i++)
+        {
+            xBounds[b] = makeInterval(fmin(xBounds[b].lo, x[i]), fmax(xBounds[b].hi, x[i]));
+            yBounds[b] = makeInterval(fmin(yBounds[b].lo, y[i]), fmax(yBounds[b].hi, y[i]));
+        }
+    }
+
+    // Full scan
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int fullMatches = scanRows(postfix, x, y, 0, rows, threshold);
+    chrono::steady_clock::time_point stop = chrono::steady_clock::now();
+    double fullSeconds = chrono::duration<double>(stop - start).count();
+
+    // Pruned scan
+    int skipped  = 0;
+    int accepted = 0;
+    int scanned  = 0;
+    int prunedMatches = 0;
+    Map<string, Interval> ranges;
+
+    start = chrono::steady_clock::now();
+    for (int b = 0; b < blocks; b++)
+    {
+        int first = b * blockSize;
+        int last  = (first + blockSize < rows) ? first + blockSize : rows;
+
+        Interval bounds;
+        ranges.insert("x", xBounds[b]);
+        ranges.insert("y", yBounds[b]);
+
+        if (!evaluatePostfix(postfix, ranges, bounds))
+        {
+            cout << "Expression was malformed.\n";
+            return 1;
+        }
+
+        if (bounds.hi <= threshold)
+            skipped++;
+        else if (bounds.lo > threshold)
+        {
+            accepted++;
+            prunedMatches += last - first;
+        }
+        else
+        {
+            scanned++;
+            prunedMatches += scanRows(postfix, x, y, first, last, threshold);
+        }
+    }
+    stop = chrono::steady_clock::now();
+    double prunedSeconds = chrono::duration<double>(stop - start).count();
+
+    cout << "Expression: " << text << " > " << threshold << "\n";
+    cout << rows << " rows in " << blocks << " blocks of " << blockSize << "\n\n";
+    cout << "Full scan:   " << fullMatches << " matches in "
+         << fixed << setprecision(3) << fullSeconds << " s\n";
+    cout << "Pruned scan: " << prunedMatches << " matches in "
+         << prunedSeconds << " s (" << setprecision(1)
+         << fullSeconds / prunedSeconds << "x)\n";
+    cout << "  skipped  " << skipped  << " blocks ("
+         << 100.0 * skipped / blocks << "%)\n";
+    cout << "  accepted " << accepted << " blocks ("
+         << 100.0 * accepted / blocks << "%) without evaluating rows\n";
+    cout << "  scanned  " << scanned  << " blocks ("
+         << 100.0 * scanned / blocks << "%)\n";
+
+    if (fullMatches != prunedMatches)
+        cout << "ERROR: the pruned scan disagrees with the full scan\n";
+
+    delete[] x;
+    delete[] y;
+    delete[] xBounds;
+    delete[] yBounds;
+    return (fullMatches == prunedMatches) ? 0 : 1;
+}
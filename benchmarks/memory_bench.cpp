@@ -0,0 +1,74 @@
+
+// File:   memory_bench.cpp
+// Compares the memory needed to keep expressions around as token vectors
+// (the infix tokens plus the postfix output of shuntingYard()) with keeping
+// them as compiled, packed Programs.
+//
+// Build: g++ -std=c++17 -O2 -I.. memory_bench.cpp -o memory_bench
+// Usage: memory_bench [expressions] [depth]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include "../Calculator.h"
+#include "../Program.h"
+#include "../ExpressionGenerator.h"
+using namespace std;
+
+
+int main(int argc, char* argv[])
+{
+    int count = (argc > 1) ? atoi(argv[1]) : 100000;
+
+    GeneratorOptions options = defaultGeneratorOptions();
+    if (argc > 2)
+        options.maxDepth = atoi(argv[2]);
+
+    Random random(1);
+    size_t tokenBytes   = 0;
+    size_t postfixBytes = 0;
+    size_t programBytes = 0;
+    long tokenCount     = 0;
+    long instructions   = 0;
+
+    for (int n = 0; n < count; n++)
+    {
+        Vector<string> tokens;
+        Vector<string> postfix;
+        Program program;
+
+        generateExpression(random, options, options.maxDepth, tokens);
+        if (!shuntingYard(tokens, 0, postfix) || !compileProgram(postfix, program))
+        {
+            cout << "Generated a malformed expression: " << joinTokens(tokens) << "\n";
+            return 1;
+        }
+
+        tokenBytes   += tokens.memoryUsage();
+        postfixBytes += postfix.memoryUsage();
+        programBytes += sizeof(program) + heapBytesOf(program);
+        tokenCount   += tokens.getSize();
+        instructions += program.code.getSize();
+    }
+
+    double perExpression = 1.0 / count;
+    cout << count << " expressions, " << fixed << setprecision(1)
+         << tokenCount * perExpression << " tokens and "
+         << instructions * perExpression << " instructions on average\n\n";
+
+    cout << "Bytes per expression:\n";
+    cout << "  infix tokens     " << setw(10) << tokenBytes * perExpression << "\n";
+    cout << "  postfix tokens   " << setw(10) << postfixBytes * perExpression << "\n";
+    cout << "  tokens, total    " << setw(10)
+         << (tokenBytes + postfixBytes) * perExpression << "\n";
+    cout << "  compiled program " << setw(10) << programBytes * perExpression
+         << "  (" << sizeof(Instruction) << " bytes per instruction)\n\n";
+
+    double million = 1e6 * perExpression / (1024.0 * 1024.0);
+    cout << "For a million cached expressions:\n";
+    cout << "  as tokens   " << setw(10) << (tokenBytes + postfixBytes) * million << " MiB\n";
+    cout << "  as programs " << setw(10) << programBytes * million << " MiB ("
+         << setprecision(1) << 100.0 * programBytes / (tokenBytes + postfixBytes)
+         << "%)\n";
+    return 0;
+}
@@ -0,0 +1,166 @@
+
+// File:   multi_bench.cpp
+// Evaluates a large set of formulas over the same rows of variables, once
+// program by program with evaluateProgram() and once fused into a single
+// MultiProgram. The formulas are built from a shared pool of
+// sub-expressions, the way a set of related business rules or features
+// usually reuses the same terms.
+//
+// Build: g++ -std=c++17 -O2 -I.. multi_bench.cpp -o multi_bench
+// Usage: multi_bench [formulas] [rows] [pool size]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <cstring>
+#include "../Calculator.h"
+#include "../Program.h"
+#include "../MultiProgram.h"
+#include "../ExpressionGenerator.h"
+using namespace std;
+
+volatile double benchmarkSink;
+
+// Appends "( tokens )" to 'out'
+void appendGrouped(const Vector<string>& tokens, Vector<string>& out)
+{
+    out.pushBack("(");
+    for (int i = 0; i < tokens.getSize(); i++)
+        out.pushBack(tokens[i]);
+    out.pushBack(")");
+}
+
+int main(int argc, char* argv[])
+{
+    int formulas = (argc > 1) ? atoi(argv[1]) : 2000;
+    int rows     = (argc > 2) ? atoi(argv[2]) : 2000;
+    int poolSize = (argc > 3) ? atoi(argv[3]) : 200;
+
+    GeneratorOptions options = defaultGeneratorOptions();
+    options.maxDepth      = 4;
+    options.variableCount = 16;
+
+    // Shared sub-expressions
+    Random random(7);
+    Vector< Vector<string> > pool;
+    for (int i = 0; i < poolSize; i++)
+    {
+        Vector<string> tokens;
+        generateExpression(random, options, options.maxDepth, tokens);
+        pool.pushBack(tokens);
+    }
+
+    // Each formula combines two pool entries with a small random term
+    const char* const joins[] = {"+", "-", "*", "/"};
+    options.maxDepth = 2;
+
+    Vector<Program> programs;
+    long instructions = 0;
+    for (int n = 0; n < formulas; n++)
+    {
+        Vector<string> tokens;
+        Vector<string> extra;
+        generateExpression(random, options, options.maxDepth, extra);
+
+        appendGrouped(pool[random.below(poolSize)], tokens);
+        tokens.pushBack(joins[random.below(4)]);
+        appendGrouped(pool[random.below(poolSize)], tokens);
+        tokens.pushBack(joins[random.below(4)]);
+        appendGrouped(extra, tokens);
+
+        Vector<string> postfix;
+        Program program;
+        if (!shuntingYard(tokens, 0, postfix) || !compileProgram(postfix, program))
+        {
+            cout << "Generated a malformed expression: " << joinTokens(tokens) << "\n";
+            return 1;
+        }
+        instructions += program.code.getSize();
+        programs.pushBack(program);
+    }
+
+    MultiProgram multi;
+    auto buildStart = chrono::steady_clock::now();
+    buildMultiProgram(programs, multi);
+    auto buildEnd = chrono::steady_clock::now();
+
+    // Random rows, one value per variable slot of the fused program
+    int width = multi.variables.getSize();
+    Vector<double> table;
+    table.resize(rows * width);
+    for (int i = 0; i < rows * width; i++)
+        table[i] = (random.unit() - 0.5) * 10;
+
+    // Where each program's variables live in a row
+    Vector< Vector<int> > slots;
+    for (int p = 0; p < formulas; p++)
+    {
+        Vector<int> map;
+        for (int v = 0; v < programs[p].variables.getSize(); v++)
+            for (int s = 0; s < width; s++)
+                if (multi.variables[s] == programs[p].variables[v])
+                    map.pushBack(s);
+        slots.pushBack(map);
+    }
+
+    // One program at a time
+    Vector<double> separate;
+    separate.resize(rows * formulas);
+    Vector<double> inputs;
+    inputs.resize(width);
+
+    auto separateStart = chrono::steady_clock::now();
+    for (int r = 0; r < rows; r++)
+    {
+        const double* row = &table[r * width];
+        for (int p = 0; p < formulas; p++)
+        {
+            const Vector<int>& map = slots[p];
+            for (int v = 0; v < map.getSize(); v++)
+                inputs[v] = row[map[v]];
+            evaluateProgram(programs[p], &inputs[0], separate[r * formulas + p]);
+        }
+    }
+    auto separateEnd = chrono::steady_clock::now();
+
+    // Fused
+    Vector<double> fused;
+    fused.resize(rows * formulas);
+
+    auto fusedStart = chrono::steady_clock::now();
+    for (int r = 0; r < rows; r++)
+        evaluateMultiProgram(multi, &table[r * width], &fused[r * formulas]);
+    auto fusedEnd = chrono::steady_clock::now();
+
+    // Both must agree bit for bit, NaN included
+    for (int i = 0; i < rows * formulas; i++)
+    {
+        if (memcmp(&separate[i], &fused[i], sizeof(double)) != 0)
+        {
+            cout << "Mismatch in formula " << i % formulas << ", row " << i / formulas
+                 << ": " << separate[i] << " vs " << fused[i] << "\n";
+            return 1;
+        }
+        benchmarkSink = fused[i];
+    }
+
+    double separateSeconds = chrono::duration<double>(separateEnd - separateStart).count();
+    double fusedSeconds    = chrono::duration<double>(fusedEnd - fusedStart).count();
+    double buildSeconds    = chrono::duration<double>(buildEnd - buildStart).count();
+
+    cout << formulas << " formulas over " << width << " variables, "
+         << rows << " rows\n";
+    cout << "  instructions, all programs " << setw(10) << instructions << "\n";
+    cout << "  nodes run per row, fused   " << setw(10) << multi.schedule.getSize()
+         << "  (" << multi.registers.getSize() - multi.schedule.getSize()
+         << " constants)\n";
+    cout << "  build time                 " << setw(10) << fixed << setprecision(2)
+         << buildSeconds * 1e3 << " ms\n\n";
+
+    cout << "Time per row:\n";
+    cout << "  program by program " << setw(10) << separateSeconds / rows * 1e6 << " us\n";
+    cout << "  fused              " << setw(10) << fusedSeconds / rows * 1e6 << " us  ("
+         << setprecision(1) << separateSeconds / fusedSeconds << "x)\n";
+    return 0;
+}
@@ -0,0 +1,104 @@
+
+// File:   numeric_bench.cpp
+// Compares the throughput and accuracy of the numeric types the evaluator
+// can be instantiated with (see Numeric.h).
+//
+// Build: g++ -std=c++17 -O2 -I.. numeric_bench.cpp -o numeric_bench
+// Usage: numeric_bench [repetitions]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include "../Calculator.h"
+using namespace std;
+
+// Keeps the compiler from dropping the timed loops
+volatile double benchmarkSink = 0;
+
+// Evaluates 'postfix' 'repetitions' times as a T and prints the average time
+// per evaluation and the error against 'exact'.
+
+template <class T>
+void run(const Vector<string>& postfix, const Map<string, double>& variables,
+    int repetitions, long double exact)
+{
+    T value = NumericTraits<T>::fromDouble(0);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++)
+    {
+        if (!evaluatePostfix(postfix, variables, value))
+        {
+            cout << "  evaluation failed\n";
+            return;
+        }
+        benchmarkSink = NumericTraits<T>::toDouble(value);
+    }
+    chrono::steady_clock::time_point stop = chrono::steady_clock::now();
+
+    double nanoseconds = chrono::duration<double, nano>(stop - start).count();
+    double result      = NumericTraits<T>::toDouble(value);
+    long double error  = fabsl((long double) result - exact);
+
+    cout << "  " << setw(12) << left << NumericTraits<T>::name() << right
+         << setw(12) << fixed << setprecision(1) << nanoseconds / repetitions
+         << " ns/eval   result " << setprecision(17) << result
+         << "   abs error " << scientific << setprecision(3) << (double) error
+         << defaultfloat << endl;
+}
+
+// Runs every numeric type over one expression.
+
+void compare(const string& title, const string& text,
+    const Map<string, double>& variables, int repetitions, long double exact)
+{
+    Vector<string> expression;
+    Vector<string> postfix;
+    tokenize(text, expression);
+
+    if (!shuntingYard(expression, 0, postfix))
+    {
+        cout << title << ": mismatched parentheses\n";
+        return;
+    }
+
+    cout << title << " (" << expression.getSize() << " tokens)\n";
+    run<float>(postfix, variables, repetitions, exact);
+    run<double>(postfix, variables, repetitions, exact);
+    run<long double>(postfix, variables, repetitions, exact);
+    run<Decimal>(postfix, variables, repetitions, exact);
+    run<Compensated>(postfix, variables, repetitions, exact);
+}
+
+int main(int argc, char* argv[])
+{
+    int repetitions = (argc > 1) ? atoi(argv[1]) : 2000;
+
+    Map<string, double> variables;
+    variables.insert("rate", 0.07);
+
+    // 1000 additions of 0.1. The exact answer is 100.
+    string sum = "0.1";
+    for (int i = 1; i < 1000; i++)
+        sum += " + 0.1";
+    compare("Repeated sum", sum, variables, repetitions, 100.0L);
+
+    // Cents with tax, the kind of total a ledger adds up. Exact: 10000 items
+    // of 19.99 at a rate of 0.07 add up to 213893.
+    string ledger = "19.99 * ( 1 + rate )";
+    for (int i = 1; i < 200; i++)
+        ledger += " + 19.99 * ( 1 + rate )";
+    compare("Ledger total", "( " + ledger + " ) * 50", variables,
+        repetitions, 213893.0L);
+
+    // Catastrophic cancellation: large values that cancel, leaving a small
+    // remainder. Exact answer: 1.
+    string cancel = "1e15 + 0.5 - 1e15 + 0.5";
+    for (int i = 0; i < 100; i++)
+        cancel += " + 1e15 - 1e15";
+    compare("Cancellation", cancel, variables, repetitions, 1.0L);
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+
+// File:   parallel_bench.cpp
+// Scaling of evaluateProgramParallel() from one worker up to one per CPU,
+// for a single formula over large columns. Columns are allocated with
+// allocateColumn() by each pool, so the pages sit on the NUMA node of the
+// workers that read them. The one-worker run uses evaluateProgramBatch()
+// directly as the baseline.
+//
+// Build: g++ -std=c++17 -O2 -pthread -I.. parallel_bench.cpp -o parallel_bench
+// Usage: parallel_bench [rows] [repeats] ["expression"]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include "../Calculator.h"
+#include "../Program.h"
+#include "../Parallel.h"
+#include "../ExpressionGenerator.h"
+using namespace std;
+
+volatile double benchmarkSink;
+
+// Seconds per pass over all rows, best of 'repeats'
+double timePasses(const Program& program, const Vector<const double*>& columns,
+    int rows, double* out, ParallelPool* pool, int repeats)
+{
+    double best = 1e30;
+    for (int n = 0; n < repeats; n++)
+    {
+        auto start = chrono::steady_clock::now();
+        if (pool != NULL)
+            evaluateProgramParallel(program, columns, rows, out, *pool);
+        else
+            evaluateProgramBatch(program, columns, rows, out);
+        auto end = chrono::steady_clock::now();
+
+        double seconds = chrono::duration<double>(end - start).count();
+        if (seconds < best)
+            best = seconds;
+    }
+    return best;
+}
+
+int main(int argc, char* argv[])
+{
+    int rows    = (argc > 1) ? atoi(argv[1]) : 1 << 23;
+    int repeats = (argc > 2) ? atoi(argv[2]) : 5;
+    string text = (argc > 3) ? argv[3]
+                : "( x0 * 1.5 + x1 ) * ( x2 - x3 ) + max ( x0 , x3 ) / 4";
+
+    Vector<string> tokens, postfix;
+    Program program;
+    tokenize(text, tokens);
+    if (!shuntingYard(tokens, 0, postfix) || !compileProgram(postfix, program))
+    {
+        cout << "Could not compile: " << text << "\n";
+        return 1;
+    }
+
+    int cpus = (int) thread::hardware_concurrency();
+    if (cpus < 1) cpus = 1;
+
+    Vector<int> order;
+    numaCpuOrder(order);
+    cout << rows << " rows, " << program.variables.getSize() << " columns, "
+         << cpus << " CPUs\nCPU order across NUMA nodes:";
+    for (int i = 0; i < order.getSize(); i++)
+        cout << " " << order[i];
+    cout << "\n\n";
+
+    // Baseline: single thread, plain allocation
+    Random random(3);
+    Vector<double*> data;
+    Vector<const double*> columns;
+    for (int c = 0; c < program.variables.getSize(); c++)
+    {
+        double* column = new double[rows];
+        for (int r = 0; r < rows; r++)
+            column[r] = (random.unit() - 0.5) * 100;
+        data.pushBack(column);
+        columns.pushBack(column);
+    }
+    double* expected = new double[rows];
+    double baseline = timePasses(program, columns, rows, expected, NULL, repeats);
+
+    double bytes = (double) rows * sizeof(double) * (program.variables.getSize() + 1);
+    cout << " workers      ms/pass    Mrows/s     GB/s   speedup\n";
+    cout << fixed << setprecision(2);
+    cout << setw(8) << "batch" << setw(13) << baseline * 1e3
+         << setw(11) << rows / baseline / 1e6 << setw(9) << bytes / baseline / 1e9
+         << setw(10) << 1.0 << "\n";
+
+    for (int workers = 1; workers <= cpus; workers = (workers == cpus) ? cpus + 1 :
+         (workers * 2 > cpus ? cpus : workers * 2))
+    {
+        ParallelPool pool(workers);
+
+        // First touch from the pool's own workers
+        Vector<double*> local;
+        Vector<const double*> localColumns;
+        for (int c = 0; c < data.getSize(); c++)
+        {
+            double* column = allocateColumn(pool, rows);
+            memcpy(column, data[c], rows * sizeof(double));
+            local.pushBack(column);
+            localColumns.pushBack(column);
+        }
+        double* out = allocateColumn(pool, rows);
+
+        double seconds = timePasses(program, localColumns, rows, out, &pool, repeats);
+
+        if (memcmp(out, expected, rows * sizeof(double)) != 0)
+        {
+            cout << "Parallel result differs from evaluateProgramBatch()\n";
+            return 1;
+        }
+        benchmarkSink = out[rows / 2];
+
+        cout << setw(8) << workers << setw(13) << seconds * 1e3
+             << setw(11) << rows / seconds / 1e6 << setw(9) << bytes / seconds / 1e9
+             << setw(10) << baseline / seconds << "\n";
+
+        for (int c = 0; c < local.getSize(); c++)
+            freeColumn(local[c]);
+        freeColumn(out);
+    }
+
+    for (int c = 0; c < data.getSize(); c++)
+        delete [] data[c];
+    delete [] expected;
+    return 0;
+}
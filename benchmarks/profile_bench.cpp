@@ -0,0 +1,231 @@
+
+// File:   profile_bench.cpp
+// Evaluates a workload of linear and polynomial formulas (the kind that
+// dominate pricing and scoring rules) before and after profile-guided
+// specialization. The first pass records a Profile, the second compiles the
+// same formulas with the superinstructions it picks, and both are timed with
+// evaluateProgram() per row and with evaluateProgramBatch(). The results
+// have to match bit for bit. It also checks that the program cache stays
+// bounded when many different expressions go through it.
+//
+// Build: g++ -std=c++17 -O2 -I.. profile_bench.cpp -o profile_bench
+// Usage: profile_bench [rows]
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdlib>
+#include <chrono>
+#include "../Calculator.h"
+#include "../Program.h"
+#include "../Profile.h"
+#include "../ExpressionGenerator.h"
+using namespace std;
+
+
+const char* formulas[] =
+{
+    "price * 0.9 + shipping",
+    "qty * price * 1.2 + fee",
+    "x * x * 0.5 + x * 3 + 7",
+    "( ( x * 0.25 + 1.5 ) * x + 2 ) * x + 0.125",
+    "a * 2 + b * 3 + c * 4 + d * 5",
+    "if ( qty > 10 , price * 0.8 , price * 0.95 ) * qty + fee",
+};
+const int FORMULAS = sizeof(formulas) / sizeof(formulas[0]);
+
+// Evaluates every formula for every row, one row at a time, and returns
+// the seconds taken. 'inputs' holds the row values by name.
+double timeScalar(const Vector<Program>& programs,
+    const Map<string, const double*>& columns, int rows, Vector<double>& out)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int p = 0; p < programs.getSize(); p++)
+    {
+        const Program& program = programs[p];
+        Vector<const double*> bound;
+        for (int j = 0; j < program.variables.getSize(); j++)
+        {
+            const double* column = NULL;
+            columns.search(program.variables[j], column);
+            bound.pushBack(column);
+        }
+
+        double inputs[16];
+        for (int r = 0; r < rows; r++)
+        {
+            for (int j = 0; j < bound.getSize(); j++)
+                inputs[j] = bound[j][r];
+            evaluateProgram(program, inputs, out[p * rows + r]);
+        }
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Same, a batch at a time
+double timeBatch(const Vector<Program>& programs,
+    const Map<string, const double*>& columns, int rows, Vector<double>& out)
+{
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int p = 0; p < programs.getSize(); p++)
+    {
+        const Program& program = programs[p];
+        Vector<const double*> bound;
+        for (int j = 0; j < program.variables.getSize(); j++)
+        {
+            const double* column = NULL;
+            columns.search(program.variables[j], column);
+            bound.pushBack(column);
+        }
+        evaluateProgramBatch(program, bound, rows, &out[p * rows]);
+    }
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Looks up more different expressions than the cache holds, as a long
+// session would, and checks that the cache stays within its limit, that
+// each expression still gets a program that computes it, and that the hot
+// formulas are still cached as 'specialized'. Returns false otherwise.
+bool checkCacheLimit(ProgramCache& cache, const Vector< Vector<string> >& postfixes,
+    const Vector<Program>& specialized, const Map<string, Function>& functions)
+{
+    for (int n = 0; n < 3 * MAX_CACHED_PROGRAMS; n++)
+    {
+        stringstream expression;
+        expression << "x * " << n << " + 1";
+        Vector<string> tokens, postfix;
+        tokenize(expression.str(), tokens);
+        shuntingYard(tokens, 0, postfix);
+
+        int entry = 0;
+        double x = 2, result = 0;
+        if (!findProgram(cache, postfix, functions, entry) ||
+            !evaluateProgram(cache.programs[entry], &x, result) || result != 2.0 * n + 1)
+        {
+            cout << "Cached program for " << expression.str() << " is wrong\n";
+            return false;
+        }
+        if (cache.programs.getSize() > MAX_CACHED_PROGRAMS)
+        {
+            cout << "Program cache grew past " << MAX_CACHED_PROGRAMS << " programs\n";
+            return false;
+        }
+    }
+
+    for (int f = 0; f < postfixes.getSize(); f++)
+    {
+        int entry = 0;
+        findProgram(cache, postfixes[f], functions, entry);
+        if (entry >= cache.warmed ||
+            cache.programs[entry].code.getSize() != specialized[f].code.getSize())
+        {
+            cout << "Hot formula " << f << " was dropped from the program cache\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    int rows = (argc > 1) ? atoi(argv[1]) : 1000000;
+
+    // Random values for every variable the formulas use
+    const char* names[] = {"price", "shipping", "qty", "fee", "x", "a", "b", "c", "d"};
+    const int NAMES = sizeof(names) / sizeof(names[0]);
+    Random random(1);
+    Vector< Vector<double> > values(NAMES);
+    Map<string, const double*> columns;
+    for (int v = 0; v < NAMES; v++)
+    {
+        values[v].resize(rows);
+        for (int r = 0; r < rows; r++)
+            values[v][r] = random.unit() * 20;
+        columns.insert(names[v], &values[v][0]);
+    }
+
+    // Plain programs, with every evaluation recorded
+    Profile profile;
+    clearProfile(profile);
+    Vector<Program> plain;
+    Vector< Vector<string> > postfixes;
+    for (int f = 0; f < FORMULAS; f++)
+    {
+        Vector<string> tokens, postfix;
+        Program program;
+        tokenize(formulas[f], tokens);
+        if (!shuntingYard(tokens, 0, postfix) ||
+            !compileProgram(postfix, program))
+        {
+            cout << "Could not compile " << formulas[f] << "\n";
+            return 1;
+        }
+        plain.pushBack(program);
+        postfixes.pushBack(postfix);
+        recordEvaluation(profile, postfix, program);
+    }
+
+    // What a later run does with the profile
+    ProgramCache cache;
+    cache.specialization = noSpecialization();
+    Map<string, Function> noFunctions;
+    warmProgramCache(cache, profile, noFunctions);
+
+    Vector<Program> specialized;
+    long plainCode = 0, specializedCode = 0;
+    for (int f = 0; f < FORMULAS; f++)
+    {
+        int entry = 0;
+        findProgram(cache, postfixes[f], noFunctions, entry);
+        specialized.pushBack(cache.programs[entry]);
+        plainCode       += plain[f].code.getSize();
+        specializedCode += cache.programs[entry].code.getSize();
+    }
+
+    cout << FORMULAS << " formulas, " << rows << " rows\n";
+    cout << "Superinstructions chosen:";
+    for (int i = 0; i < SUPERINSTRUCTION_COUNT; i++)
+    {
+        if (cache.specialization.superinstructions[i])
+            cout << " " << superinstructionName(i);
+    }
+    cout << "\nInstructions: " << plainCode << " plain, " << specializedCode
+         << " specialized\n\n";
+
+    if (!checkCacheLimit(cache, postfixes, specialized, noFunctions))
+        return 1;
+
+    Vector<double> expected(FORMULAS * rows), actual(FORMULAS * rows);
+    double scalarPlain = timeScalar(plain, columns, rows, expected);
+    double scalarFast  = timeScalar(specialized, columns, rows, actual);
+    for (int i = 0; i < expected.getSize(); i++)
+    {
+        if (expected[i] != actual[i])
+        {
+            cout << "Specialized result differs at " << i << "\n";
+            return 1;
+        }
+    }
+
+    double batchPlain = timeBatch(plain, columns, rows, expected);
+    double batchFast  = timeBatch(specialized, columns, rows, actual);
+    for (int i = 0; i < expected.getSize(); i++)
+    {
+        if (expected[i] != actual[i])
+        {
+            cout << "Specialized batch result differs at " << i << "\n";
+            return 1;
+        }
+    }
+
+    double evaluations = (double) FORMULAS * rows / 1e6;
+    cout << fixed << setprecision(1);
+    cout << "                      plain  specialized   (M evaluations/s)\n";
+    cout << "evaluateProgram   " << setw(9) << evaluations / scalarPlain
+         << setw(13) << evaluations / scalarFast << "   "
+         << setprecision(2) << scalarPlain / scalarFast << "x\n" << setprecision(1);
+    cout << "evaluateProgramBatch" << setw(7) << evaluations / batchPlain
+         << setw(13) << evaluations / batchFast << "   "
+         << setprecision(2) << batchPlain / batchFast << "x\n";
+    return 0;
+}
@@ -0,0 +1,189 @@
+
+// File:   register_bench.cpp
+// Compares the stack interpreter (evaluateProgram()) with the register code
+// of RegisterMachine.h, one row at a time, on three kinds of expressions:
+//   deep         random expressions nested 10 levels deep
+//   long         a linear formula of many "x * c +" terms
+//   conditional  random expressions with comparisons, "and", "or" and "if"
+// evaluatePostfix() is timed on a tenth of the rows for reference. All
+// results have to match bit for bit.
+//
+// Build: g++ -std=c++17 -O2 -I.. register_bench.cpp -o register_bench
+// Usage: register_bench [rows] [seed]
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdlib>
+#include <chrono>
+#include "../Calculator.h"
+#include "../Program.h"
+#include "../RegisterMachine.h"
+#include "../ExpressionGenerator.h"
+using namespace std;
+
+const int VARIABLES = 8;
+
+struct Workload
+{
+    string name;
+    Vector< Vector<string> > postfixes;
+};
+
+// Adds 'count' generated expressions to 'workload'
+bool addGenerated(Workload& workload, Random& random,
+    const GeneratorOptions& options, int count)
+{
+    for (int e = 0; e < count; e++)
+    {
+        Vector<string> tokens, postfix;
+        generateExpression(random, options, options.maxDepth, tokens);
+        if (!shuntingYard(tokens, 0, postfix))
+            return false;
+        workload.postfixes.pushBack(postfix);
+    }
+    return true;
+}
+
+// Adds "x0 * c0 + x1 * c1 + ... + c" with 'terms' terms
+bool addLinear(Workload& workload, Random& random, int terms)
+{
+    stringstream ss;
+    for (int t = 0; t < terms; t++)
+        ss << generatorVariable(t % VARIABLES) << " * " << random.unit() * 4 << " + ";
+    ss << random.unit();
+
+    Vector<string> tokens, postfix;
+    tokenize(ss.str(), tokens);
+    if (!shuntingYard(tokens, 0, postfix))
+        return false;
+    workload.postfixes.pushBack(postfix);
+    return true;
+}
+
+// Fills row 'r' of the inputs of 'program' from the variable columns
+void loadRow(const Program& program, const Vector< Vector<double> >& values,
+    int r, double* inputs)
+{
+    for (int j = 0; j < program.variables.getSize(); j++)
+        inputs[j] = values[program.variables[j][1] - '0'][r];
+}
+
+int main(int argc, char* argv[])
+{
+    int rows = (argc > 1) ? atoi(argv[1]) : 20000;
+    Random random((argc > 2) ? atoi(argv[2]) : 1);
+
+    Vector< Vector<double> > values(VARIABLES);
+    for (int v = 0; v < VARIABLES; v++)
+    {
+        values[v].resize(rows);
+        for (int r = 0; r < rows; r++)
+            values[v][r] = random.unit() * 20 - 10;
+    }
+
+    Vector<Workload> workloads(3);
+    GeneratorOptions options = defaultGeneratorOptions();
+    options.variableCount = VARIABLES;
+
+    workloads[0].name = "deep";
+    options.maxDepth   = 10;
+    options.leafChance = 0.05;
+    bool built = addGenerated(workloads[0], random, options, 20);
+
+    workloads[1].name = "long";
+    for (int e = 0; e < 20; e++)
+        built = built && addLinear(workloads[1], random, 200);
+
+    workloads[2].name = "conditional";
+    options.maxDepth   = 8;
+    options.leafChance = 0.1;
+    for (int i = GENERATOR_FIRST_CONDITION; i < GENERATOR_OPERATOR_COUNT; i++)
+        options.weights[i] = 2;
+    built = built && addGenerated(workloads[2], random, options, 20);
+
+    if (!built)
+    {
+        cout << "Could not parse the generated expressions\n";
+        return 1;
+    }
+
+    cout << rows << " rows per expression\n";
+    cout << "workload       tokens  stack ops  register ops   postfix   stack  register"
+            "   (ns/evaluation)\n";
+
+    for (int w = 0; w < workloads.getSize(); w++)
+    {
+        const Workload& workload = workloads[w];
+        long tokens = 0, stackOps = 0, registerOps = 0;
+        double postfixTime = 0, stackTime = 0, registerTime = 0;
+
+        for (int e = 0; e < workload.postfixes.getSize(); e++)
+        {
+            const Vector<string>& postfix = workload.postfixes[e];
+            Program program;
+            RegisterProgram registers;
+            if (!compileProgram(postfix, program) ||
+                !compileRegisterProgram(program, registers))
+            {
+                cout << "Could not compile a " << workload.name << " expression\n";
+                return 1;
+            }
+            tokens      += postfix.getSize();
+            stackOps    += program.code.getSize();
+            registerOps += registers.code.getSize();
+
+            Vector<double> expected(rows), actual(rows);
+            double inputs[VARIABLES];
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for (int r = 0; r < rows; r++)
+            {
+                loadRow(program, values, r, inputs);
+                evaluateProgram(program, inputs, expected[r]);
+            }
+            chrono::steady_clock::time_point middle = chrono::steady_clock::now();
+            for (int r = 0; r < rows; r++)
+            {
+                loadRow(program, values, r, inputs);
+                evaluateRegisterProgram(registers, inputs, actual[r]);
+            }
+            chrono::steady_clock::time_point end = chrono::steady_clock::now();
+            stackTime    += chrono::duration<double>(middle - start).count();
+            registerTime += chrono::duration<double>(end - middle).count();
+
+            for (int r = 0; r < rows; r++)
+            {
+                if (expected[r] != actual[r] && expected[r] == expected[r])
+                {
+                    cout << "Register result differs in " << workload.name
+                         << " expression " << e << ", row " << r << "\n";
+                    return 1;
+                }
+            }
+
+            // The reference evaluator looks variables up by name
+            Map<string, double> variables;
+            double result = 0;
+            start = chrono::steady_clock::now();
+            for (int r = 0; r < rows / 10; r++)
+            {
+                for (int v = 0; v < VARIABLES; v++)
+                    variables.insert(generatorVariable(v), values[v][r]);
+                evaluatePostfix(postfix, variables, result);
+            }
+            postfixTime += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+
+        double evaluations = (double) workload.postfixes.getSize() * rows;
+        cout << left << setw(12) << workload.name << right << setw(9) << tokens
+             << setw(11) << stackOps << setw(14) << registerOps
+             << fixed << setprecision(1)
+             << setw(10) << postfixTime * 1e9 / (evaluations / 10)
+             << setw(8) << stackTime * 1e9 / evaluations
+             << setw(10) << registerTime * 1e9 / evaluations
+             << "   " << setprecision(2) << stackTime / registerTime << "x\n";
+        cout.unsetf(ios::fixed);
+    }
+    return 0;
+}
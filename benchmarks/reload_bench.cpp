@@ -0,0 +1,323 @@
+
+// File:   reload_bench.cpp
+// Reader threads evaluate the formulas of a BundleStore without a break
+// while a writer reads and publishes new versions of the bundle. Every
+// formula of version v evaluates to about 1000 * v, so each reader checks
+// that all results of one enter() / leave() come from the bundle it
+// entered; any mismatch makes the program fail. Reports the time to read
+// a bundle, to publish it and to reclaim the old one, how long until every
+// reader has seen it, and the readers' throughput and latency with and
+// without reloads. Last, short-lived readers take and give back reader
+// slots, more of them in all than the store has slots, while the writer
+// keeps publishing.
+//
+// Build: g++ -std=c++17 -O2 -pthread -I.. reload_bench.cpp -o reload_bench
+// Usage: reload_bench [readers] [reloads] [seconds] [formulas]
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include "../FormulaBundle.h"
+#include "../Benchmark.h"
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+double secondsBetween(Clock::time_point start, Clock::time_point end)
+{
+    return chrono::duration<double>(end - start).count();
+}
+
+// The text of version 'version' of the bundle
+string bundleText(int version, int formulas)
+{
+    stringstream text;
+    text << "# version " << version << "\n";
+    text << "scale = " << version << "\n";
+    text << "base = scale * 1000\n";
+    text << "x = 0.5\n";
+    for (int i = 0; i < formulas; i++)
+        text << "formula f" << i << " = base + " << i + 1 << " + sin ( x * " << i
+             << " ) / 4 + ( x * x - x ) * 0.5\n";
+    return text.str();
+}
+
+FormulaBundle* buildBundle(int version, int formulas)
+{
+    FormulaBundle* bundle = new FormulaBundle();
+    stringstream in(bundleText(version, formulas));
+    string error;
+    if (!readBundle(in, "bundle", *bundle, error))
+    {
+        cerr << error << endl;
+        exit(1);
+    }
+    return bundle;
+}
+
+struct ReaderState
+{
+    BundleStore* store;
+    int reader;
+    const atomic<bool>* stop;
+    atomic<long> seen; // latest version this reader entered
+
+    long operations;
+    long mismatches;
+    Vector<double> latencies; // seconds per enter() .. leave()
+};
+
+// Evaluates every formula of 'bundle', and returns false if one of them
+// comes from another version
+bool evaluateBundle(const FormulaBundle& bundle)
+{
+    bool consistent = true;
+    for (int i = 0; i < bundle.programs.getSize(); i++)
+    {
+        double result = 0;
+        evaluateFormula(bundle, i, result);
+        if (floor(result / 1000) != bundle.version)
+            consistent = false;
+    }
+    return consistent;
+}
+
+void readerLoop(ReaderState* state)
+{
+    int reader = state->reader;
+    while (!state->stop->load(memory_order_relaxed))
+    {
+        Clock::time_point start = Clock::now();
+        const FormulaBundle* bundle = state->store->enter(reader);
+        long version = bundle->version;
+        bool consistent = evaluateBundle(*bundle);
+        state->store->leave(reader);
+        Clock::time_point end = Clock::now();
+
+        state->latencies.pushBack(secondsBetween(start, end));
+        state->seen.store(version, memory_order_relaxed);
+        state->operations++;
+        if (!consistent)
+            state->mismatches++;
+    }
+}
+
+// Runs the readers for 'seconds', publishing 'reloads' new versions spread
+// over that time. Returns false if a reader saw a mixed bundle.
+bool runReaders(BundleStore& store, const Vector<int>& slots, int reloads,
+    double seconds, int formulas, int& version)
+{
+    int readers = slots.getSize();
+    atomic<bool> stop(false);
+    ReaderState* states = new ReaderState[readers];
+    Vector<thread*> threads;
+    for (int r = 0; r < readers; r++)
+    {
+        states[r].store      = &store;
+        states[r].reader     = slots[r];
+        states[r].stop       = &stop;
+        states[r].seen.store(0);
+        states[r].operations = 0;
+        states[r].mismatches = 0;
+        threads.pushBack(new thread(readerLoop, &states[r]));
+    }
+
+    Vector<double> readTimes, publishTimes, reclaimTimes, propagationTimes;
+    int pending = 0;
+    Clock::time_point start = Clock::now();
+    for (int n = 0; n < reloads; n++)
+    {
+        this_thread::sleep_until(start + chrono::duration_cast<Clock::duration>(
+            chrono::duration<double>(seconds * n / reloads)));
+
+        Clock::time_point before = Clock::now();
+        FormulaBundle* bundle = buildBundle(++version, formulas);
+        Clock::time_point read = Clock::now();
+        store.publish(bundle);
+        Clock::time_point published = Clock::now();
+        pending = store.reclaim();
+        Clock::time_point reclaimed = Clock::now();
+
+        // Until every reader has entered the new version
+        for (int r = 0; r < readers; r++)
+            while (states[r].seen.load(memory_order_relaxed) < version)
+                this_thread::yield();
+        Clock::time_point seen = Clock::now();
+
+        readTimes.pushBack(secondsBetween(before, read));
+        publishTimes.pushBack(secondsBetween(read, published));
+        reclaimTimes.pushBack(secondsBetween(published, reclaimed));
+        propagationTimes.pushBack(secondsBetween(published, seen));
+    }
+    this_thread::sleep_until(start + chrono::duration_cast<Clock::duration>(
+        chrono::duration<double>(seconds)));
+    stop.store(true);
+    for (int r = 0; r < readers; r++)
+    {
+        threads[r]->join();
+        delete threads[r];
+    }
+    double elapsed = secondsBetween(start, Clock::now());
+
+    long operations = 0, mismatches = 0;
+    Vector<double> latencies;
+    for (int r = 0; r < readers; r++)
+    {
+        operations += states[r].operations;
+        mismatches += states[r].mismatches;
+        for (int i = 0; i < states[r].latencies.getSize(); i++)
+            latencies.pushBack(states[r].latencies[i]);
+    }
+    delete[] states;
+    sortSamples(latencies);
+
+    cout << fixed << setprecision(1);
+    cout << (reloads > 0 ? "With reloads:    " : "Without reloads: ")
+         << operations / elapsed / 1000 << "k evaluations of the bundle per second, "
+         << "latency p50 " << percentile(latencies, 50) * 1e6
+         << " us, p99.9 " << percentile(latencies, 99.9) * 1e6
+         << " us, max " << percentile(latencies, 100) * 1e6 << " us" << endl;
+
+    if (reloads > 0)
+    {
+        sortSamples(readTimes);
+        sortSamples(publishTimes);
+        sortSamples(reclaimTimes);
+        sortSamples(propagationTimes);
+        cout << setprecision(2);
+        cout << "  read bundle:   p50 " << percentile(readTimes, 50) * 1e6
+             << " us, max " << percentile(readTimes, 100) * 1e6 << " us" << endl;
+        cout << "  publish:       p50 " << percentile(publishTimes, 50) * 1e6
+             << " us, p99 " << percentile(publishTimes, 99) * 1e6
+             << " us, max " << percentile(publishTimes, 100) * 1e6 << " us" << endl;
+        cout << "  reclaim:       p50 " << percentile(reclaimTimes, 50) * 1e6
+             << " us, max " << percentile(reclaimTimes, 100) * 1e6 << " us" << endl;
+        cout << "  seen by all:   p50 " << percentile(propagationTimes, 50) * 1e6
+             << " us, p99 " << percentile(propagationTimes, 99) * 1e6
+             << " us, max " << percentile(propagationTimes, 100) * 1e6 << " us" << endl;
+        cout << "  retired bundles still in use after the last reclaim: "
+             << pending << endl;
+    }
+
+    if (mismatches > 0)
+    {
+        cout << "ERROR: " << mismatches << " evaluations mixed two versions" << endl;
+        return false;
+    }
+    return true;
+}
+
+struct ShortReaderState
+{
+    BundleStore* store;
+    bool registered; // whether addReader() found a free slot
+    long mismatches;
+};
+
+// A reader thread that evaluates the bundle a few times and stops
+void shortReader(ShortReaderState* state)
+{
+    int reader = state->store->addReader();
+    state->registered = reader >= 0;
+    if (reader < 0)
+        return;
+
+    for (int n = 0; n < 20; n++)
+    {
+        const FormulaBundle* bundle = state->store->enter(reader);
+        if (!evaluateBundle(*bundle))
+            state->mismatches++;
+        state->store->leave(reader);
+    }
+    state->store->removeReader(reader);
+}
+
+// Starts 'readers' short-lived reader threads at a time, in enough waves
+// that twice as many threads as there are reader slots come and go, and
+// publishes a new version during each wave. Returns false if a thread found
+// no free slot or saw a mixed bundle.
+bool runShortReaders(BundleStore& store, int readers, int formulas, int& version)
+{
+    int waves = 2 * BundleStore::MAX_READERS / readers + 1;
+    long unregistered = 0, mismatches = 0;
+    Clock::time_point start = Clock::now();
+    for (int w = 0; w < waves; w++)
+    {
+        ShortReaderState* states = new ShortReaderState[readers];
+        Vector<thread*> threads;
+        for (int r = 0; r < readers; r++)
+        {
+            states[r].store      = &store;
+            states[r].registered = false;
+            states[r].mismatches = 0;
+            threads.pushBack(new thread(shortReader, &states[r]));
+        }
+
+        store.publish(buildBundle(++version, formulas));
+        store.reclaim();
+
+        for (int r = 0; r < readers; r++)
+        {
+            threads[r]->join();
+            delete threads[r];
+            if (!states[r].registered)
+                unregistered++;
+            mismatches += states[r].mismatches;
+        }
+        delete[] states;
+    }
+
+    cout << fixed << setprecision(1);
+    cout << "Short-lived readers: " << waves * readers << " threads took and gave back "
+         << "a slot in " << secondsBetween(start, Clock::now()) * 1e3 << " ms" << endl;
+    if (unregistered > 0)
+    {
+        cout << "ERROR: " << unregistered << " readers found no free slot" << endl;
+        return false;
+    }
+    if (mismatches > 0)
+    {
+        cout << "ERROR: " << mismatches << " evaluations mixed two versions" << endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    int defaultReaders = (int) thread::hardware_concurrency();
+    int readers     = (argc > 1) ? atoi(argv[1]) : (defaultReaders > 1 ? defaultReaders : 2);
+    int reloads     = (argc > 2) ? atoi(argv[2]) : 200;
+    double seconds  = (argc > 3) ? atof(argv[3]) : 2;
+    int formulas    = (argc > 4) ? atoi(argv[4]) : 100;
+    if (readers < 1 || readers > BundleStore::MAX_READERS || reloads < 1 ||
+        formulas < 1 || formulas > 500)
+    {
+        cerr << "Usage: reload_bench [readers] [reloads] [seconds] [formulas <= 500]" << endl;
+        return 1;
+    }
+
+    cout << readers << " readers, " << formulas << " formulas per bundle, "
+         << reloads << " reloads in " << seconds << " s" << endl;
+
+    int version = 1;
+    BundleStore store(buildBundle(version, formulas));
+    Vector<int> slots;
+    for (int r = 0; r < readers; r++)
+        slots.pushBack(store.addReader());
+    bool ok = runReaders(store, slots, 0, seconds, formulas, version) &&
+              runReaders(store, slots, reloads, seconds, formulas, version);
+    for (int r = 0; r < readers; r++)
+        store.removeReader(slots[r]);
+    ok = ok && runShortReaders(store, readers, formulas, version);
+
+    int left = store.reclaim();
+    cout << "Retired bundles left once the readers stopped: " << left << endl;
+    if (left != 0)
+        ok = false;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+
+// File:   scaling_bench.cpp
+// Times every stage of the pipeline on expressions from 10^3 tokens up to
+// 10^N tokens, in three shapes:
+//   long   x0 * 1.5 + x1 - x2 / 3 + ...      a flat chain of operators
+//   deep   x0 + ( x1 * ( x2 - ( ... ) ) )    nested as deep as it is long
+//   names  v0000000 + v0000001 + ...         a new variable in every operand
+// The deep shape keeps a quarter of its tokens on the operation stack of
+// shuntingYard() and on the value stacks of the evaluators at once. The
+// names shape has half as many variables as tokens, in sorted order, which
+// is the worst case for a map that is not balanced; it stops at 10^6
+// tokens, as every variable also needs a value. Every stage should take the
+// same time per token at every size: none of them rescans, recurses, has a
+// fixed-size stack or looks names up in a degenerate tree.
+// The last column parses and evaluates the text of the expression with
+// StreamParser and StreamEvaluator, 64 KB at a time, the way the driver
+// handles lines too long to hold.
+//
+// Build: g++ -std=c++17 -O2 -I.. scaling_bench.cpp -o scaling_bench
+// Usage: scaling_bench [largest power of 10, default 7]
+// Each token takes about 70 bytes across the text, the infix and postfix
+// vectors and the program, so 10^8 tokens need about 8 GB of memory.
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cstdlib>
+#include <chrono>
+#include "../Calculator.h"
+#include "../Program.h"
+#include "../PersistentMap.h"
+#include "../StreamParser.h"
+#include "../ExpressionGenerator.h"
+using namespace std;
+
+const int VARIABLES = 8;
+
+// Binary operators, cycled through
+const char* operators[] = {"+", "*", "-", "/"};
+
+// Appends a flat expression of about 'length' tokens to 'tokens'
+void buildLong(long length, Vector<string>& tokens)
+{
+    tokens.pushBack(generatorVariable(0));
+    for (long i = 1; i + 1 < length; i += 2)
+    {
+        tokens.pushBack(operators[(i / 2) % 4]);
+        tokens.pushBack((i % 3 == 0) ? string("1.5") : generatorVariable(i % VARIABLES));
+    }
+}
+
+// Appends a right-nested expression of about 'length' tokens to 'tokens'
+void buildDeep(long length, Vector<string>& tokens)
+{
+    long depth = length / 4;
+    for (long i = 0; i < depth; i++)
+    {
+        tokens.pushBack(generatorVariable(i % VARIABLES));
+        tokens.pushBack(operators[i % 4]);
+        tokens.pushBack("(");
+    }
+    tokens.pushBack(generatorVariable(0));
+    for (long i = 0; i < depth; i++)
+        tokens.pushBack(")");
+}
+
+// The name of variable 'index' of the names shape, padded so that the
+// names sort in the order they appear
+string distinctName(long index)
+{
+    stringstream name;
+    name << "v" << setw(7) << setfill('0') << index;
+    return name.str();
+}
+
+// Appends a flat sum of about 'length' tokens, each operand a new
+// variable, to 'tokens', and gives every variable a value in 'variables'
+void buildNames(long length, Vector<string>& tokens,
+    PersistentMap<string, double>& variables)
+{
+    for (long i = 0; 2 * i + 1 < length; i++)
+    {
+        if (i > 0)
+            tokens.pushBack("+");
+        tokens.pushBack(distinctName(i));
+        variables.insert(tokens[tokens.getSize() - 1], 1 + (i % VARIABLES) * 0.125);
+    }
+}
+
+double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    int largest = (argc > 1) ? atoi(argv[1]) : 7;
+
+    // As in the driver, whose variables are in a PersistentMap too
+    PersistentMap<string, double> common;
+    Vector<double> inputs;
+    for (int v = 0; v < VARIABLES; v++)
+        common.insert(generatorVariable(v), 1 + v * 0.125);
+
+    Map<string, Function> noFunctions;
+
+    cout << "                       ns per token\n";
+    cout << "shape      tokens   shuntingYard  evaluatePostfix  compileProgram"
+            "  evaluateProgram  streamed\n";
+
+    const char* shapes[] = {"long", "deep", "names"};
+    for (int shape = 0; shape < 3; shape++)
+    {
+        long length = 1000;
+        for (int power = 3; power <= largest && (shape < 2 || power <= 6);
+             power++, length *= 10)
+        {
+            Vector<string> tokens, postfix;
+            PersistentMap<string, double> variables = common;
+            if (shape == 0)
+                buildLong(length, tokens);
+            else if (shape == 1)
+                buildDeep(length, tokens);
+            else
+                buildNames(length, tokens, variables);
+            double count = tokens.getSize();
+            string text = joinTokens(tokens);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            bool parsed = shuntingYard(tokens, 0, postfix);
+            double parse = secondsSince(start);
+
+            double expected = 0;
+            start = chrono::steady_clock::now();
+            bool evaluated = parsed && evaluatePostfix(postfix, variables, expected);
+            double interpret = secondsSince(start);
+
+            // The infix tokens are no longer needed
+            tokens = Vector<string>();
+
+            typedef StreamEvaluator<double, PersistentMap, double> Evaluator;
+            Evaluator evaluator(variables, noFunctions);
+            StreamParser<Evaluator> parser(evaluator);
+            const int CHUNK = 1 << 16;
+            double streamedResult = 0;
+            start = chrono::steady_clock::now();
+            bool streamed = true;
+            for (size_t offset = 0; streamed && offset < text.size(); offset += CHUNK)
+                streamed = parser.push(text.data() + offset, 
+                    (int) min((size_t) CHUNK, text.size() - offset));
+            streamed = streamed && parser.finish() && evaluator.finish(streamedResult);
+            double stream = secondsSince(start);
+            text = string();
+
+            Program program;
+            start = chrono::steady_clock::now();
+            bool compiled = evaluated && compileProgram(postfix, program);
+            double compile = secondsSince(start);
+
+            postfix = Vector<string>();
+
+            double actual = 0;
+            compiled = compiled && bindVariables(program, variables, inputs);
+            start = chrono::steady_clock::now();
+            if (compiled)
+                evaluateProgram(program, &inputs[0], actual);
+            double run = secondsSince(start);
+
+            if (!compiled || !streamed || !(expected == actual || expected != expected) ||
+                !(expected == streamedResult || expected != expected))
+            {
+                cout << "Failed at " << (long) count << " tokens\n";
+                return 1;
+            }
+
+            cout << left << setw(6) << shapes[shape] << right
+                 << setw(11) << (long) count << fixed << setprecision(1)
+                 << setw(15) << parse * 1e9 / count
+                 << setw(17) << interpret * 1e9 / count
+                 << setw(16) << compile * 1e9 / count
+                 << setw(17) << run * 1e9 / count
+                 << setw(10) << stream * 1e9 / count << "\n";
+            cout.unsetf(ios::fixed);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,142 @@
+
+// File:   snapshot_bench.cpp
+// What-if scenarios over a large variable environment: every scenario
+// forks the environment, changes a few variables and evaluates a formula.
+// Forking a Map deep-copies every node; forking a PersistentMap shares
+// them and copies only the paths to the changed variables. Also compares
+// the cost of a lookup, and times a begin / assign / rollback block.
+//
+// Build: g++ -std=c++17 -O2 -I.. snapshot_bench.cpp -o snapshot_bench
+// Usage: snapshot_bench [variables] [scenarios] [changes per scenario]
+
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include "../Calculator.h"
+#include "../Program.h"
+#include "../PersistentMap.h"
+#include "../ExpressionGenerator.h"
+using namespace std;
+
+volatile double benchmarkSink;
+
+double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+    int variables = (argc > 1) ? atoi(argv[1]) : 1000000;
+    int scenarios = (argc > 2) ? atoi(argv[2]) : 10000;
+    int changes   = (argc > 3) ? atoi(argv[3]) : 10;
+    Random random(1);
+
+    // Names in random order, so that the plain Map stays reasonably
+    // balanced too
+    Vector<string> names(variables);
+    for (int i = 0; i < variables; i++)
+        names[i] = generatorVariable(i);
+    for (int i = variables - 1; i > 0; i--)
+    {
+        int j = random.below(i + 1);
+        string swap = names[i]; names[i] = names[j]; names[j] = swap;
+    }
+
+    Map<string, double> plain;
+    PersistentMap<string, double> persistent;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < variables; i++)
+        plain.insert(names[i], i * 0.5);
+    double plainBuild = secondsSince(start);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < variables; i++)
+        persistent.insert(names[i], i * 0.5);
+    double persistentBuild = secondsSince(start);
+
+    // The formula every scenario evaluates
+    Vector<string> tokens, postfix;
+    tokenize("x0 * 1.05 + x1 - x2 / 4", tokens);
+    Program program;
+    if (!shuntingYard(tokens, 0, postfix) || !compileProgram(postfix, program))
+        return 1;
+
+    // A few deep copies of the Map are enough to see what one costs
+    int plainForks = (scenarios < 5) ? scenarios : 5;
+    double checksum = 0;
+    start = chrono::steady_clock::now();
+    for (int s = 0; s < plainForks; s++)
+    {
+        Map<string, double> scenario(plain);
+        for (int c = 0; c < changes; c++)
+            scenario.insert(generatorVariable(random.below(variables)), c);
+        Vector<double> inputs;
+        double result = 0;
+        if (bindVariables(program, scenario, inputs))
+            evaluateProgram(program, &inputs[0], result);
+        checksum += result;
+    }
+    double plainFork = secondsSince(start) / plainForks;
+
+    start = chrono::steady_clock::now();
+    for (int s = 0; s < scenarios; s++)
+    {
+        PersistentMap<string, double> scenario(persistent);
+        for (int c = 0; c < changes; c++)
+            scenario.insert(generatorVariable(random.below(variables)), c);
+        Vector<double> inputs;
+        double result = 0;
+        if (bindVariables(program, scenario, inputs))
+            evaluateProgram(program, &inputs[0], result);
+        checksum += result;
+    }
+    double persistentFork = secondsSince(start) / scenarios;
+
+    // Lookups of random variables
+    const int LOOKUPS = 1000000;
+    Vector<string> keys(LOOKUPS);
+    for (int i = 0; i < LOOKUPS; i++)
+        keys[i] = generatorVariable(random.below(variables));
+    double value = 0;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < LOOKUPS; i++)
+    {
+        plain.search(keys[i], value);
+        checksum += value;
+    }
+    double plainLookup = secondsSince(start) / LOOKUPS;
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < LOOKUPS; i++)
+    {
+        persistent.search(keys[i], value);
+        checksum += value;
+    }
+    double persistentLookup = secondsSince(start) / LOOKUPS;
+
+    // An assignment block that is rolled back
+    start = chrono::steady_clock::now();
+    for (int s = 0; s < scenarios; s++)
+    {
+        persistent.begin();
+        for (int c = 0; c < changes; c++)
+            persistent.insert(keys[(s * changes + c) % LOOKUPS], c);
+        persistent.rollback();
+    }
+    double block = secondsSince(start) / scenarios;
+    benchmarkSink = checksum;
+
+    cout << variables << " variables, " << changes << " changes per scenario\n";
+    cout << fixed << setprecision(2);
+    cout << "                          Map   PersistentMap\n";
+    cout << "build (s)          " << setw(10) << plainBuild << setw(16) << persistentBuild << "\n";
+    cout << "fork + changes (us)" << setw(10) << plainFork * 1e6
+         << setw(16) << persistentFork * 1e6 << "   ("
+         << setprecision(0) << plainFork / persistentFork << "x)\n" << setprecision(2);
+    cout << "lookup (ns)        " << setw(10) << plainLookup * 1e9
+         << setw(16) << persistentLookup * 1e9 << "\n";
+    cout << scenarios << " forks take " << plainFork * scenarios << " s with Map, "
+         << persistentFork * scenarios << " s with PersistentMap\n";
+    cout << "begin + " << changes << " assignments + rollback: " << block * 1e6 << " us\n";
+    return 0;
+}
@@ -6,359 +6,1015 @@
 #include <iostream>
 #include <cstdlib>
 #include <sstream>
+#include <cstring>
 #include <cmath>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
 #include "Stack.h"
 #include "Vector.h"
 #include "Map.h"
+#include "PersistentMap.h"
+#include "NumberFormat.h"
+#include "Calculator.h"
+#include "Program.h"
+#include "Derivative.h"
+#include "Diagnostics.h"
+#include "Profile.h"
+#include "Benchmark.h"
+#include "Parallel.h"
+#include "StreamParser.h"
 using namespace std;
 
 
-// Returns the precedence of a given string by variable reference
+// Prints what went wrong with 'expression'. The diagnostic's token is an
+// index into 'expression', or -1 for the end of it.
 
-void currentPrecedence(string value, int& precedenceValue)
+void printError(const Vector<string>& expression, const Diagnostic& diagnostic)
 {
-    if      (value == "(")      precedenceValue = 0;
-    else if (value == "min")    precedenceValue = 3;
-    else if (value == "max")    precedenceValue = 3;
-    else if (value == "sin")    precedenceValue = 3;
-    else if (value == "cos")    precedenceValue = 3;
-    else if (value == "tan")    precedenceValue = 3;   
-    else if (value == "*")      precedenceValue = 2;
-    else if (value == "/")      precedenceValue = 2;
-    else if (value == "+")      precedenceValue = 1;
-    else if (value == "-")      precedenceValue = 1;
+    cout << errorMessage(diagnostic.code);
+    if (diagnostic.token >= 0 && diagnostic.token < expression.getSize())
+    {
+        cout << " at token " << diagnostic.token + 1 << " ('" 
+             << expression[diagnostic.token] << "')";
+    }
+    else if (diagnostic.code == ERROR_MISSING_OPERAND || 
+        diagnostic.code == ERROR_EXTRA_VALUES)
+        cout << " at the end of the expression";
+    cout << ".\n";
 }
 
-// Pops operators from the operation stack, and pushes them onto postfix 
-// accordingly.
+// Turns the token of a diagnostic about a postfix expression into the index
+// of the infix token it came from, using the origins from shuntingYard().
 
-void movePrecedence(Stack<string>& opStack, Vector<string>& postfix, 
-    int operation, int& precedence)
+void traceDiagnostic(const Vector<int>& origins, Diagnostic& diagnostic)
 {
-    // Initialization & declaration
-    string value;
-    opStack.top(value);   
-    int precedenceValue = 0;
-        
-    // Pops one operator at a time accordingly   
-    while ((!opStack.isEmpty()) && (value != "(") && (operation <= precedence))
+    if (diagnostic.token >= 0 && diagnostic.token < origins.getSize())
+        diagnostic.token = origins[diagnostic.token];
+}
+
+// Fills in 'diagnostic' for a program bindVariables() failed on: the token
+// is the first use of the missing variable (for a variable used inside a
+// function, the call), also where specializeProgram() fused it into a
+// scaled variable. 'origins' is from compileProgram(). Returns false.
+
+bool reportUnbound(const Program& program, const Vector<int>& origins,
+    const PersistentMap<string, double>& variables, Diagnostic& diagnostic)
+{
+    int slot = findUnboundVariable(program, variables);
+    for (int i = 0; i < program.code.getSize(); i++)
     {
-        opStack.pop(value);        
-        
-        if (value != "(")
-            postfix.pushBack(value);
-                  
-        if (value == "(")
-            opStack.push(value);
-        
-        if (!opStack.isEmpty())
-        {           
-            // Need to update the operator and precedence on the operation stack.
-            opStack.top(value);
-            currentPrecedence(value, precedenceValue);
-            precedence = precedenceValue;
-        }
-        else
-            precedence = 0;               
-    }  
+        const Instruction& instruction = program.code[i];
+        if ((instruction.opcode == OP_VARIABLE && instruction.operand == slot) ||
+            (instruction.opcode == OP_SCALE_VARIABLE &&
+             (instruction.operand & 0xffff) == slot))
+            return report(&diagnostic, ERROR_UNDEFINED_VARIABLE, origins[i]);
+    }
+    return report(&diagnostic, ERROR_UNDEFINED_VARIABLE, -1);
 }
 
-// Returns the two values that arithmetic will be performed on by variable reference.
+// Evaluates a compiled expression in the numeric type T and hands the 
+// result back as a double, which is what the variable map stores. 'origins' 
+// holds the postfix index of every instruction. On failure 'diagnostic' 
+// tells why, with the index of the postfix token at fault. Division by zero 
+// is an error, and with 'strict' so is any result that is NaN or infinite.
 
-bool operatorValues(Stack<double>& auxStack, double& value1, double& value2,
-    int trigFunc)
+template <class T>
+bool evaluateAs(const Program& program, const Vector<int>& origins,
+    const PersistentMap<string, double>& variables, bool strict, double& result,
+    Diagnostic& diagnostic)
 {
-    // Error checking for malformed expressions
-    if (auxStack.size() >= 2 && trigFunc == 0)   
+    Vector<T> inputs;
+    if (!bindVariables(program, variables, inputs))
+        return reportUnbound(program, origins, variables, diagnostic);
+    
+    T value;
+    if (!evaluateProgram(program, (inputs.getSize() > 0) ? &inputs[0] : NULL, 
+        value, &diagnostic))
     {
-        // pop 2nd value
-        auxStack.pop(value2);
+        diagnostic.token = origins[diagnostic.token];
+        return false;
+    }
+    
+    if (NumericTraits<T>::overflowed(value))
+        return report(&diagnostic, ERROR_OUT_OF_RANGE, -1);
+    
+    result = NumericTraits<T>::toDouble(value);
+    if (strict && !isfinite(result))
+        return report(&diagnostic, ERROR_NOT_FINITE, -1);
+    return true;
+}
+
+typedef bool (*EvaluateFunction)(const Program&, const Vector<int>&, 
+    const PersistentMap<string, double>&, bool, double&, Diagnostic&);
+
+// Evaluates 'postfix' with 'evaluate'. The expression is compiled on first 
+// use and kept in 'cache'; compiling inlines the calls to user-defined 
+// functions. If 'profile' is given the evaluation is recorded in it.
 
-        // pop 1st value
-        auxStack.pop(value1);
+bool evaluateExpression(const Vector<string>& postfix, 
+    const PersistentMap<string, double>& variables, 
+    const Map<string, Function>& functions, ProgramCache& cache, 
+    Profile* profile, EvaluateFunction evaluate, bool strict, double& result, 
+    Diagnostic& diagnostic)
+{
+    int entry = 0;
+    if (!findProgram(cache, postfix, functions, entry, &diagnostic))
+        return false;
+    
+    if (profile != NULL)
+        recordEvaluation(*profile, postfix, cache.programs[entry]);
+    
+    return evaluate(cache.programs[entry], cache.origins[entry], variables, 
+        strict, result, diagnostic);
+}
+
+// Returns true if 'expression' has the shape of a function definition such
+// as "f ( x , y ) = x * y + sin ( x )", and sets 'body' to the index of the
+// first token after the "=".
+
+bool isDefinition(const Vector<string>& expression, int& body)
+{
+    // Find the closing parenthesis of the parameter list
+    int close = 2;
+    while (close < expression.getSize() && expression[close] != ")")
+        close++;
+    
+    if (expression.getSize() < 5 || expression[1] != "(" || 
+        close + 1 >= expression.getSize() || expression[close + 1] != "=")
+        return false;
+    
+    body = close + 2;
+    return true;
+}
 
+// Reads the parameters of a function definition that isDefinition()
+// accepted. Returns false if they are not names separated by commas.
+
+bool readParameters(const Vector<string>& expression, int body, 
+    Vector<string>& parameters)
+{
+    // Parameters alternate with commas: "x , y , z". An even number of
+    // tokens means the list ends in a comma, as in "x ,".
+    int end = body - 2;
+    if (end > 2 && (end - 2) % 2 == 0)
+        return false;
+    
+    for (int i = 2; i < end; i++)
+    {
+        if ((i - 2) % 2 == 1)
+        {
+            if (expression[i] != ",")
+                return false;
+        }
+        else if (!isName(expression[i]))
+            return false;
+        else
+            parameters.pushBack(expression[i]);
+    }
+    return true;
+}
+
+// Handles a function definition such as "f ( x , y ) = x * y + sin ( x )".
+// Returns false if 'expression' does not have that shape, so the caller can 
+// treat it as an ordinary expression instead.
+
+bool defineFunction(const Vector<string>& expression, 
+    Map<string, Function>& functions)
+{
+    int body = 0;
+    if (!isDefinition(expression, body))
+        return false;
+    
+    Vector<string> parameters;
+    if (!readParameters(expression, body, parameters))
+    {
+        cout << "Expected parameter names separated by ','.\n";
         return true;
     }
-    else if (auxStack.size() >= 1 && trigFunc == 1)
+    
+    Vector<string> postfix;
+    Diagnostic diagnostic;
+    if (!shuntingYard(expression, body, functions, postfix, &diagnostic))
     {
-        // pop one value
-        auxStack.pop(value1);
-        
+        printError(expression, diagnostic);
         return true;
     }
-    else return false;
+    
+    Function function;
+    if (defineFunction(parameters, postfix, functions, function))
+    {
+        functions.insert(expression[0], function);
+        cout << "Defined " << expression[0] << " with " 
+             << parameters.getSize() << " parameter(s).\n";
+    }
+    else
+        cout << "Function body was malformed.\n";
+    
+    return true;
 }
 
-// This function will be given the infix expression provided by the user and will 
-// attempt to convert it to an equivalent postfix expression, that will be stored 
-// in ‘postfix’. This function will return true if we were able to perform the 
-// conversion and false if the expression is malformed. Shunting Yard algorithm 
-// will only fail if the parentheses are mismatched. It is possible for the 
-// expression to be invalid, but still pass through the shunting yard.
-
-bool shuntingYard(const Vector<string>& expression, const int startIndex, 
-    Vector<string>& postfix)
-{    
-    // Creating the auxiliary track (opStack object).
-    Stack<string> opStack;
-    
-    // Precedence levels    
-    int precedence      =  0;
-    int multiplication  =  2;
-    int division        =  2;
-    int addition        =  1;
-    int subtraction     =  1;
-    int nonOperator     = -1;
-    
-    for (int i = startIndex; i < expression.getSize(); i++)
-    {            
-        if (expression[i] == "(")
-        {
-            // Update precedence of operator being pushed onto the operation stack
-            currentPrecedence(expression[i], precedence);
-            opStack.push("(");
-        }
-        else if (expression[i] == ")")
-        {                                    
-            movePrecedence(opStack, postfix, nonOperator, precedence);
-            
-            string value;
-            opStack.top(value);
-            currentPrecedence(value, precedence);
-            
-            // Error checking for missing parenthesis.
-            if (value == "(")
-                opStack.pop(value);
-            else return false;
-            
-            // Update the precedence if there are remaining operators on the
-            // operation stack
-            opStack.top(value);
-            currentPrecedence(value, precedence);
-        }
-        else if (expression[i] == "min")
-        {
-            currentPrecedence(expression[i], precedence);            
-            opStack.push("min");
-        }
-        else if (expression[i] ==  "max")
-        {
-            currentPrecedence(expression[i], precedence);           
-            opStack.push("max");
-        }
-        else if (expression[i] == "sin")
-        {
-            currentPrecedence(expression[i], precedence);
-            opStack.push("sin");
-        }
-        else if (expression[i] == "cos")
-        {
-            currentPrecedence(expression[i], precedence);
-            opStack.push("cos");
-        }
-        else if (expression[i] == "tan")
-        {
-            currentPrecedence(expression[i], precedence);
-            opStack.push("tan");
-        }        
-        else if (expression[i] == "*")
+// Evaluates the expression after the leading "grad" and prints its value
+// together with its derivative with respect to every variable it uses.
+
+void printGradient(const Vector<string>& expression, 
+    const PersistentMap<string, double>& variables, 
+    const Map<string, Function>& functions, const NumberFormat& format)
+{
+    Vector<string> postfix;
+    Vector<int> origins;
+    Diagnostic diagnostic;
+    if (!shuntingYard(expression, 1, functions, postfix, &diagnostic, &origins))
+    {
+        printError(expression, diagnostic);
+        return;
+    }
+    
+    Program program;
+    Vector<int> instructionOrigins;
+    Vector<double> inputs;
+    bool valid = compileProgram(postfix, functions, program, &diagnostic, 
+        &instructionOrigins);
+    if (valid && !bindVariables(program, variables, inputs))
+        valid = reportUnbound(program, instructionOrigins, variables, diagnostic);
+    if (!valid)
+    {
+        traceDiagnostic(origins, diagnostic);
+        printError(expression, diagnostic);
+        return;
+    }
+    
+    double result = 0;
+    Vector<double> gradient;
+    GradientTape tape;
+    evaluateReverse(program, (inputs.getSize() > 0) ? &inputs[0] : NULL, 
+        result, gradient, tape);
+    
+    cout << "Result: " << formatNumber(result, format) << endl;
+    for (int i = 0; i < gradient.getSize(); i++)
+    {
+        cout << "d/d" << program.variables[i] << ": " 
+             << formatNumber(gradient[i], format) << endl;
+    }
+}
+
+// Prints how much memory the variables and functions are using.
+
+void printMemoryUsage(const PersistentMap<string, double>& variables, 
+    const Map<string, Function>& functions)
+{
+    cout << "Variables: " << variables.size() << " using " 
+         << variables.memoryUsage() << " bytes\n";
+    cout << "Functions: " << functions.size() << " using " 
+         << functions.memoryUsage() << " bytes\n";
+}
+
+// ----------------------------------------------------//
+// Input is read a chunk at a time. Lines up to STREAM_THRESHOLD characters
+// are handled whole; a longer one is parsed and evaluated while it is read
+// (see StreamParser.h), so it takes memory for its nesting depth only,
+// rather than for its text, its tokens and its postfix form.
+
+const int CHUNK_SIZE       = 1 << 16;
+const int STREAM_THRESHOLD = 1 << 20;
+
+// Outcomes of readLine()
+enum LineStatus
+{
+    LINE_COMPLETE,
+    LINE_TOO_LONG,
+    LINE_END_OF_INPUT
+};
+
+struct ChunkReader
+{
+    istream* in;
+    Vector<char> data;
+    int begin; // first unread character of data
+    int end;
+};
+
+// Makes sure there is unread input, reading the next chunk if needed.
+// Returns false at the end of the input.
+
+bool fillChunk(ChunkReader& reader)
+{
+    if (reader.begin < reader.end)
+        return true;
+    
+    reader.in->read(&reader.data[0], reader.data.getSize());
+    reader.begin = 0;
+    reader.end   = (int) reader.in->gcount();
+    return reader.end > 0;
+}
+
+// Reads the next line into 'line', without the newline, like getline().
+// Stops once 'line' holds 'limit' characters, leaving the rest unread.
+
+int readLine(ChunkReader& reader, string& line, int limit)
+{
+    line.clear();
+    while (fillChunk(reader))
+    {
+        const char* start = &reader.data[reader.begin];
+        const char* newline = (const char*) memchr(start, '\n', reader.end - reader.begin);
+        int length = (newline != NULL) ? (int) (newline - start) : reader.end - reader.begin;
+        
+        if ((int) line.size() + length > limit)
         {
-            if (multiplication > precedence)
-            {
-                currentPrecedence(expression[i], precedence);
-                opStack.push("*");
-            }
-            else
-            {                
-                movePrecedence(opStack, postfix, multiplication, precedence);
-                
-                currentPrecedence(expression[i], precedence);
-                opStack.push("*");
-            }
-        }
-        else if (expression[i] == "/")
-        {        
-            if (division > precedence)
-            {
-                currentPrecedence(expression[i], precedence);
-                opStack.push("/");
-            }
-            else
-            {                
-                movePrecedence(opStack, postfix, division, precedence);
-                
-                currentPrecedence(expression[i], precedence);
-                opStack.push("/");
-            }
+            length = limit - (int) line.size();
+            line.append(start, length);
+            reader.begin += length;
+            return LINE_TOO_LONG;
         }
-        else if (expression[i] == "+")
+        
+        line.append(start, length);
+        reader.begin += length;
+        if (newline != NULL)
         {
-            if (addition > precedence)
-            {
-                currentPrecedence(expression[i], precedence);
-                opStack.push("+");
-            }
-            else
-            {                
-                movePrecedence(opStack, postfix, addition, precedence);
-                
-                currentPrecedence(expression[i], precedence);
-                opStack.push("+");
-            }
+            reader.begin++;
+            return LINE_COMPLETE;
         }
-        else if (expression[i] == "-")
+    }
+    return line.empty() ? LINE_END_OF_INPUT : LINE_COMPLETE;
+}
+
+// Passes the rest of the current line to 'parser', one chunk at a time, and
+// finishes it. Once the parser fails the rest of the line is only skipped.
+
+template <class Sink>
+bool streamLine(ChunkReader& reader, StreamParser<Sink>& parser, bool valid)
+{
+    while (fillChunk(reader))
+    {
+        const char* start = &reader.data[reader.begin];
+        const char* newline = (const char*) memchr(start, '\n', reader.end - reader.begin);
+        int length = (newline != NULL) ? (int) (newline - start) : reader.end - reader.begin;
+        
+        valid = valid && parser.push(start, length);
+        reader.begin += length;
+        if (newline != NULL)
         {
-            if (subtraction > precedence)
-            {
-                currentPrecedence(expression[i], precedence);
-                opStack.push("-");
-            }
-            else
-            {                   
-                movePrecedence(opStack, postfix, subtraction, precedence);
-                
-                currentPrecedence(expression[i], precedence);
-                opStack.push("-");
-            }
-        }
-        else
-        {            
-            // Pushing numbers directly onto postfix
-            postfix.pushBack(expression[i]);           
+            reader.begin++;
+            break;
         }
     }
+    return valid && parser.finish();
+}
+
+// Parses and evaluates a long line in the numeric type T. The expression 
+// starts at 'offset' in 'prefix', the part of the line already read, with 
+// token 'first', and goes on with the rest of the line in 'reader'. On 
+// failure 'diagnostic' tells why and 'token' is the text at fault, if known.
+
+template <class T>
+bool streamAs(const string& prefix, int offset, int first, ChunkReader& reader,
+    const PersistentMap<string, double>& variables, 
+    const Map<string, Function>& functions, bool strict, double& result,
+    Diagnostic& diagnostic, string& token)
+{
+    typedef StreamEvaluator<T, PersistentMap, double> Evaluator;
+    Evaluator evaluator(variables, functions, &diagnostic);
+    StreamParser<Evaluator> parser(evaluator, &diagnostic, first, &functions);
     
-    // Push the final operator in the operation stack onto postfix
-    movePrecedence(opStack, postfix, nonOperator, precedence);
+    bool valid = parser.push(prefix.data() + offset, (int) prefix.size() - offset);
+    T value;
+    if (!streamLine(reader, parser, valid) || !evaluator.finish(value))
+    {
+        token = parser.errorToken().empty() ? evaluator.errorToken() : 
+            parser.errorToken();
+        return false;
+    }
     
-    // Transforming infix to postfix was a success if opStack is empty
-    if (opStack.isEmpty())
-        return true;
-    else return false;
+    result = NumericTraits<T>::toDouble(value);
+    if (strict && !isfinite(result))
+        return report(&diagnostic, ERROR_NOT_FINITE, -1);
+    return true;
 }
 
-// This function will be given the postfix expression produced by the 
-// Shunting Yard algorithm as input. It will attempt to evaluate the expression, 
-// returning true if evaluation was successful. If evaluation fails 
-// (because the postfix expression was invalid), the function will return false 
-// instead. The result will be saved in ‘result’ if the function returns true.
-// Including variable map as an input. Values will be inserted into 
-// the variable map in the driver, and they will be retrieved in 
-// evaluatePostfix(). At any point in time, all variables that have been 
-// assigned by the program so far will be stored in the variable map.
-
-bool evaluatePostfix(const Vector<string>& postfix,
-    const Map<string, double>& variables, double& result)
-{   
-    // Declaring & initializing
-    double value1 = 0;
-    double value2 = 0;
-    // To differentiate between a trig function and non trig function string
-    int trigFunc = 0;
-    
-    // Creating the auxiliary track (auxStack object).
-    Stack<double> auxStack;
-    
-    for (int i = 0; i < postfix.getSize(); i++)
-    {           
-        if (postfix.get(i) == "min")
+typedef bool (*StreamFunction)(const string&, int, int, ChunkReader&,
+    const PersistentMap<string, double>&, const Map<string, Function>&, bool,
+    double&, Diagnostic&, string&);
+
+// Handles a line longer than STREAM_THRESHOLD, of which 'prefix' has been
+// read. It can be an expression or an assignment, and is printed like an 
+// ordinary line except for its postfix form, which is never held whole.
+
+void evaluateLongLine(const string& prefix, ChunkReader& reader,
+    PersistentMap<string, double>& variables, const Map<string, Function>& functions,
+    StreamFunction stream, bool strict, const NumberFormat& format)
+{
+    // The first few tokens tell an assignment from an expression, and
+    // catch what cannot be streamed
+    const int HEAD_TOKENS = 64;
+    Vector<string> head;
+    Vector<int> ends;
+    string token;
+    int offset = 0;
+    while (head.getSize() < HEAD_TOKENS && (offset = nextToken(prefix, offset, token)) >= 0)
+    {
+        head.pushBack(token);
+        ends.pushBack(offset);
+    }
+    
+    int body = 0;
+    bool unsupported = (head.getSize() > 0 && head[0] == "grad") || 
+        isDefinition(head, body);
+    bool assignment = !unsupported && head.getSize() >= 3 && head[1] == "=";
+    int first = assignment ? 2 : 0;
+    int start = assignment ? ends[1] : 0;
+    
+    Diagnostic diagnostic = {ERROR_NONE, -1};
+    double result = 0;
+    if (unsupported)
+    {
+        // Skip the rest of the line
+        string rest;
+        while (readLine(reader, rest, STREAM_THRESHOLD) == LINE_TOO_LONG);
+        cout << "Lines longer than " << STREAM_THRESHOLD << " characters can only"
+             << " be expressions or assignments.\n";
+    }
+    else if (stream(prefix, start, first, reader, variables, functions, strict, 
+        result, diagnostic, token))
+    {
+        if (assignment)
+            variables.insert(head[0], result);
+        cout << "Postfix: (not printed for lines longer than " << STREAM_THRESHOLD
+             << " characters)\n";
+        cout << "Result: " << formatNumber(result, format) << endl;
+    }
+    else
+    {
+        cout << errorMessage(diagnostic.code);
+        if (diagnostic.token >= 0)
         {
-            if (operatorValues(auxStack, value1, value2, trigFunc))
-                // Compute arithmetic and push it onto the auxiliary stack
-                auxStack.push(fmin (value1, value2));
-            else return false;            
+            cout << " at token " << diagnostic.token + 1;
+            if (!token.empty())
+                cout << " ('" << token << "')";
         }
-        else if (postfix.get(i) == "max")
+        else if (diagnostic.code == ERROR_MISSING_OPERAND || 
+            diagnostic.code == ERROR_EXTRA_VALUES)
+            cout << " at the end of the expression";
+        cout << ".\n";
+    }
+}
+
+// ----------------------------------------------------//
+// The "bench" command replays a file of driver input (expressions,
+// assignments, function definitions, begin/commit/rollback) without
+// printing, and measures each stage: parse (tokenizing and shuntingYard()),
+// compile (compileProgram() and function definitions) and evaluate
+// (binding variables and evaluateProgram()). Each iteration starts with no
+// variables or functions, and runs every stage over the whole file before
+// the next one, so reading the counters never lands inside a stage.
+
+// Kinds of lines in a benchmark file
+enum BenchLine
+{
+    BENCH_EXPRESSION,
+    BENCH_ASSIGNMENT,
+    BENCH_DEFINITION,
+    BENCH_BEGIN,
+    BENCH_COMMIT,
+    BENCH_ROLLBACK,
+    BENCH_SKIPPED   // empty, a comment, or a command that only prints
+};
+
+enum BenchStage
+{
+    STAGE_PARSE,
+    STAGE_COMPILE,
+    STAGE_EVALUATE,
+    STAGE_COUNT
+};
+
+struct BenchOptions
+{
+    int iterations;
+    int warmup;
+    int cpu;        // -1 to leave the thread where it is
+    string save;    // file for the per-iteration results, if any
+    string label;
+};
+
+// What one iteration produces for every line, kept between stages
+struct BenchState
+{
+    Vector< Vector<string> > tokens;
+    Vector<int> kinds;
+    Vector< Vector<string> > postfixes;
+    // Calls to user-defined functions, checked once they are defined
+    Vector< Vector<int> > calls;
+    Vector< Vector<int> > counts;
+    Vector<Program> programs;
+    Vector<bool> valid;
+    Vector<double> latencies; // seconds per line, all stages together
+    int errors;
+};
+
+double secondsBetween(chrono::steady_clock::time_point start, 
+    chrono::steady_clock::time_point end)
+{
+    return chrono::duration<double>(end - start).count();
+}
+
+// Runs the parse stage over all lines.
+
+void benchParse(const Vector<string>& lines, BenchState& state)
+{
+    for (int i = 0; i < lines.getSize(); i++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        
+        Vector<string>& expression = state.tokens[i];
+        expression.clear();
+        tokenize(lines[i], expression);
+        
+        int kind = BENCH_EXPRESSION;
+        int first = 0;
+        if (expression.getSize() == 0 || expression[0][0] == '#' ||
+            expression[0] == "memory" || expression[0] == "grad")
+            kind = BENCH_SKIPPED;
+        else if (expression.getSize() == 1 && expression[0] == "begin")
+            kind = BENCH_BEGIN;
+        else if (expression.getSize() == 1 && expression[0] == "commit")
+            kind = BENCH_COMMIT;
+        else if (expression.getSize() == 1 && expression[0] == "rollback")
+            kind = BENCH_ROLLBACK;
+        else if (isDefinition(expression, first))
+            kind = BENCH_DEFINITION;
+        else if (expression.getSize() >= 3 && expression[1] == "=")
         {
-            if (operatorValues(auxStack, value1, value2, trigFunc))
-                // Compute arithmetic and push it onto the auxiliary stack
-                auxStack.push(fmax (value1, value2));
-            else return false;            
+            kind  = BENCH_ASSIGNMENT;
+            first = 2;
         }
-        else if (postfix.get(i) == "sin")
+        state.kinds[i] = kind;
+        
+        state.postfixes[i].clear();
+        state.calls[i].clear();
+        state.counts[i].clear();
+        state.valid[i] = (kind != BENCH_EXPRESSION && kind != BENCH_ASSIGNMENT &&
+            kind != BENCH_DEFINITION) || 
+            shuntingYard(expression, first, state.postfixes[i], NULL, NULL,
+                &state.calls[i], &state.counts[i]);
+        
+        state.latencies[i] = secondsBetween(start, chrono::steady_clock::now());
+    }
+}
+
+// Runs the compile stage over all lines. Functions are defined in order,
+// so later lines can call them.
+
+void benchCompile(BenchState& state, Map<string, Function>& functions)
+{
+    for (int i = 0; i < state.kinds.getSize(); i++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        
+        int kind = state.kinds[i];
+        if (state.valid[i])
+            state.valid[i] = checkArguments(state.calls[i], state.counts[i], functions,
+                state.tokens[i]);
+        
+        if (state.valid[i] && kind == BENCH_DEFINITION)
         {
-            trigFunc = 1;            
-            if (operatorValues(auxStack, value1, value2, trigFunc))
-                // Compute arithmetic and push it onto the auxiliary stack
-                auxStack.push(sin (value1));
-            else return false;
+            int body = 0;
+            Vector<string> parameters;
+            Function function;
+            isDefinition(state.tokens[i], body);
+            state.valid[i] = readParameters(state.tokens[i], body, parameters) &&
+                defineFunction(parameters, state.postfixes[i], functions, function);
+            if (state.valid[i])
+                functions.insert(state.tokens[i][0], function);
         }
-        else if (postfix.get(i) == "cos")
+        else if (state.valid[i] && (kind == BENCH_EXPRESSION || kind == BENCH_ASSIGNMENT))
+            state.valid[i] = compileProgram(state.postfixes[i], functions, state.programs[i]);
+        
+        state.latencies[i] += secondsBetween(start, chrono::steady_clock::now());
+    }
+}
+
+// Runs the evaluate stage over all lines.
+
+void benchEvaluate(BenchState& state, PersistentMap<string, double>& variables)
+{
+    Vector<double> inputs;
+    for (int i = 0; i < state.kinds.getSize(); i++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        
+        int kind = state.kinds[i];
+        if      (kind == BENCH_BEGIN)    variables.begin();
+        else if (kind == BENCH_COMMIT)   variables.commit();
+        else if (kind == BENCH_ROLLBACK) variables.rollback();
+        else if (state.valid[i] && (kind == BENCH_EXPRESSION || kind == BENCH_ASSIGNMENT))
         {
-            trigFunc = 1;
-            if (operatorValues(auxStack, value1, value2, trigFunc))
-                // Compute arithmetic and push it onto the auxiliary stack
-                auxStack.push(cos (value1));
-            else return false;
+            const Program& program = state.programs[i];
+            double result = 0;
+            state.valid[i] = bindVariables(program, variables, inputs) &&
+                evaluateProgram(program, (inputs.getSize() > 0) ? &inputs[0] : NULL, 
+                    result);
+            if (state.valid[i] && kind == BENCH_ASSIGNMENT)
+                variables.insert(state.tokens[i][0], result);
         }
-        else if (postfix.get(i) == "tan")
-        {
-            trigFunc = 1;
-            if (operatorValues(auxStack, value1, value2, trigFunc))
-                // Compute arithmetic and push it onto the auxiliary stack
-                auxStack.push(tan (value1));
-            else return false;
-        }        
-        else if (variables.search(postfix[i], value1))
-        {
-            auxStack.push(value1);
-        }        
-        else if (postfix.get(i) == "+")
-        {         
-            if (operatorValues(auxStack, value1, value2, trigFunc))
-                // Compute arithmetic and push it onto the auxiliary stack
-                auxStack.push(value1 + value2);
-            else return false;
-        } 
-        else if (postfix.get(i) == "-")
-        {
-            if (operatorValues(auxStack, value1, value2, trigFunc))
-                auxStack.push(value1 - value2);
-            else return false;
-        } 
-        else if (postfix.get(i) == "*")
+        
+        state.latencies[i] += secondsBetween(start, chrono::steady_clock::now());
+        if (!state.valid[i])
+            state.errors++;
+    }
+}
+
+// Prints one counter per line, or "-" if it was not counted.
+
+void printPerLine(double count, double lines, int width)
+{
+    cout << setw(width);
+    if (count < 0)
+        cout << "-";
+    else
+        cout << count / lines;
+}
+
+// Replays the file 'path' as described above and prints the results.
+
+int runBenchmark(const string& path, const BenchOptions& options)
+{
+    ifstream in(path.c_str());
+    if (!in)
+    {
+        cout << "Cannot open " << path << "\n";
+        return 1;
+    }
+    Vector<string> lines;
+    string line;
+    while (getline(in, line))
+        lines.pushBack(line);
+    
+    int count = lines.getSize();
+    BenchState state;
+    state.tokens.resize(count);
+    state.kinds.resize(count);
+    state.postfixes.resize(count);
+    state.calls.resize(count);
+    state.counts.resize(count);
+    state.programs.resize(count);
+    state.valid.resize(count);
+    state.latencies.resize(count);
+    
+    bool pinned = options.cpu >= 0 && pinThread(options.cpu);
+    PerfCounters counters;
+    bool counted = openCounters(counters);
+    
+    CounterValues stages[STAGE_COUNT];
+    double stageSeconds[STAGE_COUNT] = {0, 0, 0};
+    for (int s = 0; s < STAGE_COUNT; s++)
+        stages[s] = zeroCounters(counters);
+    
+    BenchmarkRun run;
+    run.label = options.label.empty() ? path : options.label;
+    Vector<double> latencies;
+    long tokens = 0;
+    int errors = 0;
+    
+    for (int iteration = 0; iteration < options.warmup + options.iterations; iteration++)
+    {
+        bool measured = iteration >= options.warmup;
+        PersistentMap<string, double> variables;
+        Map<string, Function> functions;
+        state.errors = 0;
+        
+        chrono::steady_clock::time_point times[STAGE_COUNT + 1];
+        CounterValues readings[STAGE_COUNT + 1];
+        times[0]    = chrono::steady_clock::now();
+        readings[0] = readCounters(counters);
+        benchParse(lines, state);
+        times[1]    = chrono::steady_clock::now();
+        readings[1] = readCounters(counters);
+        benchCompile(state, functions);
+        times[2]    = chrono::steady_clock::now();
+        readings[2] = readCounters(counters);
+        benchEvaluate(state, variables);
+        times[3]    = chrono::steady_clock::now();
+        readings[3] = readCounters(counters);
+        
+        if (!measured)
+            continue;
+        
+        for (int s = 0; s < STAGE_COUNT; s++)
         {
-            if (operatorValues(auxStack, value1, value2, trigFunc))
-                auxStack.push(value1 * value2);
-            else return false;
-        } 
-        else if (postfix.get(i) == "/")
+            stageSeconds[s] += secondsBetween(times[s], times[s + 1]);
+            addCounters(stages[s], subtractCounters(readings[s + 1], readings[s]));
+        }
+        CounterValues total = subtractCounters(readings[STAGE_COUNT], readings[0]);
+        run.seconds.pushBack(secondsBetween(times[0], times[STAGE_COUNT]));
+        run.cycles.pushBack(total.values[COUNTER_CYCLES]);
+        run.instructions.pushBack(total.values[COUNTER_INSTRUCTIONS]);
+        
+        for (int i = 0; i < count; i++)
         {
-            if (operatorValues(auxStack, value1, value2, trigFunc))
-                auxStack.push(value1 / value2);
-            else return false;
+            if (state.kinds[i] != BENCH_SKIPPED)
+                latencies.pushBack(state.latencies[i]);
         }
+        errors = state.errors;
+    }
+    closeCounters(counters);
+    
+    for (int i = 0; i < count; i++)
+        tokens += state.tokens[i].getSize();
+    
+    int measured = options.iterations;
+    cout << "Benchmark of " << path << ": " << count << " lines, " << tokens 
+         << " tokens, " << errors << " lines with errors\n";
+    cout << options.warmup << " warmup and " << measured << " measured iterations";
+    if (pinned)
+        cout << ", pinned to CPU " << options.cpu;
+    cout << "\n";
+    if (!counted)
+        cout << "Hardware counters are not available here; times only.\n";
+    
+    cout << fixed << setprecision(3);
+    cout << "\nstage       ms/iteration   cycles/line  instr./line    IPC"
+            "  cache-misses/line  branch-misses/line\n";
+    CounterValues total = stages[0];
+    for (int s = 1; s < STAGE_COUNT; s++)
+        addCounters(total, stages[s]);
+    const char* names[] = {"parse", "compile", "evaluate", "total"};
+    for (int s = 0; s <= STAGE_COUNT; s++)
+    {
+        const CounterValues& counts = (s < STAGE_COUNT) ? stages[s] : total;
+        double seconds = (s < STAGE_COUNT) ? stageSeconds[s] :
+            stageSeconds[0] + stageSeconds[1] + stageSeconds[2];
+        double perLine = (double) count * measured;
+        
+        cout << left << setw(10) << names[s] << right << setw(14) 
+             << seconds * 1000 / measured << setprecision(1);
+        printPerLine(counts.values[COUNTER_CYCLES], perLine, 14);
+        printPerLine(counts.values[COUNTER_INSTRUCTIONS], perLine, 13);
+        cout << setw(7) << setprecision(2);
+        if (counts.values[COUNTER_CYCLES] > 0 && counts.values[COUNTER_INSTRUCTIONS] >= 0)
+            cout << counts.values[COUNTER_INSTRUCTIONS] / counts.values[COUNTER_CYCLES];
         else
+            cout << "-";
+        cout << setprecision(3);
+        printPerLine(counts.values[COUNTER_CACHE_MISSES], perLine, 19);
+        printPerLine(counts.values[COUNTER_BRANCH_MISSES], perLine, 20);
+        cout << "\n";
+    }
+    
+    double average = mean(run.seconds);
+    double deviation = sqrt(variance(run.seconds));
+    cout << setprecision(0) << "\nThroughput: " << count / average << " lines/s, "
+         << tokens / average << " tokens/s (iteration time " << setprecision(3)
+         << average * 1000 << " ms, sd " << deviation * 1000 << " ms)\n";
+    
+    sortSamples(latencies);
+    cout << "Latency per line (us): p50 " << percentile(latencies, 50) * 1e6
+         << ", p90 " << percentile(latencies, 90) * 1e6
+         << ", p99 " << percentile(latencies, 99) * 1e6
+         << ", p99.9 " << percentile(latencies, 99.9) * 1e6
+         << ", max " << percentile(latencies, 100) * 1e6 << "\n";
+    cout.unsetf(ios::fixed);
+    
+    if (!options.save.empty())
+    {
+        if (!writeBenchmarkRun(options.save, run))
         {
-            // Converting string to double value.
-            double value = atof(postfix[i].c_str());
- 
-            // Pushing the double value directly onto the auxiliary stack
-            auxStack.push(value);
+            cout << "Could not write " << options.save << "\n";
+            return 1;
         }
+        cout << "Saved to " << options.save << "\n";
+    }
+    return 0;
+}
+
+// Compares two runs saved with "bench --save" and tells whether the
+// difference in iteration time is statistically significant.
+
+int compareBenchmarks(const string& firstPath, const string& secondPath)
+{
+    BenchmarkRun first, second;
+    string error;
+    if (!readBenchmarkRun(firstPath, first, error) || 
+        !readBenchmarkRun(secondPath, second, error))
+    {
+        cout << error << "\n";
+        return 1;
+    }
+    if (first.seconds.getSize() < 2 || second.seconds.getSize() < 2)
+    {
+        cout << "Each run needs at least 2 iterations to compare.\n";
+        return 1;
     }
     
-    // If there is only 1 element (result) in the auxiliary stack return true
-    if (auxStack.size() == 1)
+    const BenchmarkRun* runs[2] = {&first, &second};
+    cout << fixed << setprecision(3);
+    cout << "run                             iterations   mean (ms)     sd (ms)\n";
+    for (int r = 0; r < 2; r++)
     {
-        // Pop the result
-        auxStack.pop(result);
-        return true;
+        string label = runs[r]->label.substr(0, 30);
+        cout << left << setw(32) << label << right << setw(10) 
+             << runs[r]->seconds.getSize()
+             << setw(12) << mean(runs[r]->seconds) * 1000
+             << setw(12) << sqrt(variance(runs[r]->seconds)) * 1000 << "\n";
     }
-    else return false;
+    
+    Comparison time = welchTest(first.seconds, second.seconds);
+    double change = (mean(second.seconds) / mean(first.seconds) - 1) * 100;
+    cout << setprecision(2) << "\nTime: " << showpos << change << noshowpos
+         << "% (Welch's t = " << time.t << ", df = " << setprecision(1) 
+         << time.freedom << ", p = " << setprecision(4) << time.p << "): "
+         << (time.p < 0.05 ? "significant" : "not significant") 
+         << " at the 5% level\n";
+    
+    // Instructions are much less noisy than time, when both runs have them
+    if (mean(first.instructions) > 0 && mean(second.instructions) > 0)
+    {
+        Comparison counted = welchTest(first.instructions, second.instructions);
+        change = (mean(second.instructions) / mean(first.instructions) - 1) * 100;
+        cout << setprecision(2) << "Instructions: " << showpos << change << noshowpos
+             << "% (p = " << setprecision(4) << counted.p << ")\n";
+    }
+    cout.unsetf(ios::fixed);
+    return 0;
+}
+
+// Handles "bench ..." on the command line. Returns the exit status.
+
+int benchCommand(int argc, char* argv[])
+{
+    BenchOptions options = {20, 3, 0, "", ""};
+    string path;
+    for (int i = 2; i < argc; i++)
+    {
+        string option = argv[i];
+        if (option == "--compare" && i + 2 < argc)
+            return compareBenchmarks(argv[i + 1], argv[i + 2]);
+        else if (option == "--iterations" && i + 1 < argc)
+            options.iterations = atoi(argv[++i]);
+        else if (option == "--warmup" && i + 1 < argc)
+            options.warmup = atoi(argv[++i]);
+        else if (option == "--cpu" && i + 1 < argc)
+            options.cpu = atoi(argv[++i]);
+        else if (option == "--save" && i + 1 < argc)
+            options.save = argv[++i];
+        else if (option == "--label" && i + 1 < argc)
+            options.label = argv[++i];
+        else if (path.empty() && option[0] != '-')
+            path = option;
+        else
+            path.clear(), i = argc;
+    }
+    
+    if (path.empty() || options.iterations < 1 || options.warmup < 0)
+    {
+        cout << "Usage: " << argv[0] << " bench FILE [--iterations N] [--warmup N]"
+             << " [--cpu K | --cpu -1]\n"
+             << "             [--save RESULTS] [--label TEXT]\n"
+             << "       " << argv[0] << " bench --compare RESULTS RESULTS\n";
+        return 1;
+    }
+    return runBenchmark(path, options);
 }
 
 // Driver
 // Values will be inserted into the variable map in the driver, and they will 
 // be retrieved in evaluatePostfix().
+// Prefixing an expression with "grad" also prints its derivative with respect
+// to each variable, e.g. "grad x * y + sin ( x )".
+// Functions are defined with "f ( x , y ) = x * y + sin ( x )" and called 
+// with "f ( 2 , 3 )".
+// Entering "memory" prints how much memory the variables and functions use.
+// "begin" starts a block of assignments, "commit" keeps them and "rollback"
+// undoes them; blocks nest. Variables are kept in a PersistentMap, so each
+// of these is O(1).
+// Results are printed as the shortest string that reads back as the same 
+// double. Pass "--precision N" to print N significant digits instead.
+// Pass "--numeric TYPE" to do the arithmetic in float, double, long-double,
+// decimal (exact 128-bit fixed point) or compensated (Kahan-style) instead 
+// of double.
+// Errors name the token at fault, counting from 1. Division by zero is an
+// error; pass "--strict" to treat any NaN or infinite result as one too.
+// Pass "--profile-out FILE" to record which operators, variables and 
+// expressions the session used, and "--profile FILE" to specialize for a 
+// recorded profile (see Profile.h).
+// Input is read in chunks of 64 KB. A line longer than 1 MB is parsed and
+// evaluated as it is read (see StreamParser.h), so generated expressions of
+// any length fit in memory; such a line can be an expression or an
+// assignment. The program ends at "Q" or at the end of the input.
+// "bench FILE" replays a file of input lines without printing them and 
+// reports the time and hardware counters of each stage; "bench --compare"
+// tells whether two saved runs differ (see benchCommand()).
 
-int main()
+int main(int argc, char* argv[])
 {  
-    // Map data structure
-    Map<string, double> variables;
+    if (argc > 1 && string(argv[1]) == "bench")
+        return benchCommand(argc, argv);
+    
+    // Map data structure, with snapshots for begin/rollback
+    PersistentMap<string, double> variables;
+    
+    // User-defined functions, compiled when they are defined
+    Map<string, Function> functions;
+    
+    // Output format for results
+    NumberFormat format = {true, 6};
+    
+    // Numeric type used for the arithmetic
+    EvaluateFunction evaluate = evaluateAs<double>;
+    StreamFunction stream = streamAs<double>;
+    
+    // Reject NaN and infinite results
+    bool strict = false;
+    
+    // Compiled expressions, and the profile they are specialized for
+    ProgramCache cache;
+    clearProgramCache(cache);
+    cache.specialization = noSpecialization();
+    Profile loaded;
+    bool profiled = false;
+    
+    // Profile of this session, written to 'profilePath' at the end
+    Profile recorded;
+    clearProfile(recorded);
+    string profilePath;
+    
+    for (int i = 1; i < argc; i++)
+    {
+        string option = argv[i];
+        if (option == "--precision" && i + 1 < argc)
+        {
+            format.roundTrip = false;
+            format.precision = atoi(argv[++i]);
+        }
+        else if (option == "--round-trip")
+            format.roundTrip = true;
+        else if (option == "--strict")
+            strict = true;
+        else if (option == "--profile" && i + 1 < argc)
+        {
+            string error;
+            if (!readProfile(argv[++i], loaded, error))
+            {
+                cout << error << "\n";
+                return 1;
+            }
+            profiled = true;
+        }
+        else if (option == "--profile-out" && i + 1 < argc)
+            profilePath = argv[++i];
+        else if (option == "--numeric" && i + 1 < argc)
+        {
+            string type = argv[++i];
+            if (type == "float")
+            {
+                evaluate = evaluateAs<float>;
+                stream   = streamAs<float>;
+            }
+            else if (type == "double")
+            {
+                evaluate = evaluateAs<double>;
+                stream   = streamAs<double>;
+            }
+            else if (type == "long-double")
+            {
+                evaluate = evaluateAs<long double>;
+                stream   = streamAs<long double>;
+            }
+            else if (type == "decimal")
+            {
+                evaluate = evaluateAs<Decimal>;
+                stream   = streamAs<Decimal>;
+            }
+            else if (type == "compensated")
+            {
+                evaluate = evaluateAs<Compensated>;
+                stream   = streamAs<Compensated>;
+            }
+            else
+            {
+                cout << "Unknown numeric type: " << type << "\n";
+                return 1;
+            }
+        }
+        else
+        {
+            cout << "Usage: " << argv[0] << " [--precision N | --round-trip]";
+            cout << " [--numeric TYPE] [--strict]\n";
+            cout << "       [--profile FILE] [--profile-out FILE]\n";
+            cout << "       " << argv[0] << " bench FILE [options]\n";
+            return 1;
+        }
+    }
+    
+    if (profiled)
+        warmProgramCache(cache, loaded, functions);
+    Profile* profile = profilePath.empty() ? NULL : &recorded;
+    
+    // Input, read a chunk at a time
+    ChunkReader reader = {&cin, Vector<char>(CHUNK_SIZE), 0, 0};
     
     string str;    
-    // Until user decides to quit the program
+    // Until user decides to quit the program or the input ends
     while (str != "Q")
     {
         // reads an entire line into a string, and then tokenizes it separately
@@ -368,59 +1024,126 @@ int main()
         cout << "between elements.\nOr enter a variable assignment.\n";
         cout << "Then press Enter.\nPress 'Q' to quit the program.\n";
 
-        // to read the line from cin and store the result in ‘str’.
-        getline(cin, str);
+        // to read the line from cin and store the result in ‘str’. A line
+        // too long to hold is evaluated as it is read instead.
+        int status = readLine(reader, str, STREAM_THRESHOLD);
+        if (status == LINE_END_OF_INPUT)
+            break;
+        if (status == LINE_TOO_LONG)
+        {
+            evaluateLongLine(str, reader, variables, functions, stream, strict, format);
+            str.clear();
+            continue;
+        }
         
-        // special C++ object called a “string stream” to perform the 
-        // tokenizing process.
-        stringstream ss(str);
-
-        while (ss >> str)
-            expression.pushBack(str);        
+        // the tokenizing process, shared with the benchmarks and tools
+        // (see Calculator.h). 'str' is left holding the last token.
+        tokenize(str, expression);
+        if (expression.getSize() > 0)
+            str = expression[expression.getSize() - 1];
+        
+        // Nothing to evaluate when the user quits
+        if (str == "Q")
+            continue;
         
         Vector<string> postfix;
+        Vector<int> origins;
+        Diagnostic diagnostic;
         
         int startIndex = 0;
+        // Memory accounting
+        if (expression.getSize() == 1 && expression[0] == "memory")
+        {
+            printMemoryUsage(variables, functions);
+        }
+        // Blocks of assignments
+        else if (expression.getSize() == 1 && expression[0] == "begin")
+        {
+            variables.begin();
+            cout << "Transaction " << variables.transactions() << " started.\n";
+        }
+        else if (expression.getSize() == 1 && expression[0] == "commit")
+        {
+            if (variables.commit())
+                cout << "Committed.\n";
+            else
+                cout << "No transaction to commit.\n";
+        }
+        else if (expression.getSize() == 1 && expression[0] == "rollback")
+        {
+            if (variables.rollback())
+                cout << "Rolled back.\n";
+            else
+                cout << "No transaction to roll back.\n";
+        }
+        // Gradient of an expression
+        else if (expression.getSize() >= 2 && expression[0] == "grad")
+        {
+            printGradient(expression, variables, functions, format);
+        }
+        // Function definition
+        else if (defineFunction(expression, functions))
+        {
+            // Cached programs have the old function inlined
+            if (profiled)
+                warmProgramCache(cache, loaded, functions);
+            else
+                clearProgramCache(cache);
+        }
         // Assignment expression
-        if (expression.getSize() >= 3 && expression[1] == "=")
+        else if (expression.getSize() >= 3 && expression[1] == "=")
         {
             startIndex = 2;           
-            if (shuntingYard(expression, startIndex, postfix))
+            if (shuntingYard(expression, startIndex, functions, postfix, &diagnostic, &origins))
             {                                     
                 cout << "Postfix: ";
                 postfix.print();
 
                 double result = 0;
-                if (evaluatePostfix(postfix, variables, result))
+                if (evaluateExpression(postfix, variables, functions, cache, 
+                    profile, evaluate, strict, result, diagnostic))
                 {
                     // Evaluate expression[2, infinity]
                     variables.insert(expression[0], result);
                                        
-                    cout << "Result: " << result << endl;
+                    cout << "Result: " << formatNumber(result, format) << endl;
                 } 
                 else
-                    cout << "Expression was malformed.\n";       
+                {
+                    traceDiagnostic(origins, diagnostic);
+                    printError(expression, diagnostic);
+                }
             } 
             else
-                cout << "Mismatched parentheses.\n";
+                printError(expression, diagnostic);
         }
         // Regular expression
         else
         {
-            if (shuntingYard(expression, startIndex, postfix))
+            if (shuntingYard(expression, startIndex, functions, postfix, &diagnostic, &origins))
             {                                     
                 cout << "Postfix: ";
                 postfix.print();
 
                 double result = 0;
-                if (evaluatePostfix(postfix, variables, result))
-                    cout << "Result: " << result << endl; 
+                if (evaluateExpression(postfix, variables, functions, cache, 
+                    profile, evaluate, strict, result, diagnostic))
+                    cout << "Result: " << formatNumber(result, format) << endl; 
                 else 
-                    cout << "Expression was malformed.\n";        
+                {
+                    traceDiagnostic(origins, diagnostic);
+                    printError(expression, diagnostic);
+                }
             } 
             else 
-                cout << "Mismatched parentheses.\n";
+                printError(expression, diagnostic);
         }
     }    
+    
+    if (profile != NULL && !writeProfile(recorded, profilePath))
+    {
+        cout << "Could not write " << profilePath << "\n";
+        return 1;
+    }
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,647 @@
+
+// File:   fuzz_evaluator.cpp
+// Differential fuzzer for the evaluation back ends. Every expression is
+// evaluated by the reference path (shuntingYard() + evaluatePostfix()) and
+// by every compiled back end, and the results have to agree. Any mismatch
+// prints the expression and aborts, so it is reported as a crash.
+//
+// Checks, for the same expression and variable values:
+//   - compileProgram() succeeds exactly when evaluatePostfix() does
+//   - evaluateProgram(), evaluateProgramBatch(), evaluateForward(),
+//     evaluateReverse() and evaluateMultiProgram() match the reference
+//     within --ulp units (default 0, i.e. bit for bit; NaNs only have to
+//     match NaNs)
+//   - the gradients of evaluateForward() and evaluateReverse() agree, and
+//     match finite differences wherever those are stable
+//   - the Interval result of the same expression contains the reference
+//   - evaluateProgram() in long double and Decimal gives exactly the result
+//     of evaluatePostfix() in the same type, also for a fixed list of
+//     literals a double cannot hold
+//   - specializeProgram() with every superinstruction, and the variables in
+//     reverse order, does not change the results of evaluateProgram() and
+//     evaluateProgramBatch()
+//   - the register code of compileRegisterProgram(), made from the plain
+//     and the specialized program, gives the same results with
+//     evaluateRegisterProgram()
+//   - StreamParser, fed the text in chunks that cut tokens, gives the
+//     postfix of shuntingYard(), and StreamEvaluator the result and
+//     diagnostic of evaluatePostfix()
+//   - with a Diagnostic, evaluatePostfix() and evaluateProgram() report the
+//     same division by zero, and the batch evaluator reports it for the
+//     same rows
+//
+// Standalone build (random expressions from ExpressionGenerator.h):
+//   g++ -std=c++17 -O2 -I.. fuzz_evaluator.cpp -o fuzz_evaluator
+//   fuzz_evaluator [--runs N] [--seed S] [--depth D] [--variables V] [--ulp U]
+//                  [--conditions W]
+//   fuzz_evaluator --corpus N [--seed S] [--depth D] [--variables V]
+//
+// --corpus writes the variable assignments and N expressions in the format
+// the driver reads, one per line, instead of fuzzing. Benchmarks use the
+// same generator, so a seed reproduces their input exactly. --conditions
+// gives the comparisons, "and", "or" and "if" weight W (0 by default).
+//
+// libFuzzer build (the input is read as an expression):
+//   clang++ -std=c++17 -O1 -g -fsanitize=fuzzer,address -DCALCULATOR_LIBFUZZER
+//           -I.. fuzz_evaluator.cpp -o fuzz_evaluator
+
+#include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <cmath>
+#include <cfloat>
+#include "../Calculator.h"
+#include "../Program.h"
+#include "../Derivative.h"
+#include "../MultiProgram.h"
+#include "../Interval.h"
+#include "../Profile.h"
+#include "../RegisterMachine.h"
+#include "../StreamParser.h"
+#include "../ExpressionGenerator.h"
+using namespace std;
+
+
+// Number of representable doubles between 'a' and 'b'
+uint64_t ulpDistance(double a, double b)
+{
+    if (a == b)
+        return 0;
+
+    // Map the doubles onto a line of integers that is ordered the same way
+    int64_t ia, ib;
+    memcpy(&ia, &a, sizeof(a));
+    memcpy(&ib, &b, sizeof(b));
+    if (ia < 0) ia = INT64_MIN - ia;
+    if (ib < 0) ib = INT64_MIN - ib;
+
+    return (ia > ib) ? (uint64_t) ia - (uint64_t) ib : (uint64_t) ib - (uint64_t) ia;
+}
+
+// Returns true if 'a' and 'b' agree within 'ulps'. NaN only matches NaN.
+bool sameResult(double a, double b, uint64_t ulps)
+{
+    if (isnan(a) || isnan(b))
+        return isnan(a) && isnan(b);
+    return ulpDistance(a, b) <= ulps;
+}
+
+// Tolerance for sameResult(), set by --ulp
+uint64_t allowedUlps = 0;
+
+// Reports a mismatch and stops
+void fail(const Vector<string>& tokens, const string& what, double expected,
+    double actual)
+{
+    cout.precision(17);
+    cout << "MISMATCH in " << what << "\n"
+         << "  expression: " << joinTokens(tokens) << "\n"
+         << "  expected:   " << expected << "\n"
+         << "  actual:     " << actual << endl;
+    abort();
+}
+
+// Feeds the text of 'tokens' to a StreamParser in chunks of 'chunk'
+// characters, so that tokens are cut at every possible place.
+
+template <class Sink>
+bool streamText(const string& text, int chunk, Sink& sink, Diagnostic& diagnostic)
+{
+    StreamParser<Sink> parser(sink, &diagnostic);
+    for (int start = 0; start < (int) text.size(); start += chunk)
+    {
+        int size = ((int) text.size() - start < chunk) ? (int) text.size() - start : chunk;
+        if (!parser.push(text.data() + start, size))
+            return false;
+    }
+    return parser.finish();
+}
+
+// The streaming parser and evaluator have to give the same postfix tokens,
+// origins, result and diagnostic as shuntingYard() and evaluatePostfix().
+
+void checkStream(const Vector<string>& tokens, const Map<string, double>& variables)
+{
+    Vector<string> postfix;
+    Vector<int> origins;
+    Diagnostic reference = {ERROR_NONE, -1};
+    double expected = 0;
+    bool parsed = shuntingYard(tokens, 0, postfix, &reference, &origins);
+    bool evaluated = parsed && evaluatePostfix(postfix, variables, expected, &reference);
+
+    // Postfix errors are reported by the infix token they came from
+    if (parsed && !evaluated && reference.token >= 0)
+        reference.token = origins[reference.token];
+
+    string text = joinTokens(tokens);
+    Map<string, Function> noFunctions;
+    for (int chunk = 1 + (int) text.size() % 7; chunk <= (int) text.size() + 7; chunk *= 8)
+    {
+        Vector<string> streamed;
+        Vector<int> streamedOrigins;
+        PostfixCollector collector = {&streamed, &streamedOrigins};
+        Diagnostic diagnostic = {ERROR_NONE, -1};
+        streamText(text, chunk, collector, diagnostic);
+        if (streamed.getSize() > postfix.getSize())
+            fail(tokens, "StreamParser (postfix length)", postfix.getSize(), streamed.getSize());
+        for (int i = 0; i < streamed.getSize(); i++)
+        {
+            if (streamed[i] != postfix[i] || streamedOrigins[i] != origins[i])
+                fail(tokens, "StreamParser (postfix)", origins[i], streamedOrigins[i]);
+        }
+
+        StreamEvaluator<double, Map, double> evaluator(variables, noFunctions, &diagnostic);
+        diagnostic.code = ERROR_NONE;
+        double actual = 0;
+        bool streamedResult = streamText(text, chunk, evaluator, diagnostic) &&
+            evaluator.finish(actual);
+        if (streamedResult != evaluated || diagnostic.code != reference.code ||
+            diagnostic.token != reference.token)
+            fail(tokens, "StreamEvaluator (diagnostic)", reference.token, diagnostic.token);
+        if (evaluated && !sameResult(expected, actual, 0))
+            fail(tokens, "StreamEvaluator", expected, actual);
+    }
+}
+
+// Relative difference of two derivatives
+double relativeError(double a, double b)
+{
+    return (a == b) ? 0 : fabs(a - b) / fmax(fabs(a), fabs(b));
+}
+
+// The forward and reverse mode gradients of an expression with a finite
+// value have to agree with each other and with finite differences. 'tape'
+// is the one evaluateReverse() filled.
+//
+// Both modes add up the same products of partial derivatives, one for
+// each use of a variable, in different orders, so they can only differ by
+// rounding relative to the sum of their magnitudes. That sum is the sum of
+// the adjoints of the uses on the tape.
+//
+// Finite differences are taken in long double, for steps h and h / 64.
+// They only describe the double evaluation where it is well conditioned:
+// its value agrees with long double, and no sin, cos or tan is taken of an
+// argument so large that rounding it moves the result. A slope is then
+// trusted if the step changes the result by far more than rounding can
+// (rounding the value of an instruction by eps moves the result by about
+// eps times the value times its adjoint), and if the slopes left of, right
+// of and across the point agree for both steps, which they do not near a
+// kink, a jump of a conditional or a pole, or where the step winds a sin
+// around. Other slots are skipped.
+
+void checkGradient(const Vector<string>& tokens, const Vector<string>& postfix,
+    const Program& program, const double* in, double value,
+    const Vector<double>& forward, const Vector<double>& reverse,
+    const GradientTape& tape)
+{
+    int n = program.variables.getSize();
+    Vector<double> magnitudes(n);
+    for (int j = 0; j < n; j++)
+        magnitudes[j] = 0;
+    double rounding = 0;
+    bool conditioned = true;
+    for (int i = 0; i < program.code.getSize(); i++)
+    {
+        int opcode = program.code[i].opcode;
+        if (opcode == OP_VARIABLE)
+            magnitudes[program.code[i].operand] += fabs(tape.adjoints[i]);
+        if ((opcode == OP_SIN || opcode == OP_COS || opcode == OP_TAN) &&
+            !(fabs(tape.values[tape.left[i]]) <= 1e6))
+            conditioned = false;
+        rounding += fabs(tape.adjoints[i] * tape.values[i]) * DBL_EPSILON;
+    }
+
+    Map<string, long double> shifted;
+    for (int j = 0; j < n; j++)
+        shifted.insert(program.variables[j], in[j]);
+    long double center = 0;
+    evaluatePostfix(postfix, shifted, center);
+    if (!(fabsl(center - value) <= 1e-9 * fabs(value)))
+        conditioned = false;
+
+    for (int j = 0; j < n; j++)
+    {
+        // A NaN or an infinity in a branch min(), max() or if() did not
+        // take reaches the two modes differently
+        if (!isfinite(forward[j]) || !isfinite(reverse[j]) || !isfinite(magnitudes[j]))
+            continue;
+        if (fabs(forward[j] - reverse[j]) > 1e-12 * magnitudes[j])
+            fail(tokens, "evaluateReverse gradient", forward[j], reverse[j]);
+        if (!conditioned)
+            continue;
+
+        const string& name = program.variables[j];
+        double slopes[2];
+        bool stable = true;
+        double h = 1e-6 * fmax(1.0, fabs(in[j]));
+        for (int k = 0; k < 2; k++, h /= 64)
+        {
+            double up = in[j] + h, down = in[j] - h;
+            long double above = 0, below = 0;
+            shifted.insert(name, up);
+            evaluatePostfix(postfix, shifted, above);
+            shifted.insert(name, down);
+            evaluatePostfix(postfix, shifted, below);
+
+            double left  = (double) ((center - below) / (in[j] - down));
+            double right = (double) ((above - center) / (up - in[j]));
+            slopes[k] = (double) ((above - below) / (up - down));
+            if (!(fabsl(above - below) > 1e4 * rounding) ||
+                relativeError(left, right) > 1e-3)
+                stable = false;
+        }
+        shifted.insert(name, in[j]);
+
+        if (!stable || relativeError(slopes[0], slopes[1]) > 1e-4)
+            continue;
+        if (relativeError(forward[j], slopes[1]) > 1e-3)
+            fail(tokens, "evaluateForward gradient (finite difference)",
+                slopes[1], forward[j]);
+    }
+}
+
+// Returns true if two results of a type more precise than double are the
+// same. NaN only matches NaN.
+bool samePrecise(long double a, long double b)
+{
+    return (a == b) || (isnan(a) && isnan(b));
+}
+
+bool samePrecise(const Decimal& a, const Decimal& b)
+{
+    return a.units == b.units;
+}
+
+// The compiled program has to agree with the reference evaluator in T,
+// which reads every literal as written. 'inputs' are the variable values
+// by slot.
+
+template <class T>
+void checkPrecise(const Vector<string>& tokens, const Vector<string>& postfix,
+    const Map<string, double>& variables, const Program& program,
+    const Vector<double>& inputs, const string& what)
+{
+    T expected = T(), actual = T();
+    if (!evaluatePostfix(postfix, variables, expected))
+        fail(tokens, what + " evaluatePostfix (rejected)", 0, 0);
+
+    Vector<T> in(inputs.getSize());
+    for (int j = 0; j < inputs.getSize(); j++)
+        in[j] = NumericTraits<T>::fromDouble(inputs[j]);
+    evaluateProgram(program, (in.getSize() > 0) ? &in[0] : NULL, actual);
+    if (!samePrecise(expected, actual))
+        fail(tokens, what + " evaluateProgram", NumericTraits<T>::toDouble(expected),
+            NumericTraits<T>::toDouble(actual));
+}
+
+// Runs one expression through every back end. 'variables' holds the values
+// of x0, x1, ...
+
+void checkExpression(const Vector<string>& tokens,
+    const Map<string, double>& variables)
+{
+    Vector<string> postfix;
+    bool parsed = shuntingYard(tokens, 0, postfix);
+
+    double expected = 0;
+    bool evaluated = parsed && evaluatePostfix(postfix, variables, expected);
+
+    Program program;
+    Vector<int> origins;
+    Vector<double> inputs;
+    bool compiled = parsed && compileProgram(postfix, program, NULL, &origins) &&
+        bindVariables(program, variables, inputs);
+
+    if (evaluated != compiled)
+        fail(tokens, evaluated ? "compileProgram (rejected)" :
+            "compileProgram (accepted)", evaluated, compiled);
+
+    checkStream(tokens, variables);
+
+    if (!evaluated)
+        return;
+
+    const double* in = (inputs.getSize() > 0) ? &inputs[0] : NULL;
+
+    double actual = 0;
+    evaluateProgram(program, in, actual);
+    if (!sameResult(expected, actual, allowedUlps))
+        fail(tokens, "evaluateProgram", expected, actual);
+
+    // A batch of three identical rows, to exercise the lane loops
+    Vector<const double*> columns;
+    Vector<double> rows(program.variables.getSize() * 3);
+    for (int j = 0; j < program.variables.getSize(); j++)
+    {
+        for (int r = 0; r < 3; r++)
+            rows[j * 3 + r] = inputs[j];
+    }
+    for (int j = 0; j < program.variables.getSize(); j++)
+        columns.pushBack(&rows[j * 3]);
+
+    double batch[3];
+    evaluateProgramBatch(program, columns, 3, batch);
+    for (int r = 0; r < 3; r++)
+    {
+        if (!sameResult(expected, batch[r], allowedUlps))
+            fail(tokens, "evaluateProgramBatch", expected, batch[r]);
+    }
+
+    // Division by zero has to be found at the same token by both
+    // evaluators, and in every row of the batch
+    Diagnostic reference = {ERROR_NONE, -1};
+    Diagnostic compiledDiagnostic = {ERROR_NONE, -1};
+    evaluatePostfix(postfix, variables, actual, &reference);
+    evaluateProgram(program, in, actual, &compiledDiagnostic);
+    if (compiledDiagnostic.code != ERROR_NONE)
+        compiledDiagnostic.token = origins[compiledDiagnostic.token];
+    if (reference.code != compiledDiagnostic.code ||
+        reference.token != compiledDiagnostic.token)
+        fail(tokens, "division by zero diagnostic", reference.token,
+            compiledDiagnostic.token);
+
+    // Rows are numbered from an offset past the range of an int, as for a
+    // worker's range of a very long column
+    const size_t rowOffset = (size_t) 1 << 32;
+    BatchErrors errors = makeBatchErrors(false, 3);
+    evaluateProgramBatch(program, columns, 3, batch, &errors, rowOffset);
+    if (errors.count != ((reference.code == ERROR_DIVISION_BY_ZERO) ? 3 : 0))
+        fail(tokens, "batch division by zero rows", reference.code, errors.count);
+    for (int k = 0; k < errors.rows.getSize(); k++)
+    {
+        if (errors.rows[k].row != rowOffset + k)
+            fail(tokens, "batch division by zero row number", rowOffset + k,
+                errors.rows[k].row);
+    }
+
+    Specialization specialization = noSpecialization();
+    for (int k = 0; k < SUPERINSTRUCTION_COUNT; k++)
+        specialization.superinstructions[k] = true;
+    for (int j = program.variables.getSize() - 1; j >= 0; j--)
+        specialization.hotVariables.pushBack(program.variables[j]);
+
+    Program specialized = program;
+    specializeProgram(specialized, specialization);
+    Vector<double> specializedInputs;
+    bindVariables(specialized, variables, specializedInputs);
+    const double* specializedIn = (specializedInputs.getSize() > 0) ?
+        &specializedInputs[0] : NULL;
+    evaluateProgram(specialized, specializedIn, actual);
+    if (!sameResult(expected, actual, allowedUlps))
+        fail(tokens, "specialized evaluateProgram", expected, actual);
+
+    Vector<const double*> specializedColumns;
+    for (int j = 0; j < specialized.variables.getSize(); j++)
+    {
+        for (int k = 0; k < program.variables.getSize(); k++)
+        {
+            if (program.variables[k] == specialized.variables[j])
+                specializedColumns.pushBack(columns[k]);
+        }
+    }
+    evaluateProgramBatch(specialized, specializedColumns, 3, batch);
+    for (int r = 0; r < 3; r++)
+    {
+        if (!sameResult(expected, batch[r], allowedUlps))
+            fail(tokens, "specialized evaluateProgramBatch", expected, batch[r]);
+    }
+
+    RegisterProgram registers;
+    if (!compileRegisterProgram(program, registers))
+        fail(tokens, "compileRegisterProgram", expected, 0);
+    evaluateRegisterProgram(registers, in, actual);
+    if (!sameResult(expected, actual, allowedUlps))
+        fail(tokens, "evaluateRegisterProgram", expected, actual);
+
+    if (!compileRegisterProgram(specialized, registers))
+        fail(tokens, "compileRegisterProgram (specialized)", expected, 0);
+    evaluateRegisterProgram(registers, specializedIn, actual);
+    if (!sameResult(expected, actual, allowedUlps))
+        fail(tokens, "specialized evaluateRegisterProgram", expected, actual);
+
+    Vector<double> gradient;
+    evaluateForward(program, in, actual, gradient);
+    if (!sameResult(expected, actual, allowedUlps))
+        fail(tokens, "evaluateForward", expected, actual);
+
+    GradientTape tape;
+    Vector<double> reverseGradient;
+    evaluateReverse(program, in, actual, reverseGradient, tape);
+    if (!sameResult(expected, actual, allowedUlps))
+        fail(tokens, "evaluateReverse", expected, actual);
+    if (isfinite(expected))
+        checkGradient(tokens, postfix, program, in, expected, gradient,
+            reverseGradient, tape);
+
+    Vector<Program> programs;
+    programs.pushBack(program);
+    MultiProgram multi;
+    buildMultiProgram(programs, multi);
+    Vector<double> multiInputs;
+    bindVariables(multi, variables, multiInputs);
+    evaluateMultiProgram(multi,
+        (multiInputs.getSize() > 0) ? &multiInputs[0] : NULL, &actual);
+    if (!sameResult(expected, actual, allowedUlps))
+        fail(tokens, "evaluateMultiProgram", expected, actual);
+
+    // Point intervals have to contain the double result
+    Interval bounds;
+    if (!evaluatePostfix(postfix, variables, bounds))
+        fail(tokens, "interval evaluatePostfix (rejected)", expected, 0);
+    if (!isnan(expected) && !(bounds.lo <= expected && expected <= bounds.hi))
+        fail(tokens, "interval bounds", expected, bounds.lo);
+
+    checkPrecise<long double>(tokens, postfix, variables, program, inputs, "long double");
+    checkPrecise<Decimal>(tokens, postfix, variables, program, inputs, "decimal");
+}
+
+// A Compensated result that leaves the range of a double has to be the same
+// infinity as the double result, not the NaN its error term would make it.
+
+void checkOverflow(const Vector<string>& tokens,
+    const Map<string, double>& variables)
+{
+    Vector<string> postfix;
+    Program program;
+    Vector<double> inputs;
+    if (!shuntingYard(tokens, 0, postfix) || !compileProgram(postfix, program) ||
+        !bindVariables(program, variables, inputs))
+        fail(tokens, "overflow (rejected)", 0, 0);
+
+    double expected = 0;
+    evaluatePostfix(postfix, variables, expected);
+
+    Compensated reference = Compensated(), actual = Compensated();
+    evaluatePostfix(postfix, variables, reference);
+    Vector<Compensated> in(inputs.getSize());
+    for (int j = 0; j < inputs.getSize(); j++)
+        in[j] = NumericTraits<Compensated>::fromDouble(inputs[j]);
+    evaluateProgram(program, (in.getSize() > 0) ? &in[0] : NULL, actual);
+
+    double value = NumericTraits<Compensated>::toDouble(reference);
+    if (!sameResult(expected, value, 0))
+        fail(tokens, "compensated evaluatePostfix", expected, value);
+    value = NumericTraits<Compensated>::toDouble(actual);
+    if (!sameResult(expected, value, 0))
+        fail(tokens, "compensated evaluateProgram", expected, value);
+}
+
+// Sums and products past the largest double, and what follows them
+const char* const OVERFLOW_EXPRESSIONS[] =
+{
+    "1e200 * 1e200",
+    "1e308 + 1e308",
+    "-1e200 * 1e200",
+    "( 1e308 + 1e308 ) - 1",
+    "( 1e200 * 1e200 ) * 0.5",
+};
+
+// Expressions whose literals have more digits than a double holds. The
+// compiled program once kept only the double, so long double and Decimal
+// lost the difference.
+const char* const PRECISE_EXPRESSIONS[] =
+{
+    "0.10000000000000000001 - 0.1",
+    "123456789.123456789 + 0",
+    "( 0.123456789012345678 * x0 ) - ( 0.123456789012345677 * x0 )",
+};
+
+// Calls with the wrong number of arguments and commas outside of a call,
+// which every parser has to reject the same way
+const char* const MALFORMED_CALLS[] =
+{
+    "max ( 1 , 2 , 3 ) + sin ( )",
+    "max ( x0 ) * 2",
+    "if ( x0 < 1 , 2 )",
+    "( 1 , 2 ) + 3",
+    "min ( ( x0 , 2 ) , 3 )",
+    "cos ( x0 , x1 , x2 )",
+};
+
+#ifdef CALCULATOR_LIBFUZZER
+
+// libFuzzer entry point. The input is an expression in the driver's format;
+// the variables x0..x3 are always defined.
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    static Map<string, double>* variables = NULL;
+    if (variables == NULL)
+    {
+        variables = new Map<string, double>();
+        variables->insert("x0", 1.5);
+        variables->insert("x1", -2.25);
+        variables->insert("x2", 1e-3);
+        variables->insert("x3", 12345.0);
+    }
+
+    Vector<string> tokens;
+    tokenize(string((const char*) data, size), tokens);
+    checkExpression(tokens, *variables);
+    return 0;
+}
+
+#else
+
+int main(int argc, char* argv[])
+{
+    GeneratorOptions options = defaultGeneratorOptions();
+    long runs    = 100000;
+    long corpus  = 0;
+    uint64_t seed = 1;
+
+    for (int i = 1; i < argc; i++)
+    {
+        string option = argv[i];
+        if (i + 1 >= argc)
+        {
+            cout << "Missing value for " << option << "\n";
+            return 1;
+        }
+
+        if      (option == "--runs")      runs = atol(argv[++i]);
+        else if (option == "--corpus")    corpus = atol(argv[++i]);
+        else if (option == "--seed")      seed = strtoull(argv[++i], NULL, 10);
+        else if (option == "--depth")     options.maxDepth = atoi(argv[++i]);
+        else if (option == "--variables") options.variableCount = atoi(argv[++i]);
+        else if (option == "--ulp")       allowedUlps = strtoull(argv[++i], NULL, 10);
+        else if (option == "--conditions")
+        {
+            int weight = atoi(argv[++i]);
+            for (int k = GENERATOR_FIRST_CONDITION; k < GENERATOR_OPERATOR_COUNT; k++)
+                options.weights[k] = weight;
+        }
+        else
+        {
+            cout << "Unknown option " << option << "\n";
+            return 1;
+        }
+    }
+
+    Random random(seed);
+
+    // Variable values are random too, but fixed for the whole run
+    Map<string, double> variables;
+    Vector<double> values;
+    for (int v = 0; v < options.variableCount; v++)
+    {
+        values.pushBack((random.unit() - 0.5) * 20);
+        variables.insert(generatorVariable(v), values[v]);
+    }
+
+    if (corpus > 0)
+    {
+        NumberFormat format = {true, 17};
+        for (int v = 0; v < options.variableCount; v++)
+            cout << generatorVariable(v) << " = " << formatNumber(values[v], format) << "\n";
+
+        for (long n = 0; n < corpus; n++)
+        {
+            Vector<string> tokens;
+            generateExpression(random, options, options.maxDepth, tokens);
+            cout << joinTokens(tokens) << "\n";
+        }
+        return 0;
+    }
+
+    for (size_t k = 0; k < sizeof(PRECISE_EXPRESSIONS) / sizeof(PRECISE_EXPRESSIONS[0]); k++)
+    {
+        Vector<string> tokens;
+        tokenize(PRECISE_EXPRESSIONS[k], tokens);
+        checkExpression(tokens, variables);
+    }
+    for (size_t k = 0; k < sizeof(OVERFLOW_EXPRESSIONS) / sizeof(OVERFLOW_EXPRESSIONS[0]); k++)
+    {
+        Vector<string> tokens;
+        tokenize(OVERFLOW_EXPRESSIONS[k], tokens);
+        checkOverflow(tokens, variables);
+    }
+    for (size_t k = 0; k < sizeof(MALFORMED_CALLS) / sizeof(MALFORMED_CALLS[0]); k++)
+    {
+        Vector<string> tokens;
+        tokenize(MALFORMED_CALLS[k], tokens);
+        checkExpression(tokens, variables);
+    }
+
+    long tokenCount = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    for (long n = 0; n < runs; n++)
+    {
+        Vector<string> tokens;
+        generateExpression(random, options, options.maxDepth, tokens);
+        tokenCount += tokens.getSize();
+        checkExpression(tokens, variables);
+    }
+
+    double seconds = chrono::duration<double>(
+        chrono::steady_clock::now() - start).count();
+
+    cout << runs << " expressions (" << tokenCount << " tokens) agreed in "
+         << seconds << " s: " << (long) (runs / seconds) << " exec/s\n";
+    return 0;
+}
+
+#endif